@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+
+
+static void* default_allocate(size_t size, void* data) {
+    (void)data;
+    return malloc(size);
+}
+
+
+static void* default_reallocate(void* ptr, size_t size, void* data) {
+    (void)data;
+    return realloc(ptr, size);
+}
+
+
+static void default_release(void* ptr, void* data) {
+    (void)data;
+    free(ptr);
+}
+
+
+static struct qr_allocator current_allocator = {
+    default_allocate, default_reallocate, default_release, NULL
+};
+
+
+void qr_set_allocator(const struct qr_allocator* allocator) {
+    if (allocator == NULL) {
+        current_allocator.allocate = default_allocate;
+        current_allocator.reallocate = default_reallocate;
+        current_allocator.release = default_release;
+        current_allocator.data = NULL;
+    } else {
+        current_allocator = (*allocator);
+    }
+}
+
+
+void* qr_malloc(size_t size) {
+    return current_allocator.allocate(size, current_allocator.data);
+}
+
+
+void* qr_calloc(size_t n, size_t size) {
+    if (size != 0 && n > SIZE_MAX / size) {
+        return NULL;
+    }
+    void* ptr = current_allocator.allocate(n * size, current_allocator.data);
+    if (ptr != NULL) {
+        memset(ptr, 0, n * size);
+    }
+    return ptr;
+}
+
+
+void* qr_realloc(void* ptr, size_t size) {
+    return current_allocator.reallocate(ptr, size, current_allocator.data);
+}
+
+
+void qr_free(void* ptr) {
+    if (ptr != NULL) {
+        current_allocator.release(ptr, current_allocator.data);
+    }
+}
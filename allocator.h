@@ -0,0 +1,45 @@
+#ifndef _ALLOCATOR_H
+#define _ALLOCATOR_H
+
+#include <stddef.h>
+
+
+/**
+ * All the memory used by this library is obtained through the functions
+ * of this structure, so that the application can plug its own allocator,
+ * like a memory pool or an allocator that counts allocations.
+ */
+struct qr_allocator {
+    // Same as malloc(), realloc() and free() except that they
+    // receive the data field as an extra argument
+    void* (*allocate)(size_t size, void* data);
+    void* (*reallocate)(void* ptr, size_t size, void* data);
+    void (*release)(void* ptr, void* data);
+
+    // Passed to the functions above
+    void* data;
+};
+
+
+/**
+ * Makes the library use the given allocator from now on, or the standard
+ * malloc(), realloc() and free() functions if NULL. The allocator structure
+ * is copied. Since memory must be freed by the allocator that allocated it,
+ * this function must be called before any other function of the library,
+ * or when all the objects obtained from the library have been freed.
+ */
+void qr_set_allocator(const struct qr_allocator* allocator);
+
+
+/**
+ * Allocation functions used everywhere in the library on top of the
+ * current allocator. Memory returned by the library that the caller is
+ * supposed to free directly, like the result of decode_bitstream(), must
+ * be freed with qr_free().
+ */
+void* qr_malloc(size_t size);
+void* qr_calloc(size_t n, size_t size);
+void* qr_realloc(void* ptr, size_t size);
+void qr_free(void* ptr);
+
+#endif
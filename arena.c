@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include "allocator.h"
+#include "arena.h"
+
+// The default size of the chunks of memory that the arena
+// gets from the system
+#define CHUNK_SIZE 16384
+
+// All the sizes are rounded up to this value so that
+// all the blocks are aligned on it
+#define ALIGNMENT 16
+
+#define ALIGN(n) (((n) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+
+
+struct arena_chunk {
+    struct arena_chunk* next;
+
+    // The number of bytes available in this chunk and
+    // the number of bytes already allocated from it
+    unsigned int size;
+    unsigned int used;
+};
+
+
+struct arena {
+    // The chunks are kept in a list that is never shortened
+    // before the arena is freed
+    struct arena_chunk* first;
+
+    // The chunk to allocate from. The chunks after it are
+    // leftovers from before the last reset
+    struct arena_chunk* current;
+};
+
+
+/**
+ * Returns the address of the first usable byte of the given chunk.
+ */
+static u_int8_t* get_chunk_bytes(struct arena_chunk* chunk) {
+    return ((u_int8_t*)chunk) + ALIGN(sizeof(struct arena_chunk));
+}
+
+
+struct arena* new_arena() {
+    struct arena* arena = (struct arena*)qr_malloc(sizeof(struct arena));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+    return arena;
+}
+
+
+void* arena_alloc(struct arena* arena, unsigned int size) {
+    size = ALIGN(size);
+
+    // Let's look for a chunk with enough space, starting from the current one
+    struct arena_chunk* last = NULL;
+    struct arena_chunk* chunk = arena->current;
+    while (chunk != NULL && chunk->used + size > chunk->size) {
+        last = chunk;
+        chunk = chunk->next;
+    }
+
+    if (chunk == NULL) {
+        // No luck, we need a new chunk. Since the search went through all
+        // the chunks after the current one, last is the end of the list
+        unsigned int chunk_size = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+        chunk = (struct arena_chunk*)qr_malloc(ALIGN(sizeof(struct arena_chunk)) + chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = NULL;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        if (last == NULL) {
+            arena->first = chunk;
+        } else {
+            last->next = chunk;
+        }
+    }
+
+    arena->current = chunk;
+    void* block = get_chunk_bytes(chunk) + chunk->used;
+    chunk->used += size;
+    return block;
+}
+
+
+void reset_arena(struct arena* arena) {
+    for (struct arena_chunk* chunk = arena->first ; chunk != NULL ; chunk = chunk->next) {
+        chunk->used = 0;
+    }
+    arena->current = arena->first;
+}
+
+
+void free_arena(struct arena* arena) {
+    struct arena_chunk* chunk = arena->first;
+    while (chunk != NULL) {
+        struct arena_chunk* next = chunk->next;
+        qr_free(chunk);
+        chunk = next;
+    }
+    qr_free(arena);
+}
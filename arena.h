@@ -0,0 +1,43 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdint.h>
+
+
+/**
+ * An arena is a memory pool for short-lived objects that are all released
+ * at the same time. Allocating from an arena just moves a pointer forward
+ * in the current chunk of memory, and resetting the arena makes all its
+ * memory available again without giving it back to the system, so that
+ * an arena that is reset after each image quickly stops allocating.
+ */
+struct arena;
+
+
+/**
+ * Creates a new empty arena or returns NULL in case of memory allocation error.
+ */
+struct arena* new_arena();
+
+
+/**
+ * Returns a block of the given size, suitably aligned for any of the
+ * structures of this library, or NULL in case of memory allocation error.
+ * The block remains valid until the arena is reset or freed.
+ */
+void* arena_alloc(struct arena* arena, unsigned int size);
+
+
+/**
+ * Invalidates all the blocks that were allocated from the given arena
+ * and makes their memory available for new allocations.
+ */
+void reset_arena(struct arena* arena);
+
+
+/**
+ * Frees all the memory associated to the given arena.
+ */
+void free_arena(struct arena* arena);
+
+#endif
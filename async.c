@@ -0,0 +1,350 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "allocator.h"
+#include "async.h"
+
+// We don't want to start an absurd number of threads
+// if the caller asks for it
+#define MAX_ASYNC_THREADS 256
+
+
+/**
+ * A submitted image that goes through the queue of pending images,
+ * then through the list of results to collect.
+ */
+struct async_slot {
+    struct qr_async_result result;
+    struct async_slot* next;
+};
+
+
+/**
+ * A list of slots that can be consumed in FIFO order.
+ */
+struct slot_list {
+    struct async_slot* first;
+    struct async_slot* last;
+};
+
+
+struct qr_async_decoder {
+    // Where to send the results, if not NULL
+    qr_async_callback callback;
+    void* data;
+
+    // Protects all the fields below
+    pthread_mutex_t lock;
+
+    // Signaled when an image is submitted or when stopping
+    pthread_cond_t has_requests;
+
+    // Signaled when a slot becomes free
+    pthread_cond_t has_room;
+
+    // Signaled when a result is available
+    pthread_cond_t has_results;
+
+    // All the slots, each being in exactly one of the lists below
+    // or in the hands of a worker
+    struct async_slot* slots;
+    struct slot_list free_slots;
+    struct slot_list requests;
+    struct slot_list results;
+
+    // A pipe whose read end contains a byte if and only if
+    // there are results to collect
+    int result_pipe[2];
+
+    // Set when the decoder is being freed
+    int stopping;
+
+    pthread_t threads[MAX_ASYNC_THREADS];
+    struct qr_decoder* decoders[MAX_ASYNC_THREADS];
+    unsigned int n_threads;
+};
+
+
+static void push_slot(struct slot_list* list, struct async_slot* slot) {
+    slot->next = NULL;
+    if (list->last == NULL) {
+        list->first = slot;
+    } else {
+        list->last->next = slot;
+    }
+    list->last = slot;
+}
+
+
+static struct async_slot* pop_slot(struct slot_list* list) {
+    struct async_slot* slot = list->first;
+    list->first = slot->next;
+    if (list->first == NULL) {
+        list->last = NULL;
+    }
+    return slot;
+}
+
+
+/**
+ * Adds the given slot to the list of results to collect.
+ * Must be called with the lock held.
+ */
+static void add_result(struct qr_async_decoder* decoder, struct async_slot* slot) {
+    if (decoder->results.first == NULL) {
+        // Make the pipe readable
+        u_int8_t signal = 1;
+        ssize_t n = write(decoder->result_pipe[1], &signal, 1);
+        (void)n;
+    }
+    push_slot(&(decoder->results), slot);
+    pthread_cond_signal(&(decoder->has_results));
+}
+
+
+/**
+ * Removes the oldest slot from the list of results to collect.
+ * Must be called with the lock held and with a non-empty list.
+ */
+static struct async_slot* remove_result(struct qr_async_decoder* decoder) {
+    struct async_slot* slot = pop_slot(&(decoder->results));
+    if (decoder->results.first == NULL) {
+        // Make the pipe not readable anymore
+        u_int8_t signal;
+        while (read(decoder->result_pipe[0], &signal, 1) == 1);
+    }
+    return slot;
+}
+
+
+/**
+ * Makes the given slot available for a new image.
+ * Must be called with the lock held.
+ */
+static void release_slot(struct qr_async_decoder* decoder, struct async_slot* slot) {
+    push_slot(&(decoder->free_slots), slot);
+    pthread_cond_signal(&(decoder->has_room));
+}
+
+
+/**
+ * The arguments of a worker thread.
+ */
+struct async_worker {
+    struct qr_async_decoder* async_decoder;
+    struct qr_decoder* decoder;
+};
+
+
+/**
+ * Decodes images from the queue until the async decoder is stopping
+ * and the queue is empty.
+ */
+static void* decode_requests(void* data) {
+    struct qr_async_decoder* async_decoder = ((struct async_worker*)data)->async_decoder;
+    struct qr_decoder* decoder = ((struct async_worker*)data)->decoder;
+    qr_free(data);
+
+    pthread_mutex_lock(&(async_decoder->lock));
+    for (;;) {
+        while (async_decoder->requests.first == NULL && !async_decoder->stopping) {
+            pthread_cond_wait(&(async_decoder->has_requests), &(async_decoder->lock));
+        }
+        if (async_decoder->requests.first == NULL) {
+            break;
+        }
+        struct async_slot* slot = pop_slot(&(async_decoder->requests));
+        pthread_mutex_unlock(&(async_decoder->lock));
+
+        struct qr_async_result* result = &(slot->result);
+        result->res = find_qr_codes_in_rgb_image(decoder, result->image, &(result->matches), NULL);
+        if (result->res != SUCCESS) {
+            result->matches = NULL;
+        }
+        if (async_decoder->callback != NULL) {
+            async_decoder->callback(*result, async_decoder->data);
+        }
+
+        pthread_mutex_lock(&(async_decoder->lock));
+        if (async_decoder->callback != NULL) {
+            release_slot(async_decoder, slot);
+        } else {
+            add_result(async_decoder, slot);
+        }
+    }
+    pthread_mutex_unlock(&(async_decoder->lock));
+    return NULL;
+}
+
+
+/**
+ * Frees everything but the threads, that must have been stopped.
+ */
+static void free_async_resources(struct qr_async_decoder* decoder) {
+    while (decoder->results.first != NULL) {
+        free_qr_code_match_list(remove_result(decoder)->result.matches);
+    }
+    for (unsigned int i = 0 ; i < decoder->n_threads ; i++) {
+        free_qr_decoder(decoder->decoders[i]);
+    }
+    close(decoder->result_pipe[0]);
+    close(decoder->result_pipe[1]);
+    pthread_cond_destroy(&(decoder->has_results));
+    pthread_cond_destroy(&(decoder->has_room));
+    pthread_cond_destroy(&(decoder->has_requests));
+    pthread_mutex_destroy(&(decoder->lock));
+    qr_free(decoder->slots);
+    qr_free(decoder);
+}
+
+
+/**
+ * Stops and joins the threads that were started.
+ */
+static void stop_threads(struct qr_async_decoder* decoder, unsigned int n_started) {
+    pthread_mutex_lock(&(decoder->lock));
+    decoder->stopping = 1;
+    pthread_cond_broadcast(&(decoder->has_requests));
+    pthread_mutex_unlock(&(decoder->lock));
+    for (unsigned int i = 0 ; i < n_started ; i++) {
+        pthread_join(decoder->threads[i], NULL);
+    }
+}
+
+
+struct qr_async_decoder* new_qr_async_decoder(unsigned int n_threads, unsigned int queue_size,
+                                            qr_async_callback callback, void* data) {
+    if (n_threads == 0 || queue_size == 0) {
+        return NULL;
+    }
+    if (n_threads > MAX_ASYNC_THREADS) {
+        n_threads = MAX_ASYNC_THREADS;
+    }
+    struct qr_async_decoder* decoder = (struct qr_async_decoder*)qr_calloc(1, sizeof(struct qr_async_decoder));
+    if (decoder == NULL) {
+        return NULL;
+    }
+    decoder->slots = (struct async_slot*)qr_malloc(queue_size * sizeof(struct async_slot));
+    if (decoder->slots == NULL) {
+        qr_free(decoder);
+        return NULL;
+    }
+    for (unsigned int i = 0 ; i < queue_size ; i++) {
+        push_slot(&(decoder->free_slots), &(decoder->slots[i]));
+    }
+    decoder->callback = callback;
+    decoder->data = data;
+
+    if (0 != pthread_mutex_init(&(decoder->lock), NULL)) {
+        qr_free(decoder->slots);
+        qr_free(decoder);
+        return NULL;
+    }
+    if (0 != pthread_cond_init(&(decoder->has_requests), NULL)) {
+        pthread_mutex_destroy(&(decoder->lock));
+        qr_free(decoder->slots);
+        qr_free(decoder);
+        return NULL;
+    }
+    if (0 != pthread_cond_init(&(decoder->has_room), NULL)) {
+        pthread_cond_destroy(&(decoder->has_requests));
+        pthread_mutex_destroy(&(decoder->lock));
+        qr_free(decoder->slots);
+        qr_free(decoder);
+        return NULL;
+    }
+    if (0 != pthread_cond_init(&(decoder->has_results), NULL)) {
+        pthread_cond_destroy(&(decoder->has_room));
+        pthread_cond_destroy(&(decoder->has_requests));
+        pthread_mutex_destroy(&(decoder->lock));
+        qr_free(decoder->slots);
+        qr_free(decoder);
+        return NULL;
+    }
+    if (0 != pipe(decoder->result_pipe)) {
+        pthread_cond_destroy(&(decoder->has_results));
+        pthread_cond_destroy(&(decoder->has_room));
+        pthread_cond_destroy(&(decoder->has_requests));
+        pthread_mutex_destroy(&(decoder->lock));
+        qr_free(decoder->slots);
+        qr_free(decoder);
+        return NULL;
+    }
+    // The workers must never block on the pipe and draining it must stop when it is empty
+    fcntl(decoder->result_pipe[0], F_SETFL, fcntl(decoder->result_pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(decoder->result_pipe[1], F_SETFL, fcntl(decoder->result_pipe[1], F_GETFL) | O_NONBLOCK);
+
+    // Decoders are created here rather than in the threads, so that a failure
+    // can be reported instead of leaving submitted images without a worker
+    for (unsigned int i = 0 ; i < n_threads ; i++) {
+        decoder->decoders[i] = new_qr_decoder();
+        if (decoder->decoders[i] == NULL) {
+            free_async_resources(decoder);
+            return NULL;
+        }
+        decoder->n_threads++;
+    }
+
+    for (unsigned int i = 0 ; i < n_threads ; i++) {
+        struct async_worker* worker = (struct async_worker*)qr_malloc(sizeof(struct async_worker));
+        if (worker != NULL) {
+            worker->async_decoder = decoder;
+            worker->decoder = decoder->decoders[i];
+        }
+        if (worker == NULL || 0 != pthread_create(&(decoder->threads[i]), NULL, decode_requests, worker)) {
+            qr_free(worker);
+            stop_threads(decoder, i);
+            free_async_resources(decoder);
+            return NULL;
+        }
+    }
+
+    return decoder;
+}
+
+
+int submit_qr_image(struct qr_async_decoder* decoder, struct rgb_image* image, void* tag, int blocking) {
+    pthread_mutex_lock(&(decoder->lock));
+    while (decoder->free_slots.first == NULL) {
+        if (!blocking) {
+            pthread_mutex_unlock(&(decoder->lock));
+            return WOULD_BLOCK;
+        }
+        pthread_cond_wait(&(decoder->has_room), &(decoder->lock));
+    }
+    struct async_slot* slot = pop_slot(&(decoder->free_slots));
+    slot->result.image = image;
+    slot->result.tag = tag;
+    push_slot(&(decoder->requests), slot);
+    pthread_cond_signal(&(decoder->has_requests));
+    pthread_mutex_unlock(&(decoder->lock));
+    return SUCCESS;
+}
+
+
+int poll_qr_result(struct qr_async_decoder* decoder, struct qr_async_result* result, int blocking) {
+    pthread_mutex_lock(&(decoder->lock));
+    while (decoder->results.first == NULL) {
+        if (!blocking) {
+            pthread_mutex_unlock(&(decoder->lock));
+            return WOULD_BLOCK;
+        }
+        pthread_cond_wait(&(decoder->has_results), &(decoder->lock));
+    }
+    struct async_slot* slot = remove_result(decoder);
+    *result = slot->result;
+    release_slot(decoder, slot);
+    pthread_mutex_unlock(&(decoder->lock));
+    return SUCCESS;
+}
+
+
+int get_qr_result_fd(struct qr_async_decoder* decoder) {
+    return decoder->result_pipe[0];
+}
+
+
+void free_qr_async_decoder(struct qr_async_decoder* decoder) {
+    stop_threads(decoder, decoder->n_threads);
+    free_async_resources(decoder);
+}
@@ -0,0 +1,101 @@
+#ifndef _ASYNC_H
+#define _ASYNC_H
+
+#include "qrcode.h"
+#include "rgbimage.h"
+
+
+/**
+ * An asynchronous decoder runs a pool of worker threads, each with its own
+ * decoder, that take images from a bounded queue. This makes it possible for
+ * an event loop to submit images and to collect the results later without
+ * ever blocking on a decoding.
+ */
+struct qr_async_decoder;
+
+
+/**
+ * The result of the decoding of a submitted image.
+ */
+struct qr_async_result {
+    // The image and the tag that were submitted
+    struct rgb_image* image;
+    void* tag;
+
+    // The value that find_qr_codes() would have returned for the image
+    int res;
+
+    // The matches found in the image, to be freed with
+    // free_qr_code_match_list(), or NULL if res is not SUCCESS
+    struct qr_code_match_list* matches;
+};
+
+
+/**
+ * Function called from a worker thread each time an image has been decoded.
+ * It must be thread-safe and it takes ownership of the matches, if any.
+ */
+typedef void (*qr_async_callback)(struct qr_async_result result, void* data);
+
+
+/**
+ * Creates an asynchronous decoder.
+ *
+ * @param n_threads The number of worker threads
+ * @param queue_size The maximum number of submitted images whose results
+ *                   have not been received yet, which bounds the memory used
+ *                   when the caller submits faster than images are decoded
+ * @param callback If not NULL, the function that receives the results. If
+ *                 NULL, the results are kept until they are collected with
+ *                 poll_qr_result()
+ * @param data The data to pass to the callback
+ * @return The decoder or NULL in case of error
+ */
+struct qr_async_decoder* new_qr_async_decoder(unsigned int n_threads, unsigned int queue_size,
+                                            qr_async_callback callback, void* data);
+
+
+/**
+ * Submits an image. The image must not be modified or freed before
+ * its result has been received.
+ *
+ * @param decoder The decoder
+ * @param image The image to decode
+ * @param tag Anything that helps the caller to identify the result
+ * @param blocking If not 0 and the queue is full, waits until a result
+ *                 has been received
+ * @return SUCCESS if the image was queued
+ *         WOULD_BLOCK if the queue is full and blocking is 0
+ */
+int submit_qr_image(struct qr_async_decoder* decoder, struct rgb_image* image, void* tag, int blocking);
+
+
+/**
+ * Gets the next available result when there is no callback.
+ *
+ * @param decoder The decoder
+ * @param result Where to store the result
+ * @param blocking If not 0 and there is no result yet, waits for one. Note that
+ *                 waiting while no image is being decoded waits forever
+ * @return SUCCESS if a result was stored
+ *         WOULD_BLOCK if there is no result and blocking is 0
+ */
+int poll_qr_result(struct qr_async_decoder* decoder, struct qr_async_result* result, int blocking);
+
+
+/**
+ * Returns a file descriptor that is readable as long as there are results
+ * to collect with poll_qr_result(), so that it can be watched with poll(),
+ * select() or epoll like a socket. It must not be read or closed by the caller.
+ */
+int get_qr_result_fd(struct qr_async_decoder* decoder);
+
+
+/**
+ * Waits for all the submitted images to be decoded, stops the worker
+ * threads and frees the decoder. The results that were not collected
+ * are freed.
+ */
+void free_qr_async_decoder(struct qr_async_decoder* decoder);
+
+#endif
@@ -0,0 +1,139 @@
+#include <pthread.h>
+#include "batch.h"
+
+// We don't want to start an absurd number of threads
+// if the caller asks for it
+#define MAX_BATCH_THREADS 256
+
+
+/**
+ * The state shared by the threads that decode a batch.
+ */
+struct batch_job {
+    struct qr_batch_input* inputs;
+    unsigned int n_inputs;
+
+    // Where to store the results, if not NULL
+    struct qr_batch_result* results;
+
+    // Where to send the results, if not NULL
+    qr_batch_callback callback;
+    void* data;
+
+    // Protects the fields below
+    pthread_mutex_t lock;
+
+    // The next image to be decoded
+    unsigned int next_input;
+
+    // The number of threads that managed to create a decoder
+    unsigned int n_decoders;
+};
+
+
+/**
+ * Decodes images of the given job until there are no more images.
+ */
+static void* decode_images(void* data) {
+    struct batch_job* job = (struct batch_job*)data;
+    struct qr_decoder* decoder = new_qr_decoder();
+    if (decoder == NULL) {
+        // The other threads will do the job
+        return NULL;
+    }
+
+    pthread_mutex_lock(&(job->lock));
+    job->n_decoders++;
+    pthread_mutex_unlock(&(job->lock));
+
+    for (;;) {
+        pthread_mutex_lock(&(job->lock));
+        if (job->next_input == job->n_inputs) {
+            pthread_mutex_unlock(&(job->lock));
+            break;
+        }
+        unsigned int i = job->next_input++;
+        pthread_mutex_unlock(&(job->lock));
+
+        struct qr_batch_result result;
+        struct qr_batch_input* input = &(job->inputs[i]);
+        if (input->png != NULL) {
+            result.res = find_qr_codes_with_decoder(decoder, input->png, &(result.matches), NULL);
+        } else {
+            result.res = find_qr_codes_in_rgb_image(decoder, input->image, &(result.matches), NULL);
+        }
+
+        if (job->results != NULL) {
+            job->results[i] = result;
+        } else {
+            job->callback(i, result, job->data);
+        }
+    }
+
+    free_qr_decoder(decoder);
+    return NULL;
+}
+
+
+/**
+ * Runs the given job on the given number of threads.
+ */
+static int run_batch_job(struct batch_job* job, unsigned int n_threads) {
+    job->next_input = 0;
+    job->n_decoders = 0;
+    if (0 != pthread_mutex_init(&(job->lock), NULL)) {
+        return MEMORY_ERROR;
+    }
+
+    // There is no point in having more threads than images, and the
+    // current thread counts as one of them
+    if (n_threads > job->n_inputs) {
+        n_threads = job->n_inputs;
+    }
+    if (n_threads > MAX_BATCH_THREADS) {
+        n_threads = MAX_BATCH_THREADS;
+    }
+    pthread_t threads[MAX_BATCH_THREADS];
+    unsigned int n_started = 0;
+    while (n_started + 1 < n_threads) {
+        if (0 != pthread_create(&(threads[n_started]), NULL, decode_images, job)) {
+            // If we cannot start more threads, the ones we have will do the job
+            break;
+        }
+        n_started++;
+    }
+    decode_images(job);
+    for (unsigned int i = 0 ; i < n_started ; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&(job->lock));
+
+    if (job->n_decoders == 0 && job->n_inputs > 0) {
+        return MEMORY_ERROR;
+    }
+    return SUCCESS;
+}
+
+
+int find_qr_codes_in_batch(struct qr_batch_input* inputs, unsigned int n_inputs, unsigned int n_threads,
+                            struct qr_batch_result* results) {
+    struct batch_job job;
+    job.inputs = inputs;
+    job.n_inputs = n_inputs;
+    job.results = results;
+    job.callback = NULL;
+    job.data = NULL;
+    return run_batch_job(&job, n_threads);
+}
+
+
+int find_qr_codes_in_batch_with_callback(struct qr_batch_input* inputs, unsigned int n_inputs, unsigned int n_threads,
+                                        qr_batch_callback callback, void* data) {
+    struct batch_job job;
+    job.inputs = inputs;
+    job.n_inputs = n_inputs;
+    job.results = NULL;
+    job.callback = callback;
+    job.data = data;
+    return run_batch_job(&job, n_threads);
+}
@@ -0,0 +1,71 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include "qrcode.h"
+#include "rgbimage.h"
+
+
+/**
+ * An image to decode as part of a batch.
+ */
+struct qr_batch_input {
+    // The path of a png file, or NULL if the image is given below
+    const char* png;
+
+    // The image to analyze if png is NULL. It is not modified, so
+    // the same image can appear several times in a batch
+    struct rgb_image* image;
+};
+
+
+/**
+ * The result of the decoding of one image of a batch.
+ */
+struct qr_batch_result {
+    // The value that find_qr_codes() would have returned for the image
+    int res;
+
+    // The matches found in the image, to be freed with
+    // free_qr_code_match_list(), or NULL if res is not SUCCESS
+    struct qr_code_match_list* matches;
+};
+
+
+/**
+ * Function called each time an image of a batch has been decoded. It is called
+ * from the worker threads, so it must be thread-safe, and it takes ownership
+ * of the matches, if any.
+ *
+ * @param index The position of the image in the batch
+ * @param result The result for this image
+ * @param data The data pointer that was given with the callback
+ */
+typedef void (*qr_batch_callback)(unsigned int index, struct qr_batch_result result, void* data);
+
+
+/**
+ * Decodes the given images on a pool of threads, each with its own decoder,
+ * the current thread being one of them. The results are stored in input order.
+ *
+ * @param inputs The images to decode
+ * @param n_inputs The number of images
+ * @param n_threads The number of threads to use. If some threads cannot be
+ *                  started, the other ones do all the work
+ * @param results An array of n_inputs elements where to store the results
+ * @return SUCCESS once all the images have been processed, whatever their results
+ *         MEMORY_ERROR if not a single decoder could be created, in which
+ *                      case no image was processed
+ */
+int find_qr_codes_in_batch(struct qr_batch_input* inputs, unsigned int n_inputs, unsigned int n_threads,
+                            struct qr_batch_result* results);
+
+
+/**
+ * Same as find_qr_codes_in_batch() except that each result is passed to the
+ * given callback as soon as it is available, so that the results may come in
+ * any order.
+ */
+int find_qr_codes_in_batch_with_callback(struct qr_batch_input* inputs, unsigned int n_inputs, unsigned int n_threads,
+                                        qr_batch_callback callback, void* data);
+
+#endif
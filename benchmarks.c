@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "galoisfield.h"
+#include "polynomial.h"
+#include "reedsolomon.h"
+
+// The block shape used for the benchmarks: 30 error correction
+// codewords is the most that a QR code block can have
+#define N_DATA_CODEWORDS 24
+#define N_ERROR_CORRECTION_CODEWORDS 30
+#define N_CODEWORDS (N_DATA_CODEWORDS + N_ERROR_CORRECTION_CODEWORDS)
+
+// The number of blocks to correct for each measure
+#define N_ITERATIONS 20000
+
+
+/**
+ * Fills the error correction codewords of the given block by calculating
+ * the remainder of the division of the data polynomial multiplied by
+ * X^N_ERROR_CORRECTION_CODEWORDS by the generator polynomial
+ * G(X) = (X - alpha^0)(X - alpha^1)...(X - alpha^(N_ERROR_CORRECTION_CODEWORDS - 1))
+ *
+ * Returns 1 on success, 0 on memory allocation error.
+ */
+static int encode_block(u_int8_t* codewords) {
+    struct gf_polynomial* generator = get_monomial(0, 1);
+    if (generator == NULL) {
+        return 0;
+    }
+    for (unsigned int i = 0 ; i < N_ERROR_CORRECTION_CODEWORDS ; i++) {
+        struct gf_polynomial* factor = new_gf_polynomial(2, (u_int8_t[]){ 1, gf_power(i) });
+        if (factor == NULL) {
+            free_gf_polynomial(generator);
+            return 0;
+        }
+        struct gf_polynomial* product = multiply_polynomials(generator, factor);
+        free_gf_polynomial(factor);
+        free_gf_polynomial(generator);
+        if (product == NULL) {
+            return 0;
+        }
+        generator = product;
+    }
+
+    // Let's do the division synthetically in place, knowing that the
+    // generator is monic
+    u_int8_t tmp[N_CODEWORDS] = { 0 };
+    memcpy(tmp, codewords, N_DATA_CODEWORDS);
+    for (unsigned int i = 0 ; i < N_DATA_CODEWORDS ; i++) {
+        u_int8_t coeff = tmp[i];
+        for (unsigned int j = 1 ; coeff != 0 && j <= N_ERROR_CORRECTION_CODEWORDS ; j++) {
+            u_int8_t g = get_coefficient(generator, N_ERROR_CORRECTION_CODEWORDS - j);
+            tmp[i + j] = gf_add_or_subtract(tmp[i + j], gf_multiply(g, coeff));
+        }
+    }
+    free_gf_polynomial(generator);
+
+    memcpy(codewords + N_DATA_CODEWORDS, tmp + N_DATA_CODEWORDS, N_ERROR_CORRECTION_CODEWORDS);
+    return 1;
+}
+
+
+// The corrupted blocks to correct for a measure and their syndromes
+static u_int8_t corrupted[N_ITERATIONS][N_CODEWORDS];
+static u_int8_t syndromes[N_ITERATIONS][N_ERROR_CORRECTION_CODEWORDS];
+
+
+/**
+ * Returns the average time in nanoseconds needed by the given engine to
+ * calculate sigma and omega for a block with the given number of errors,
+ * or -1 if the resulting polynomials cannot be used to correct the blocks.
+ */
+static double measure(u_int8_t* reference, unsigned int n_errors, ErrorLocatorEngine engine) {
+    // Let's always use the same pseudo-random errors for both engines
+    srand(n_errors);
+    for (unsigned int i = 0 ; i < N_ITERATIONS ; i++) {
+        memcpy(corrupted[i], reference, N_CODEWORDS);
+        unsigned int start = rand() % N_CODEWORDS;
+        for (unsigned int j = 0 ; j < n_errors ; j++) {
+            corrupted[i][(start + 3 * j) % N_CODEWORDS] ^= 1 + rand() % 255;
+        }
+        struct gf_polynomial message = { corrupted[i], N_CODEWORDS };
+        struct gf_polynomial s = { syndromes[i], N_ERROR_CORRECTION_CODEWORDS };
+        calculate_syndromes(&message, &s);
+    }
+
+    u_int8_t sigma_coefficients[MAX_RS_POLYNOMIAL_SIZE];
+    u_int8_t omega_coefficients[MAX_RS_POLYNOMIAL_SIZE];
+    struct gf_polynomial sigma = { sigma_coefficients, 0 };
+    struct gf_polynomial omega = { omega_coefficients, 0 };
+
+    int ok = 1;
+    clock_t start = clock();
+    for (unsigned int i = 0 ; i < N_ITERATIONS ; i++) {
+        struct gf_polynomial s = { syndromes[i], N_ERROR_CORRECTION_CODEWORDS };
+        int res = (engine == EUCLIDEAN_ALGORITHM)
+                    ? calculate_sigma_omega(&s, N_ERROR_CORRECTION_CODEWORDS, &sigma, &omega)
+                    : calculate_sigma_omega_berlekamp_massey(&s, N_ERROR_CORRECTION_CODEWORDS, &sigma, &omega);
+        ok = ok && res == SUCCESS && get_degree(&sigma) == n_errors;
+    }
+    clock_t total = clock() - start;
+
+    // Let's make sure that the whole correction works with this engine
+    struct block b;
+    b.n_data_codewords = N_DATA_CODEWORDS;
+    b.n_error_correction_codewords = N_ERROR_CORRECTION_CODEWORDS;
+    for (unsigned int i = 0 ; ok && i < N_ITERATIONS ; i++) {
+        b.codewords = corrupted[i];
+        ok = error_correction_with_engine(&b, engine) == (int)n_errors
+                && 0 == memcmp(corrupted[i], reference, N_CODEWORDS);
+    }
+    if (!ok) {
+        return -1;
+    }
+    return (1e9 * total / CLOCKS_PER_SEC) / N_ITERATIONS;
+}
+
+
+/**
+ * Returns the average time in nanoseconds needed by the given kernel to
+ * calculate the syndromes of the given block.
+ */
+static double measure_syndromes(u_int8_t* reference, SyndromeKernel kernel) {
+    u_int8_t coefficients[N_ERROR_CORRECTION_CODEWORDS];
+    struct gf_polynomial message = { reference, N_CODEWORDS };
+    struct gf_polynomial s = { coefficients, N_ERROR_CORRECTION_CODEWORDS };
+    clock_t start = clock();
+    for (unsigned int i = 0 ; i < N_ITERATIONS ; i++) {
+        reference[i % N_DATA_CODEWORDS] ^= 1;
+        calculate_syndromes_with_kernel(&message, &s, kernel);
+        reference[i % N_DATA_CODEWORDS] ^= 1;
+    }
+    return (1e9 * (clock() - start) / CLOCKS_PER_SEC) / N_ITERATIONS;
+}
+
+
+int main() {
+    u_int8_t reference[N_CODEWORDS];
+    for (unsigned int i = 0 ; i < N_DATA_CODEWORDS ; i++) {
+        reference[i] = i * 37 + 11;
+    }
+    if (!encode_block(reference)) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 1;
+    }
+
+    printf("Calculation of sigma and omega for a %d+%d block, average time per block:\n\n",
+            N_DATA_CODEWORDS, N_ERROR_CORRECTION_CODEWORDS);
+    printf("errors      Euclid  Berlekamp-Massey\n");
+    for (unsigned int n_errors = 1 ; n_errors <= MAX_ERROR_CORRECTION_CAPACITY ; n_errors++) {
+        double euclid = measure(reference, n_errors, EUCLIDEAN_ALGORITHM);
+        double bm = measure(reference, n_errors, BERLEKAMP_MASSEY);
+        if (euclid < 0 || bm < 0) {
+            fprintf(stderr, "Failed to correct %d errors\n", n_errors);
+            return 1;
+        }
+        printf("%6d  %8.0fns  %14.0fns\n", n_errors, euclid, bm);
+    }
+
+    const char* kernel_names[] = { "auto", "scalar", "SSSE3", "AVX2" };
+    printf("\nCalculation of the syndromes of the same block, average time per block:\n\n");
+    for (SyndromeKernel kernel = SYNDROMES_AUTO ; kernel <= SYNDROMES_AVX2 ; kernel++) {
+        if (is_syndrome_kernel_supported(kernel)) {
+            printf("%8s  %6.0fns\n", kernel_names[kernel], measure_syndromes(reference, kernel));
+        } else {
+            printf("%8s  not supported\n", kernel_names[kernel]);
+        }
+    }
+    return 0;
+}
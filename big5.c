@@ -5,7 +5,7 @@
 // given pointer. The array starts with pointer = 942
 // A value of 0 means that the pointer does not have
 // a valid code point
-static u_int32_t big5_index_codepoint[]= {
+static const u_int32_t big5_index_codepoint[]= {
  0x043f0, 0x04c32, 0x04603, 0x045a6, 0x04578, 0x27267, 0x04d77, 0x045b3, 0x27cb1, 0x04ce2, 0x27cc5, 0x03b95, 0x04736, 0x04744, 0x04c47, 0x04c40,
  0x242bf, 0x23617, 0x27352, 0x26e8b, 0x270d2, 0x04c57, 0x2a351, 0x0474f, 0x045da, 0x04c85, 0x27c6c, 0x04d07, 0x04aa4, 0x046a1, 0x26b23, 0x07225,
  0x25a54, 0x21a63, 0x23e06, 0x23f61, 0x0664d, 0x056fb, 0x00000, 0x07d95, 0x0591d, 0x28bb9, 0x03df4, 0x09734, 0x27bef, 0x05bdb, 0x21d5e, 0x05aa4,
@@ -1,20 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include "allocator.h"
 #include "binarize.h"
 
-static unsigned int BLOCK_SIZE = 8;
-static unsigned int MIN_DYNAMIC_RANGE = 24;
+static const unsigned int BLOCK_SIZE = 8;
+static const unsigned int MIN_DYNAMIC_RANGE = 24;
 
-/**
- * Returns a matrix giving for each RGB pixel an 8-bit luminance value.
- */
-static u_int8_t* calculate_luminances(struct rgb_image* img) {
+void calculate_luminances(struct rgb_image* img, u_int8_t* luminances) {
     unsigned int size = img->width * img->height;
-    u_int8_t* luminances = (u_int8_t*)malloc(size * sizeof(u_int8_t));
-    if (luminances == NULL) {
-        return NULL;
-    }
     int j = 0;
     unsigned int size_rgb_buffer = size * 3;
     for (unsigned int offset = 0 ; offset < size_rgb_buffer ; offset += 3) {
@@ -25,8 +20,6 @@ static u_int8_t* calculate_luminances(struct rgb_image* img) {
         // as red and blue when it comes to brightness
         luminances[j++] = (u_int8_t) ((red + green * 2 + blue) / 4);
     }
-
-    return luminances;
 }
 
 
@@ -34,16 +27,10 @@ static u_int8_t* calculate_luminances(struct rgb_image* img) {
  * For each block of 8x8 pixels, this function calculates a
  * threshold value representing the limit between black and white.
  */
-static u_int8_t* calculate_black_points(u_int8_t* luminances,
+static void calculate_black_points(u_int8_t* luminances,
                 unsigned int subWidth, unsigned int subHeight,
-                unsigned int width, unsigned int height) {
-
-    unsigned int size = subWidth * subHeight;
-    u_int8_t* black_points = (u_int8_t*)malloc(size * sizeof(u_int8_t));
-    if (black_points == NULL) {
-        return NULL;
-    }
-
+                unsigned int width, unsigned int height,
+                u_int8_t* black_points) {
     for (unsigned int y = 0 ; y < subHeight ; y++) {
         for (unsigned int x = 0 ; x < subWidth ; x++) {
             unsigned int sum = 0;
@@ -93,8 +80,6 @@ static u_int8_t* calculate_black_points(u_int8_t* luminances,
             black_points[y * subWidth + x] = average;
         }
     }
-
-    return black_points;
 }
 
 
@@ -157,6 +142,19 @@ static void calculate_threshold_for_blocks(u_int8_t* luminances,
 }
 
 
+/**
+ * Returns the number of blocks needed to cover the given number of pixels.
+ */
+static unsigned int get_n_blocks(unsigned int n_pixels) {
+    return (n_pixels / BLOCK_SIZE) + ((n_pixels % BLOCK_SIZE) != 0);
+}
+
+
+unsigned int get_n_black_points(unsigned int width, unsigned int height) {
+    return get_n_blocks(width) * get_n_blocks(height);
+}
+
+
 /**
  * This function creates a bit matrix from the given image
  * using the same implementation as in the HybridBinarizer in
@@ -165,30 +163,41 @@ static void calculate_threshold_for_blocks(u_int8_t* luminances,
  * https://github.com/zxing/zxing/blob/master/core/src/main/java/com/google/zxing/common/HybridBinarizer.java
  */
 struct bit_matrix* binarize(struct rgb_image* img) {
-    u_int8_t* luminances = calculate_luminances(img);
+    u_int8_t* luminances = (u_int8_t*)qr_malloc(img->width * img->height * sizeof(u_int8_t));
     if (luminances == NULL) {
         return NULL;
     }
-
-    unsigned int subWidth = (img->width / BLOCK_SIZE);
-    if ((img->width % BLOCK_SIZE) != 0) {
-        subWidth++;
-    }
-    unsigned int subHeight = (img->height / BLOCK_SIZE);
-    if ((img->height % BLOCK_SIZE) != 0) {
-        subHeight++;
-    }
-
-    u_int8_t* black_points = calculate_black_points(luminances, subWidth, subHeight, img->width, img->height);
+    u_int8_t* black_points = (u_int8_t*)qr_malloc(get_n_black_points(img->width, img->height) * sizeof(u_int8_t));
     if (black_points == NULL) {
-        free(luminances);
+        qr_free(luminances);
         return NULL;
     }
-
     struct bit_matrix* bm = create_bit_matrix(img->width, img->height);
-    calculate_threshold_for_blocks(luminances, subWidth, subHeight, img->width, img->height, black_points, bm);
+    if (bm != NULL) {
+        binarize_with_buffers(img, luminances, black_points, bm);
+    }
 
-    free(luminances);
-    free(black_points);
+    qr_free(luminances);
+    qr_free(black_points);
     return bm;
 }
+
+
+void binarize_with_buffers(struct rgb_image* img, u_int8_t* luminances, u_int8_t* black_points,
+                            struct bit_matrix* bm) {
+    calculate_luminances(img, luminances);
+    binarize_luminances(luminances, black_points, bm);
+}
+
+
+void binarize_luminances(u_int8_t* luminances, u_int8_t* black_points, struct bit_matrix* bm) {
+    unsigned int subWidth = get_n_blocks(bm->width);
+    unsigned int subHeight = get_n_blocks(bm->height);
+    calculate_black_points(luminances, subWidth, subHeight, bm->width, bm->height, black_points);
+
+    // Only black pixels are set when thresholding, so the matrix
+    // must be all white to begin with
+    unsigned int n_pixels = bm->width * bm->height;
+    memset(bm->matrix, 0, (n_pixels / 8) + ((n_pixels % 8) != 0));
+    calculate_threshold_for_blocks(luminances, subWidth, subHeight, bm->width, bm->height, black_points, bm);
+}
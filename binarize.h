@@ -11,4 +11,44 @@
  */
 struct bit_matrix* binarize(struct rgb_image* img);
 
+
+/**
+ * Returns the number of bytes needed by binarize_with_buffers()
+ * to store the black points of an image of the given dimensions.
+ */
+unsigned int get_n_black_points(unsigned int width, unsigned int height);
+
+
+/**
+ * Same as binarize() but all the memory is provided by the caller,
+ * so that the same buffers can be reused for many images.
+ *
+ * @param img The image to convert
+ * @param luminances A buffer of at least width x height bytes
+ * @param black_points A buffer of at least get_n_black_points(width, height) bytes
+ * @param bm A matrix with the same dimensions as the image. Its
+ *           previous content does not matter
+ */
+void binarize_with_buffers(struct rgb_image* img, u_int8_t* luminances, u_int8_t* black_points,
+                            struct bit_matrix* bm);
+
+
+/**
+ * Fills the given buffer of width x height bytes with
+ * an 8-bit luminance value for each pixel of the image.
+ */
+void calculate_luminances(struct rgb_image* img, u_int8_t* luminances);
+
+
+/**
+ * Second half of binarize_with_buffers(), that starts from the luminances
+ * computed by calculate_luminances(). Both halves can then run on different
+ * threads for different images.
+ *
+ * @param luminances The luminances of an image with the same dimensions as bm
+ * @param black_points A buffer of at least get_n_black_points(width, height) bytes
+ * @param bm The matrix to fill
+ */
+void binarize_luminances(u_int8_t* luminances, u_int8_t* black_points, struct bit_matrix* bm);
+
 #endif
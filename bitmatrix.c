@@ -1,19 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include "allocator.h"
 #include "bitmatrix.h"
 
 
 struct bit_matrix* create_bit_matrix(unsigned int width, unsigned int height) {
-    struct bit_matrix* bm = (struct bit_matrix*)malloc(sizeof(struct bit_matrix));
+    struct bit_matrix* bm = (struct bit_matrix*)qr_malloc(sizeof(struct bit_matrix));
     if (bm == NULL) {
         return NULL;
     }
     bm->width = width;
     bm->height = height;
     int n_bytes = ((width * height) / 8) + ((width * height) % 8 != 0);
-    bm->matrix = (u_int8_t*)calloc(n_bytes, sizeof(u_int8_t));
+    bm->matrix = (u_int8_t*)qr_calloc(n_bytes, sizeof(u_int8_t));
     if (bm->matrix == NULL) {
-        free(bm);
+        qr_free(bm);
         return NULL;
     }
     return bm;
@@ -21,8 +22,8 @@ struct bit_matrix* create_bit_matrix(unsigned int width, unsigned int height) {
 
 
 void free_bit_matrix(struct bit_matrix* bm) {
-    free(bm->matrix);
-    free(bm);
+    qr_free(bm->matrix);
+    qr_free(bm);
 }
 
 
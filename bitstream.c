@@ -1,15 +1,17 @@
 #include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
 #include "bitstream.h"
 
 struct bitstream* new_bitstream(unsigned int n_bytes) {
-    struct bitstream* s = (struct bitstream*)calloc(1, sizeof(struct bitstream));
+    struct bitstream* s = (struct bitstream*)qr_calloc(1, sizeof(struct bitstream));
     if (s == NULL) {
         return NULL;
     }
     s->n_bytes = n_bytes;
-    s->bytes = (u_int8_t*)calloc(n_bytes, 1);
+    s->bytes = (u_int8_t*)qr_calloc(n_bytes, 1);
     if (s->bytes == NULL) {
-        free(s);
+        qr_free(s);
         return NULL;
     }
 
@@ -17,14 +19,73 @@ struct bitstream* new_bitstream(unsigned int n_bytes) {
 }
 
 
+struct bitstream* wrap_bitstream(u_int8_t* bytes, unsigned int n_bytes) {
+    struct bitstream* s = (struct bitstream*)qr_calloc(1, sizeof(struct bitstream));
+    if (s == NULL) {
+        return NULL;
+    }
+    init_bitstream(s, bytes, n_bytes);
+    return s;
+}
+
+
+void init_bitstream(struct bitstream* stream, u_int8_t* bytes, unsigned int n_bytes) {
+    stream->bytes = bytes;
+    stream->n_bytes = n_bytes;
+    stream->next_byte_pos = 0;
+    stream->cache = 0;
+    stream->n_cached_bits = 0;
+}
+
+
 void free_bitstream(struct bitstream* stream) {
-    free(stream->bytes);
-    free(stream);
+    qr_free(stream->bytes);
+    qr_free(stream);
 }
 
 
 unsigned int remaining_bits(struct bitstream* stream) {
-    return 8 * (stream->n_bytes - stream->current_byte_pos) - stream->n_read_bits;
+    return 8 * (stream->n_bytes - stream->next_byte_pos) + stream->n_cached_bits;
+}
+
+
+/**
+ * Loads as many whole bytes as possible into the cache. When there are
+ * at least 8 bytes left, they are loaded with a single big-endian 64-bit
+ * read, of which only the bytes that fit in the cache are kept.
+ */
+static void refill(struct bitstream* stream) {
+    if (stream->next_byte_pos + 8 <= stream->n_bytes) {
+        u_int8_t* p = stream->bytes + stream->next_byte_pos;
+        u_int64_t word = ((u_int64_t)p[0] << 56) | ((u_int64_t)p[1] << 48)
+                        | ((u_int64_t)p[2] << 40) | ((u_int64_t)p[3] << 32)
+                        | ((u_int64_t)p[4] << 24) | ((u_int64_t)p[5] << 16)
+                        | ((u_int64_t)p[6] << 8) | (u_int64_t)p[7];
+        unsigned int n_new_bytes = (64 - stream->n_cached_bits) / 8;
+        // Let's drop the bits of the bytes that do not fit in the cache
+        word = (word >> (64 - 8 * n_new_bytes)) << (64 - 8 * n_new_bytes);
+        stream->cache |= word >> stream->n_cached_bits;
+        stream->n_cached_bits += 8 * n_new_bytes;
+        stream->next_byte_pos += n_new_bytes;
+        return;
+    }
+    while (stream->n_cached_bits <= 56 && stream->next_byte_pos < stream->n_bytes) {
+        stream->cache |= (u_int64_t)stream->bytes[stream->next_byte_pos++] << (56 - stream->n_cached_bits);
+        stream->n_cached_bits += 8;
+    }
+}
+
+
+u_int32_t peek_bits(struct bitstream* stream, unsigned int n) {
+    if (n < 1 || n > 32 || n > remaining_bits(stream)) {
+        return 0;
+    }
+    if (stream->n_cached_bits < n) {
+        // Since the cache can always hold at least 57 bits after a refill,
+        // this is enough to have the n bits we need
+        refill(stream);
+    }
+    return (u_int32_t)(stream->cache >> (64 - n));
 }
 
 
@@ -32,32 +93,62 @@ u_int32_t read_bits(struct bitstream* stream, unsigned int n) {
     if (n < 1 || n > 32 || n > remaining_bits(stream)) {
         return 0;
     }
-    u_int32_t result = 0;
-
-    while (n > 0) {
-        unsigned available_bits_in_current_byte = 8 - stream->n_read_bits;
-        unsigned int n_to_read = n <= available_bits_in_current_byte ? n : available_bits_in_current_byte;
-        u_int8_t current_byte = stream->bytes[stream->current_byte_pos];
-
-        // We want to get the AB bits in a byte XXABXXXX, so let's start by nullifying
-        // the upper bits to get 00ABXXXX with a left shift followed by a right shift 
-        u_int8_t bits = ((current_byte << stream->n_read_bits) & 0xFF) >> stream->n_read_bits;
-        // Now let's right shift again to get 000000AB
-        bits = bits >> (8 - stream->n_read_bits - n_to_read);
-        // And finally compose this with the current result
-        result = (result << n_to_read) | bits;
-
-        // Let's update the read cursor
-        stream->n_read_bits += n_to_read;
-        if (stream->n_read_bits == 8 && stream->current_byte_pos != (stream->n_bytes - 1)) {
-            stream->current_byte_pos++;
-            stream->n_read_bits = 0;
-        }
+    u_int32_t result = peek_bits(stream, n);
+    stream->cache <<= n;
+    stream->n_cached_bits -= n;
+    return result;
+}
 
 
-        n -= n_to_read;
+void read_bytes(struct bitstream* stream, u_int8_t* bytes, unsigned int n) {
+    if (8 * n > remaining_bits(stream)) {
+        return;
+    }
+    if (stream->n_cached_bits % 8 == 0) {
+        // We are on a byte boundary, so we just need to empty the
+        // cache and then copy the bytes from the source data
+        while (n > 0 && stream->n_cached_bits > 0) {
+            *(bytes++) = read_bits(stream, 8);
+            n--;
+        }
+        memcpy(bytes, stream->bytes + stream->next_byte_pos, n);
+        stream->next_byte_pos += n;
+        return;
     }
 
-    return result;
+    // Otherwise, let's read 4 bytes at a time from the cache
+    for (; n >= 4 ; n -= 4) {
+        u_int32_t value = read_bits(stream, 32);
+        bytes[0] = value >> 24;
+        bytes[1] = value >> 16;
+        bytes[2] = value >> 8;
+        bytes[3] = value;
+        bytes += 4;
+    }
+    while (n-- > 0) {
+        *(bytes++) = read_bits(stream, 8);
+    }
 }
 
+
+void skip_bits(struct bitstream* stream, unsigned int n) {
+    if (n > remaining_bits(stream)) {
+        return;
+    }
+    if (n < stream->n_cached_bits) {
+        stream->cache <<= n;
+        stream->n_cached_bits -= n;
+        return;
+    }
+
+    // Let's empty the cache and skip whole bytes directly in the source data
+    n -= stream->n_cached_bits;
+    stream->cache = 0;
+    stream->n_cached_bits = 0;
+    stream->next_byte_pos += n / 8;
+    if (n % 8) {
+        refill(stream);
+        stream->cache <<= n % 8;
+        stream->n_cached_bits -= n % 8;
+    }
+}
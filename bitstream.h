@@ -8,10 +8,16 @@ struct bitstream {
     uint8_t* bytes;
     unsigned int n_bytes;
 
-    // Index of the byte where the read cursor is 
-    unsigned int current_byte_pos;
-    // Number of bits already read from the current byte
-    unsigned int n_read_bits;
+    // Index of the next byte to be loaded into the cache
+    unsigned int next_byte_pos;
+
+    // The bits that have been loaded from the source data but not
+    // read yet, aligned on the most significant bit so that reading
+    // n bits is just a right shift by 64 - n. The cache is only filled
+    // when needed, so that the source data can be modified after the
+    // bitstream creation as long as nothing has been read yet
+    u_int64_t cache;
+    unsigned int n_cached_bits;
 };
 
 
@@ -23,6 +29,23 @@ struct bitstream {
 struct bitstream* new_bitstream(unsigned int n_bytes);
 
 
+/**
+ * Allocates a bitstream that reads from the given byte array, which is
+ * not copied. The bitstream takes ownership of the array, which will
+ * be freed by free_bitstream(). Returns the bitstream or NULL in case
+ * of memory error, in which case the array is not freed.
+ */
+struct bitstream* wrap_bitstream(u_int8_t* bytes, unsigned int n_bytes);
+
+
+/**
+ * Makes the given bitstream read from the start of the given byte array,
+ * which is neither copied nor owned. Such a bitstream must not be passed
+ * to free_bitstream().
+ */
+void init_bitstream(struct bitstream* stream, u_int8_t* bytes, unsigned int n_bytes);
+
+
 /**
  * Frees the memory associated with the given bitstream.
  */
@@ -44,8 +67,32 @@ unsigned int remaining_bits(struct bitstream* stream);
  *          The caller is responsible for checking the available bits
  *          before calling this function.
  * @return The value corresponding to the n bits that were read. Returns 0 and
- *         don't move the read cursor if n is not a
+ *         don't move the read cursor if n is not a valid value
  */
 u_int32_t read_bits(struct bitstream* stream, unsigned int n);
 
+
+/**
+ * Same as read_bits() but without moving the read cursor.
+ */
+u_int32_t peek_bits(struct bitstream* stream, unsigned int n);
+
+
+/**
+ * Reads n bytes from the stream into the given array, as n successive
+ * calls to read_bits(stream, 8) would do. When the read cursor is on a
+ * byte boundary, the bytes are copied directly from the source data.
+ * The caller is responsible for checking that the stream contains at
+ * least 8 x n bits.
+ */
+void read_bytes(struct bitstream* stream, u_int8_t* bytes, unsigned int n);
+
+
+/**
+ * Moves the read cursor n bits forward. n can be any value up to
+ * the number of available bits in the stream. If n is greater than
+ * that, the read cursor is not moved.
+ */
+void skip_bits(struct bitstream* stream, unsigned int n);
+
 #endif
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include "big5.h"
 #include "bitstream.h"
 #include "bitstreamdecoder.h"
@@ -22,12 +23,126 @@
 
 #define ALPHANUMERIC_CHARS "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:"
 
+// The 2-digit decimal representations of 0 to 99, used to convert
+// the last 2 digits of numeric triplets without any division by 10
+static const char digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+
+/**
+ * Returns 1 if the given 8 bytes are all ASCII characters.
+ */
+static int is_ascii(u_int8_t* bytes) {
+    u_int64_t word;
+    memcpy(&word, bytes, 8);
+    return (word & 0x8080808080808080ULL) == 0;
+}
+
+
+/**
+ * Decodes count ISO-8859-1 bytes from the given stream and adds their
+ * utf8 representation to the given buffer. The raw bytes are read in bulk
+ * at the end of a zone large enough for the worst case where all the
+ * characters need 2 bytes, and then expanded in place from the beginning of
+ * the zone. After i bytes, at most 2 x i bytes have been written, so that the
+ * expansion never overwrites the bytes that have not been read yet. Since most
+ * contents are plain ASCII, the bytes are checked 8 at a time.
+ */
+static int decode_latin1_segment(struct bitstream* stream, unsigned int count, struct bytebuffer* buffer) {
+    if (MEMORY_ERROR == reserve_bytes(buffer, 2 * count)) {
+        return MEMORY_ERROR;
+    }
+    u_int8_t* out = buffer->bytes + buffer->n_bytes;
+    u_int8_t* in = out + count;
+    read_bytes(stream, in, count);
+
+    unsigned int i = 0;
+    while (i < count) {
+        if (i + 8 <= count && is_ascii(in + i)) {
+            memmove(out, in + i, 8);
+            out += 8;
+            i += 8;
+            continue;
+        }
+        u_int8_t c = in[i++];
+        if (c <= 0x7F) {
+            *(out++) = c;
+        } else {
+            *(out++) = (128 + 64) | (c >> 6);
+            *(out++) = 128 | (c & 63);
+        }
+    }
+    buffer->n_bytes = out - buffer->bytes;
+    return SUCCESS;
+}
+
+
+/**
+ * Decodes count bytes from the given stream with the given single byte charset
+ * table and adds their utf8 representation to the given buffer. Since all the
+ * characters of these charsets need at most 3 bytes, the raw bytes are read in
+ * bulk at the end of a zone of 3 x count bytes and converted in place like in
+ * decode_latin1_segment().
+ */
+static int decode_single_byte_segment(struct bitstream* stream, unsigned int count,
+                                    const u_int32_t* charset, struct bytebuffer* buffer) {
+    if (MEMORY_ERROR == reserve_bytes(buffer, 3 * count)) {
+        return MEMORY_ERROR;
+    }
+    u_int8_t* out = buffer->bytes + buffer->n_bytes;
+    u_int8_t* in = out + 2 * count;
+    read_bytes(stream, in, count);
+
+    for (unsigned int i = 0 ; i < count ; i++) {
+        u_int32_t unicode = charset[in[i]];
+        if (unicode <= 0x7F) {
+            *(out++) = unicode;
+        } else if (unicode <= 0x7FF) {
+            *(out++) = (128 + 64) | (unicode >> 6);
+            *(out++) = 128 | (unicode & 63);
+        } else {
+            *(out++) = (128 + 64 + 32) | (unicode >> 12);
+            *(out++) = 128 | ((unicode >> 6) & 63);
+            *(out++) = 128 | (unicode & 63);
+        }
+    }
+    buffer->n_bytes = out - buffer->bytes;
+    return SUCCESS;
+}
+
 
 int decode_byte_segment(struct bitstream* stream, unsigned int count, EciMode eci_mode, struct bytebuffer* buffer) {
     if (8 * count > remaining_bits(stream)) {
         return DECODING_ERROR;
     }
 
+    if (eci_mode == UTF8) {
+        // The raw bytes are already utf8, so we can copy them as is
+        if (MEMORY_ERROR == reserve_bytes(buffer, count)) {
+            return MEMORY_ERROR;
+        }
+        read_bytes(stream, buffer->bytes + buffer->n_bytes, count);
+        buffer->n_bytes += count;
+        return SUCCESS;
+    }
+
+    if (eci_mode == ISO8859_1 || eci_mode == ASCII) {
+        // Like from_ascii(), we accept bytes above 0x7F in ASCII
+        // mode and decode them as ISO-8859-1
+        return decode_latin1_segment(stream, count, buffer);
+    }
+
+    // For the other single byte charsets, the conversion table
+    // is resolved once for the whole segment
+    const u_int32_t* charset = get_single_byte_charset(eci_mode);
+    if (charset != NULL) {
+        return decode_single_byte_segment(stream, count, charset, buffer);
+    }
+
     if (eci_mode == GB18030) {
         return decode_gb18030_segment(stream, count, buffer);
     }
@@ -44,12 +159,7 @@ int decode_byte_segment(struct bitstream* stream, unsigned int count, EciMode ec
     for (unsigned int i = 0 ; i < count ; i++) {
         u_int8_t value = read_bits(stream, 8);
 
-        if (eci_mode == UTF8) {
-            // If we have utf8, we can copy the raw bytes as is
-            if (MEMORY_ERROR == write_byte(buffer, value)) {
-                return MEMORY_ERROR;
-            }
-        } if (eci_mode == UnicodeBigUnmarked) {
+        if (eci_mode == UnicodeBigUnmarked) {
             // For UTF16 Big Endian, we need 2 bytes
             if (remaining_bits(stream) < 8) {
                 return DECODING_ERROR;
@@ -68,6 +178,11 @@ int decode_byte_segment(struct bitstream* stream, unsigned int count, EciMode ec
                 if (MEMORY_ERROR == write_byte(buffer, value)) {
                     return MEMORY_ERROR;
                 }
+            } else if (value >= 0xA1 && value <= 0xDF) {
+                // This is a one byte half-width katakana
+                if (SUCCESS != (res = write_unicode_as_utf8(buffer, from_SJIS(value)))) {
+                    return res;
+                }
             } else {
                 // We have a 2-byte value
                 if (remaining_bits(stream) < 8) {
@@ -80,36 +195,7 @@ int decode_byte_segment(struct bitstream* stream, unsigned int count, EciMode ec
                 }
             }
         } else {
-            // If we have a supported one byte charset, let's write
-            // the utf8 representation of the character
-            u_int32_t unicode;
-            switch(eci_mode) {
-                case ISO8859_1: unicode = from_iso8859_1(value); break;
-                case ISO8859_2: unicode = from_iso8859_2(value); break;
-                case ISO8859_3: unicode = from_iso8859_3(value); break;
-                case ISO8859_4: unicode = from_iso8859_4(value); break;
-                case ISO8859_5: unicode = from_iso8859_5(value); break;
-                case ISO8859_6: unicode = from_iso8859_6(value); break;
-                case ISO8859_7: unicode = from_iso8859_7(value); break;
-                case ISO8859_8: unicode = from_iso8859_8(value); break;
-                case ISO8859_9: unicode = from_iso8859_9(value); break;
-                case ISO8859_10: unicode = from_iso8859_10(value); break;
-                case ISO8859_11: unicode = from_iso8859_11(value); break;
-                case ISO8859_13: unicode = from_iso8859_13(value); break;
-                case ISO8859_14: unicode = from_iso8859_14(value); break;
-                case ISO8859_15: unicode = from_iso8859_15(value); break;
-                case ISO8859_16: unicode = from_iso8859_16(value); break;
-                case Cp437: unicode = from_Cp437(value); break;
-                case Cp1250: unicode = from_Cp1250(value); break;
-                case Cp1251: unicode = from_Cp1251(value); break;
-                case Cp1252: unicode = from_Cp1252(value); break;
-                case Cp1256: unicode = from_Cp1256(value); break;
-                case ASCII: unicode = from_ascii(value); break;
-                default: return DECODING_ERROR;
-            }
-            if (SUCCESS != (res = write_unicode_as_utf8(buffer, unicode))) {
-                return res;
-            }
+            return DECODING_ERROR;
         }
     }
 
@@ -164,37 +250,34 @@ void decode_percents_in_FNC1_mode(struct bytebuffer* buffer, unsigned int start)
 static int decode_alphanumeric_segment(struct bitstream* stream, unsigned int count, int fnc1_mode, struct bytebuffer* buffer) {
     int start = buffer->n_bytes;
 
-    while (count > 1) {
-        if (remaining_bits(stream) < 11) {
-            return DECODING_ERROR;
-        }
+    // Since we know exactly how many bits and bytes we need, we can check
+    // the stream and the buffer once and then write directly into the buffer
+    if (11 * (count / 2) + 6 * (count % 2) > remaining_bits(stream)) {
+        return DECODING_ERROR;
+    }
+    if (MEMORY_ERROR == reserve_bytes(buffer, count)) {
+        return MEMORY_ERROR;
+    }
+    u_int8_t* out = buffer->bytes + buffer->n_bytes;
 
+    for (unsigned int i = 0 ; i < count / 2 ; i++) {
         u_int32_t value = read_bits(stream, 11);
         if ((value / 45) >= 45) {
             return DECODING_ERROR;
         }
-        u_int8_t first = ALPHANUMERIC_CHARS[value / 45];
-        u_int8_t second = ALPHANUMERIC_CHARS[value % 45];
-        if (MEMORY_ERROR == write_byte(buffer, first)
-            || MEMORY_ERROR == write_byte(buffer, second)) {
-            return MEMORY_ERROR;
-        }
-        count -= 2;
+        *(out++) = ALPHANUMERIC_CHARS[value / 45];
+        *(out++) = ALPHANUMERIC_CHARS[value % 45];
     }
 
-    if (count == 1) {
+    if (count % 2) {
         // There is a single character at the end of the segment
-        if (remaining_bits(stream) < 6) {
-            return DECODING_ERROR;
-        }
         u_int32_t value = read_bits(stream, 6);
         if (value >= 45) {
             return DECODING_ERROR;
         }
-        if (MEMORY_ERROR == write_byte(buffer, ALPHANUMERIC_CHARS[value])) {
-            return MEMORY_ERROR;
-        }
+        *out = ALPHANUMERIC_CHARS[value];
     }
+    buffer->n_bytes += count;
 
     if (fnc1_mode) {
         // If we are in FNC1 mode, there is more to do
@@ -208,7 +291,6 @@ static int decode_alphanumeric_segment(struct bitstream* stream, unsigned int co
 /**
  * Numeric characters are encoded as 10-bit triplets plus maybe a
  * 7-bit pair or a 4-bit single value at the end.
- * converted into a characterwith the ALPHANUMERIC_CHARS lookup table.
  *
  * Decodes count numeric characters from the given stream
  * and adds the corresponding data as utf8 in the given buffer.
@@ -218,56 +300,48 @@ static int decode_alphanumeric_segment(struct bitstream* stream, unsigned int co
  *         MEMORY_ERROR on memory allocation error
  */
 static int decode_numeric_segment(struct bitstream* stream, unsigned int count, struct bytebuffer* buffer) {
-    while (count >= 3) {
-        if (remaining_bits(stream) < 10) {
-            return DECODING_ERROR;
-        }
+    // The number of bits needed by the 1 or 2 digits at the end, if any
+    static const unsigned int remainder_bits[3] = { 0, 4, 7 };
 
+    // Since we know exactly how many bits and bytes we need, we can check
+    // the stream and the buffer once and then write directly into the buffer
+    if (10 * (count / 3) + remainder_bits[count % 3] > remaining_bits(stream)) {
+        return DECODING_ERROR;
+    }
+    if (MEMORY_ERROR == reserve_bytes(buffer, count)) {
+        return MEMORY_ERROR;
+    }
+    u_int8_t* out = buffer->bytes + buffer->n_bytes;
+
+    for (unsigned int i = 0 ; i < count / 3 ; i++) {
         u_int32_t value = read_bits(stream, 10);
         if (value >= 1000) {
             return DECODING_ERROR;
         }
-        u_int8_t first = '0' + (value / 100);
-        u_int8_t second = '0' + ((value / 10) % 10);
-        u_int8_t third = '0' + (value % 10);
-        if (MEMORY_ERROR == write_byte(buffer, first)
-            || MEMORY_ERROR == write_byte(buffer, second)
-            || MEMORY_ERROR == write_byte(buffer, third)) {
-            return MEMORY_ERROR;
-        }
-        count -= 3;
+        const char* pair = digit_pairs + 2 * (value % 100);
+        out[0] = '0' + (value / 100);
+        out[1] = pair[0];
+        out[2] = pair[1];
+        out += 3;
     }
 
-    if (count == 1) {
+    if (count % 3 == 1) {
         // There is a single character at the end of the segment
-        if (remaining_bits(stream) < 4) {
-            return DECODING_ERROR;
-        }
         u_int32_t value = read_bits(stream, 4);
         if (value >= 10) {
             return DECODING_ERROR;
         }
-
-        if (MEMORY_ERROR == write_byte(buffer, '0' + value)) {
-            return MEMORY_ERROR;
-        }
-    } else if (count == 2) {
+        out[0] = '0' + value;
+    } else if (count % 3 == 2) {
         // There are 2 characters at the end
-        if (remaining_bits(stream) < 7) {
-            return DECODING_ERROR;
-        }
         u_int32_t value = read_bits(stream, 7);
         if (value >= 100) {
             return DECODING_ERROR;
         }
-        u_int8_t first = '0' + (value / 10);
-        u_int8_t second = '0' + (value % 10);
-
-        if (MEMORY_ERROR == write_byte(buffer, first)
-            || MEMORY_ERROR == write_byte(buffer, second)) {
-            return MEMORY_ERROR;
-        }
+        out[0] = digit_pairs[2 * value];
+        out[1] = digit_pairs[2 * value + 1];
     }
+    buffer->n_bytes += count;
 
     return SUCCESS;
 }
@@ -365,16 +439,20 @@ static unsigned int get_character_count_bit(u_int8_t mode, unsigned int version)
 }
 
 
-int decode_bitstream(struct bitstream* stream, unsigned int version, u_int8_t* *decoded) {
-    if (version < 1 || version > 40) {
-        return DECODING_ERROR;
-    }
-    
-    struct bytebuffer* buffer = new_bytebuffer();
-    if (buffer == NULL) {
-        return MEMORY_ERROR;
-    }
+unsigned int get_max_decoded_size(unsigned int n_bytes) {
+    // No encoding produces more than 3 utf8 bytes per byte of the stream,
+    // the worst cases being single byte charsets with characters above
+    // U+07FF and numeric segments with 3 digits every 10 bits
+    return 3 * n_bytes + 1;
+}
+
 
+/**
+ * Decodes all the segments of the given stream into the given buffer
+ * and adds a final 0. Returns the number of decoded bytes, not counting
+ * the final 0, or an error code.
+ */
+static int decode_segments(struct bitstream* stream, unsigned int version, struct bytebuffer* buffer) {
     gory("\nDecoding bytes...\n");
     u_int8_t mode;
     int fnc1_mode = 0;
@@ -403,10 +481,9 @@ int decode_bitstream(struct bitstream* stream, unsigned int version, u_int8_t* *
                 // We will ignore this feature, so let's just skip the 16
                 // bits describing the symbol sequence and the parity data
                 if (remaining_bits(stream) < 16) {
-                    free_bytebuffer(buffer);
                     return DECODING_ERROR;
                 }
-                read_bits(stream, 16);
+                skip_bits(stream, 16);
                 break;
             }
             case ECI: {
@@ -420,7 +497,6 @@ int decode_bitstream(struct bitstream* stream, unsigned int version, u_int8_t* *
                         break;
                     }
                 }
-                free_bytebuffer(buffer);
                 return DECODING_ERROR;
             }
             case NUMERIC:
@@ -436,7 +512,6 @@ int decode_bitstream(struct bitstream* stream, unsigned int version, u_int8_t* *
                         gory("Decoding numeric segment representing %d digits\n", count);
                         int res = decode_numeric_segment(stream, count, buffer);
                         if (res != SUCCESS) {
-                            free_bytebuffer(buffer);
                             return res;
                         }
                         break;
@@ -445,7 +520,6 @@ int decode_bitstream(struct bitstream* stream, unsigned int version, u_int8_t* *
                         gory("Decoding alphanumeric segment representing %d characters\n", count);
                         int res = decode_alphanumeric_segment(stream, count, fnc1_mode, buffer);
                         if (res != SUCCESS) {
-                            free_bytebuffer(buffer);
                             return res;
                         }
                         break;
@@ -454,7 +528,6 @@ int decode_bitstream(struct bitstream* stream, unsigned int version, u_int8_t* *
                         gory("Decoding binary segment of %d bytes with ECI encoding %s\n", count, get_eci_name(eci_mode));
                         int res = decode_byte_segment(stream, count, eci_mode, buffer);
                         if (res != SUCCESS) {
-                            free_bytebuffer(buffer);
                             return res;
                         }
                         break;
@@ -463,7 +536,6 @@ int decode_bitstream(struct bitstream* stream, unsigned int version, u_int8_t* *
                         gory("Decoding Kanji segment representing %d characters\n", count);
                         int res = decode_kanji_segment(stream, count, buffer);
                         if (res != SUCCESS) {
-                            free_bytebuffer(buffer);
                             return res;
                         }
                         break;
@@ -473,7 +545,6 @@ int decode_bitstream(struct bitstream* stream, unsigned int version, u_int8_t* *
             }
             default: {
                 // Unknown mode
-                free_bytebuffer(buffer);
                 return DECODING_ERROR;
             }
         }
@@ -483,14 +554,49 @@ int decode_bitstream(struct bitstream* stream, unsigned int version, u_int8_t* *
 
     // Let's turn the buffer into a null-terminated string
     if (MEMORY_ERROR == write_byte(buffer, 0)) {
-        free_bytebuffer(buffer);
+        return MEMORY_ERROR;
+    }
+    return n;
+}
+
+
+int decode_bitstream(struct bitstream* stream, unsigned int version, u_int8_t* *decoded) {
+    if (version < 1 || version > 40) {
+        return DECODING_ERROR;
+    }
+
+    // Reserving the maximum size once means that the buffer
+    // never needs to grow while decoding
+    struct bytebuffer* buffer = new_bytebuffer_with_capacity(get_max_decoded_size(stream->n_bytes));
+    if (buffer == NULL) {
         return MEMORY_ERROR;
     }
 
-    // Let's steal the byte array from the byte buffer
+    int n = decode_segments(stream, version, buffer);
+    if (n < 0) {
+        free_bytebuffer(buffer);
+        return n;
+    }
+
+    // Let's give back the unused part of the reservation and
+    // steal the byte array from the byte buffer
+    shrink_to_fit(buffer);
     *decoded = buffer->bytes;
     buffer->bytes = NULL;
     free_bytebuffer(buffer);
 
     return n;
 }
+
+
+int decode_bitstream_in_buffer(struct bitstream* stream, unsigned int version, u_int8_t* output, unsigned int capacity) {
+    if (version < 1 || version > 40) {
+        return DECODING_ERROR;
+    }
+    if (capacity < get_max_decoded_size(stream->n_bytes)) {
+        return BUFFER_TOO_SMALL;
+    }
+
+    struct bytebuffer buffer = { output, capacity, 0, 1 };
+    return decode_segments(stream, version, &buffer);
+}
@@ -28,6 +28,32 @@
 int decode_bitstream(struct bitstream* stream, unsigned int version, u_int8_t* *decoded);
 
 
+/**
+ * Returns the size of a buffer that is large enough to receive the
+ * null-terminated data decoded from a bitstream of n_bytes bytes,
+ * whatever the segments it contains.
+ */
+unsigned int get_max_decoded_size(unsigned int n_bytes);
+
+
+/**
+ * Same as decode_bitstream() but the decoded data is written in the
+ * given buffer instead of a dynamically allocated one, so that callers
+ * can reuse the same buffer for many QR codes.
+ *
+ * @param stream The bitstream to decode
+ * @param version The QR code version (between 1 and 40)
+ * @param output Where to write the null-terminated decoded data
+ * @param capacity The size of the output buffer, that must be at least
+ *                 get_max_decoded_size(stream->n_bytes)
+ * @return n >= 0 on success, where n is the number of decoded bytes placed in the
+ *           output buffer, not counting the final 0
+ *         BUFFER_TOO_SMALL if the output buffer is too small
+ *         DECODING_ERROR on decoding error or if the given version is invalid
+ */
+int decode_bitstream_in_buffer(struct bitstream* stream, unsigned int version, u_int8_t* output, unsigned int capacity);
+
+
 /**
  * Decodes count bytes from the given stream and adds
  * the corresponding data as utf8 in the given buffer.
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <string.h>
+#include "allocator.h"
 #include "blocks.h"
 
 
@@ -11,7 +12,7 @@
  * of data codewords among them (so that y - z gives the number of
  * error codewords).
  */
-static unsigned int block_descriptions[40][4][7]= {
+static const unsigned int block_descriptions[40][4][7]= {
     {           /* Version 1 */
         /* L */ { 1, 26, 19,   0 },
         /* M */ { 1, 26, 16,   0 },
@@ -255,133 +256,139 @@ static unsigned int block_descriptions[40][4][7]= {
 };
 
 
-int get_blocks(u_int8_t* codewords, int version, ErrorCorrectionLevel ec_level, struct blocks* *block_list) {
-    if (version < 1 || version > 40 || ec_level < 0 || ec_level > 3) {
-        return DECODING_ERROR;
-    }
-
-    struct blocks* blocks = (struct blocks*)malloc(sizeof(struct blocks));
-    if (blocks == NULL) {
-        return MEMORY_ERROR;
+/**
+ * Returns the number of blocks of the given description and
+ * the total number of codewords they contain.
+ */
+static unsigned int get_block_layout(const unsigned int* description, unsigned int *total_codewords) {
+    unsigned int n_blocks = 0;
+    (*total_codewords) = 0;
+    for (int i = 0 ; description[i] != 0 ; i += 3) {
+        n_blocks += description[i];
+        (*total_codewords) += description[i] * description[i + 1];
     }
+    return n_blocks;
+}
 
-    blocks->n_blocks = 0;
-    unsigned int* description = block_descriptions[version - 1][ec_level];
 
-    unsigned total_data_codewords = 0;
-    unsigned total_error_codewords = 0;
+/**
+ * De-interleaves the codewords into the given blocks, whose block
+ * and codeword arrays are large enough for the given description.
+ */
+static void fill_blocks(u_int8_t* codewords, const unsigned int* description, struct blocks* blocks) {
+    unsigned int max_data_codewords = 0;
+    unsigned int max_error_codewords = 0;
 
     int i = 0;
+    unsigned int current_block = 0;
+    unsigned int offset = 0;
     while (description[i] != 0) {
-        unsigned int n_blocks = description[i];
-        unsigned int n_data_codewords = description[i + 2];
-        unsigned int n_error_codewords = description[i + 1] - n_data_codewords;
-        blocks->n_blocks += n_blocks;
-        total_data_codewords += n_blocks * n_data_codewords;
-        total_error_codewords += n_blocks * n_error_codewords;
-        i += 3;
-    }
-
-    // This array will be used when populating the codeword arrays
-    // to remember how full each array is at any time
-    unsigned int* counters = (unsigned int*)calloc(blocks->n_blocks, sizeof(unsigned int));
-    if (counters == NULL) {
-        free(blocks);
-        return MEMORY_ERROR;
-    }
-
-    // Allocating with calloc guarantees that all the pointers in the blocks
-    // will be NULL, which will make it easier to cleanup if any allocation fails
-    // as invoking free() on a NULL pointer is a no-op
-    blocks->block = (struct block*)calloc(blocks->n_blocks, sizeof(struct block));
-    if (blocks->block == NULL) {
-        free(counters);
-        free(blocks);
-        return MEMORY_ERROR;
-    }
-
-    // Let's allocate all the codeword arrays
-    i = 0;
-    int current_block = 0;
-    int fail = 0;
-    while (!fail && description[i] != 0) {
         unsigned int n = description[i];
+        unsigned int n_data = description[i + 2];
+        unsigned int n_error = description[i + 1] - n_data;
+        if (n_data > max_data_codewords) {
+            max_data_codewords = n_data;
+        }
+        if (n_error > max_error_codewords) {
+            max_error_codewords = n_error;
+        }
         for (unsigned int j = 0 ; j < n ; j++) {
-            unsigned int n_data = description[i + 2];
-            unsigned int n_error = description[i + 1] - n_data;
             blocks->block[current_block].n_data_codewords = n_data;
             blocks->block[current_block].n_error_correction_codewords = n_error;
-            blocks->block[current_block].codewords = (u_int8_t*)malloc((n_data + n_error) * sizeof(u_int8_t));
-            if (blocks->block[current_block].codewords == NULL) {
-                fail = 1;
-                break;
-            }
+            blocks->block[current_block].codewords = blocks->codewords + offset;
+            offset += n_data + n_error;
             current_block++;
         }
         i += 3;
     }
+    blocks->n_blocks = current_block;
 
-    // If any memory allocation failed, let's free everything and return
-    if (fail) {
-        for (unsigned int i = 0 ; i < blocks->n_blocks ; i++) {
-            free(blocks->block[i].codewords);
+    // It is time to populate the codeword arrays. The interleaving takes the
+    // k-th codeword of each block in turn, skipping the blocks that have
+    // fewer than k+1 codewords
+    unsigned int pos = 0;
+    for (unsigned int k = 0 ; k < max_data_codewords ; k++) {
+        for (unsigned int b = 0 ; b < blocks->n_blocks ; b++) {
+            if (k < blocks->block[b].n_data_codewords) {
+                blocks->block[b].codewords[k] = codewords[pos++];
+            }
         }
-        free(blocks->block);
-        free(blocks);
-        free(counters);
-        return MEMORY_ERROR;
     }
 
-    // We now have allocated all the space to store the codewords.
-    // It is time to populate the codeword arrays
-
-    unsigned int pos = 0;
-    int current_block_index = 0;
-    while (pos < total_data_codewords) {
-        // Let's read one data codeword from the array
-        u_int8_t codeword = codewords[pos++];
-
-        // Now let's find where to put it by looking for the next data block that is not already full
-        while (counters[current_block_index] == blocks->block[current_block_index].n_data_codewords) {
-            current_block_index = (current_block_index + 1) % blocks->n_blocks;
+    // Let's do the same for the error codewords
+    for (unsigned int k = 0 ; k < max_error_codewords ; k++) {
+        for (unsigned int b = 0 ; b < blocks->n_blocks ; b++) {
+            if (k < blocks->block[b].n_error_correction_codewords) {
+                blocks->block[b].codewords[blocks->block[b].n_data_codewords + k] = codewords[pos++];
+            }
         }
+    }
+}
+
 
-        // Let's add the data codeword
-        blocks->block[current_block_index].codewords[counters[current_block_index]] = codeword;
-        counters[current_block_index]++;
-        current_block_index = (current_block_index + 1) % blocks->n_blocks;
+int get_blocks(u_int8_t* codewords, int version, ErrorCorrectionLevel ec_level, struct blocks* *block_list) {
+    if (version < 1 || version > 40 || ec_level < 0 || ec_level > 3) {
+        return DECODING_ERROR;
     }
 
-    // Let's do the same for the error codewords, after resetting the counter array
-    memset(counters, 0, blocks->n_blocks * sizeof(unsigned int));
+    struct blocks* blocks = (struct blocks*)qr_malloc(sizeof(struct blocks));
+    if (blocks == NULL) {
+        return MEMORY_ERROR;
+    }
 
-    current_block_index = 0;
-    unsigned total_codewords = total_data_codewords + total_error_codewords;
-    while (pos < total_codewords) {
-        // Let's read one error codeword from the array
-        u_int8_t codeword = codewords[pos++];
+    const unsigned int* description = block_descriptions[version - 1][ec_level];
+    unsigned int total_codewords;
+    unsigned int n_blocks = get_block_layout(description, &total_codewords);
 
-        // Now let's find where to put it by looking for the next data block that is not already full
-        while (counters[current_block_index] == blocks->block[current_block_index].n_error_correction_codewords) {
-            current_block_index = (current_block_index + 1) % blocks->n_blocks;
-        }
+    blocks->block = (struct block*)qr_malloc(n_blocks * sizeof(struct block));
+    if (blocks->block == NULL) {
+        qr_free(blocks);
+        return MEMORY_ERROR;
+    }
 
-        // Let's add the error correction codeword
-        blocks->block[current_block_index].codewords[blocks->block[current_block_index].n_data_codewords + counters[current_block_index]] = codeword;
-        counters[current_block_index]++;
-        current_block_index = (current_block_index + 1) % blocks->n_blocks;
+    // Instead of allocating one codeword array per block, all the blocks
+    // share a single array where they are stored one after the other
+    blocks->codewords = (u_int8_t*)qr_malloc(total_codewords * sizeof(u_int8_t));
+    if (blocks->codewords == NULL) {
+        qr_free(blocks->block);
+        qr_free(blocks);
+        return MEMORY_ERROR;
     }
 
+    fill_blocks(codewords, description, blocks);
     (*block_list) = blocks;
     return SUCCESS;
 }
 
 
-void free_blocks(struct blocks* blocks) {
-    for (unsigned int i = 0 ; i < blocks->n_blocks ; i++) {
-        free(blocks->block[i].codewords);
+int get_blocks_in_buffers(u_int8_t* codewords, int version, ErrorCorrectionLevel ec_level,
+                        struct block* block, u_int8_t* block_codewords, struct blocks* blocks) {
+    if (version < 1 || version > 40 || ec_level < 0 || ec_level > 3) {
+        return DECODING_ERROR;
     }
-    free(blocks->block);
-    free(blocks);
+    blocks->block = block;
+    blocks->codewords = block_codewords;
+    fill_blocks(codewords, block_descriptions[version - 1][ec_level], blocks);
+    return SUCCESS;
 }
 
+
+int get_n_data_codewords(int version, ErrorCorrectionLevel ec_level) {
+    if (version < 1 || version > 40 || ec_level < 0 || ec_level > 3) {
+        return DECODING_ERROR;
+    }
+
+    const unsigned int* description = block_descriptions[version - 1][ec_level];
+    int n = 0;
+    for (int i = 0 ; description[i] != 0 ; i += 3) {
+        n += description[i] * description[i + 2];
+    }
+    return n;
+}
+
+
+void free_blocks(struct blocks* blocks) {
+    qr_free(blocks->codewords);
+    qr_free(blocks->block);
+    qr_free(blocks);
+}
@@ -3,11 +3,16 @@
 
 #include <stdint.h>
 
+#include "codewords.h"
 #include "errors.h"
 #include "formatinformation.h"
 
 #define MAX_ERROR_CORRECTION_CAPACITY 15
 
+// The maximum number of blocks in a QR code, which is reached
+// by version 40 codes with high error correction level
+#define MAX_BLOCKS 81
+
 /**
  * Information is encoded into a QR code by splitting the data codewords
  * into blocks and to add for each block some error correction codewords.
@@ -33,6 +38,11 @@ struct block {
 struct blocks {
     struct block* block;
     unsigned int n_blocks;
+
+    // The array that contains the codewords of all the blocks one
+    // after the other, so that block[i].codewords points into it.
+    // NULL if the blocks' codewords are stored elsewhere
+    u_int8_t* codewords;
 };
 
 
@@ -90,6 +100,27 @@ struct blocks {
 int get_blocks(u_int8_t* codewords, int version, ErrorCorrectionLevel ec_level, struct blocks* *blocks);
 
 
+/**
+ * Same as get_blocks() but no memory is allocated. The given blocks are
+ * filled with the given arrays, that must be large enough for MAX_BLOCKS
+ * blocks and MAX_CODEWORDS codewords. Such blocks must not be passed to
+ * free_blocks().
+ *
+ * @return SUCCESS on success
+ *         DECODING_ERROR if any of the parameter has an invalid value
+ */
+int get_blocks_in_buffers(u_int8_t* codewords, int version, ErrorCorrectionLevel ec_level,
+                        struct block* block, u_int8_t* block_codewords, struct blocks* blocks);
+
+
+/**
+ * Returns the total number of data codewords of a QR code with the given
+ * version and error correction level, or DECODING_ERROR if any of the
+ * parameters has an invalid value.
+ */
+int get_n_data_codewords(int version, ErrorCorrectionLevel ec_level);
+
+
 /**
  * Frees all the memory associated to the given blocks.
  */
@@ -1,32 +1,42 @@
 #include <stdlib.h>
+#include "allocator.h"
 #include "bytebuffer.h"
 
 struct bytebuffer* new_bytebuffer() {
-    struct bytebuffer* b = (struct bytebuffer*)malloc(sizeof(struct bytebuffer));
+    return new_bytebuffer_with_capacity(32);
+}
+
+
+struct bytebuffer* new_bytebuffer_with_capacity(unsigned int capacity) {
+    struct bytebuffer* b = (struct bytebuffer*)qr_malloc(sizeof(struct bytebuffer));
     if (b == NULL) {
         return NULL;
     }
-    b->bytes = (u_int8_t*)malloc(32);
+    b->bytes = (u_int8_t*)qr_malloc(capacity);
     if (b->bytes == NULL) {
-        free(b);
+        qr_free(b);
         return NULL;
     }
-    b->capacity = 32;
+    b->capacity = capacity;
     b->n_bytes = 0;
+    b->fixed_capacity = 0;
 
     return b;
 }
 
 
 void free_bytebuffer(struct bytebuffer* buffer) {
-    free(buffer->bytes);
-    free(buffer);
+    qr_free(buffer->bytes);
+    qr_free(buffer);
 }
 
 
 int write_byte(struct bytebuffer* buffer, uint8_t value) {
     if (buffer->n_bytes == buffer->capacity) {
-        u_int8_t* tmp = (u_int8_t*)realloc(buffer->bytes, 2 * buffer->capacity);
+        if (buffer->fixed_capacity) {
+            return MEMORY_ERROR;
+        }
+        u_int8_t* tmp = (u_int8_t*)qr_realloc(buffer->bytes, 2 * buffer->capacity);
         if (tmp == NULL) {
             return MEMORY_ERROR;
         }
@@ -39,6 +49,39 @@ int write_byte(struct bytebuffer* buffer, uint8_t value) {
 }
 
 
+int reserve_bytes(struct bytebuffer* buffer, unsigned int n) {
+    if (buffer->capacity - buffer->n_bytes >= n) {
+        return SUCCESS;
+    }
+    if (buffer->fixed_capacity) {
+        return MEMORY_ERROR;
+    }
+    unsigned int capacity = 2 * buffer->capacity;
+    if (capacity < buffer->n_bytes + n) {
+        capacity = buffer->n_bytes + n;
+    }
+    u_int8_t* tmp = (u_int8_t*)qr_realloc(buffer->bytes, capacity);
+    if (tmp == NULL) {
+        return MEMORY_ERROR;
+    }
+    buffer->bytes = tmp;
+    buffer->capacity = capacity;
+    return SUCCESS;
+}
+
+
+void shrink_to_fit(struct bytebuffer* buffer) {
+    if (buffer->n_bytes == 0 || buffer->n_bytes == buffer->capacity || buffer->fixed_capacity) {
+        return;
+    }
+    u_int8_t* tmp = (u_int8_t*)qr_realloc(buffer->bytes, buffer->n_bytes);
+    if (tmp != NULL) {
+        buffer->bytes = tmp;
+        buffer->capacity = buffer->n_bytes;
+    }
+}
+
+
 int write_unicode_as_utf8(struct bytebuffer* buffer, u_int32_t value) {
     if (value <= 0x7F) {
         return write_byte(buffer, value);
@@ -12,6 +12,11 @@ struct bytebuffer {
     u_int8_t* bytes;
     unsigned int capacity;
     unsigned int n_bytes;
+
+    // If not 0, the bytes are owned by someone else and the buffer
+    // cannot be enlarged, so that running out of capacity is treated
+    // like a memory allocation error
+    int fixed_capacity;
 };
 
 
@@ -22,6 +27,13 @@ struct bytebuffer {
 struct bytebuffer* new_bytebuffer();
 
 
+/**
+ * Allocates a buffer of the given capacity, which must be greater than 0.
+ * Returns NULL in case of memory allocation error.
+ */
+struct bytebuffer* new_bytebuffer_with_capacity(unsigned int capacity);
+
+
 /**
  * Frees the memory associated with this byte buffer.
  */
@@ -37,6 +49,24 @@ void free_bytebuffer(struct bytebuffer* buffer);
 int write_byte(struct bytebuffer* buffer, uint8_t value);
 
 
+/**
+ * Makes sure that n more bytes can be written into the given buffer
+ * without enlarging it, so that they can be written directly at
+ * buffer->bytes + buffer->n_bytes.
+ * Returns SUCCESS on success or MEMORY_ERROR in case of memory allocation
+ * error.
+ */
+int reserve_bytes(struct bytebuffer* buffer, unsigned int n);
+
+
+/**
+ * Reduces the capacity of the given buffer to its current size, if not 0
+ * and if the buffer owns its bytes.
+ * If the memory cannot be reallocated, the buffer is left unchanged.
+ */
+void shrink_to_fit(struct bytebuffer* buffer);
+
+
 /**
  * Writes to the given buffer the bytes corresponding to the utf8
  * encoding of the given unicode character.
@@ -14,7 +14,7 @@
  *   position of an alignement pattern, except if the coordinates are inside one
  *   of the 3 finder patterns
  */
-static u_int8_t alignment_patterns[40][8] = {
+static const u_int8_t alignment_patterns[40][8] = {
     { 0 },
     { 6, 18, 0 },
     { 6, 22, 0 },
@@ -123,7 +123,7 @@ int get_codeword_mask(unsigned int size, struct bit_matrix* *mask) {
         }
     }
 
-    u_int8_t* pos = alignment_patterns[version - 1];
+    const u_int8_t* pos = alignment_patterns[version - 1];
 
     for (unsigned int i = 0 ; pos[i] != 0 ; i++) {
         for (unsigned int j = 0 ; pos[j] != 0 ; j++) {
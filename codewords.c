@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include "allocator.h"
 #include "codewords.h"
 
 
@@ -130,16 +131,19 @@ static int get_data_bit(struct bit_matrix* modules, unsigned x ,unsigned y, u_in
 }
 
 
-int get_codewords(struct bit_matrix* modules,
-                struct bit_matrix* codeword_mask,
-                u_int8_t mask_pattern,
-                u_int8_t* *codewords) {
-    *codewords = NULL;
+/**
+ * Checks that the given matrices can be scanned and returns the number
+ * of codewords they contain, or DECODING_ERROR.
+ */
+static int count_codewords(struct bit_matrix* modules,
+                        struct bit_matrix* codeword_mask,
+                        u_int8_t mask_pattern,
+                        int apply_mask) {
     if (modules->width != modules->height
         || modules->width != codeword_mask->width
         || modules->width != codeword_mask->height
         || (modules->width % 4) != 1
-        || mask_pattern >= 8) {
+        || (apply_mask && mask_pattern >= 8)) {
             return DECODING_ERROR;
         }
 
@@ -158,12 +162,21 @@ int get_codewords(struct bit_matrix* modules,
     }
 
     // Let's divide by 8 to get the number of codewords
-    n = n / 8;
-    (*codewords) = (u_int8_t*)malloc(n * sizeof(u_int8_t));
-    if (*codewords == NULL) {
-        return MEMORY_ERROR;
-    }
+    return n / 8;
+}
+
 
+/**
+ * Scans the n codewords of the modules following the snake pattern. If
+ * apply_mask is 0, the raw module values are used and mask_pattern is ignored.
+ */
+static void scan_codewords(struct bit_matrix* modules,
+                        struct bit_matrix* codeword_mask,
+                        u_int8_t mask_pattern,
+                        int apply_mask,
+                        int n,
+                        u_int8_t* codewords) {
+    unsigned int size = modules->width;
     unsigned int x = size - 1;
     unsigned int y = size - 1;
     u_int8_t upwards = 1;
@@ -173,15 +186,88 @@ int get_codewords(struct bit_matrix* modules,
         int bit_pos = 7;
         u_int8_t codeword = 0;
         do {
-            int bit = get_data_bit(modules, x ,y, mask_pattern);
+            int bit = apply_mask ? get_data_bit(modules, x ,y, mask_pattern) : is_black(modules, x, y);
             codeword = codeword | (bit << bit_pos);
 
             move_to_next_data_module(&x, &y, codeword_mask, &upwards, &right);
             bit_pos--;
         } while (bit_pos >= 0);
-        (*codewords)[i] = codeword;
+        codewords[i] = codeword;
     }
+}
+
 
+/**
+ * Same as scan_codewords() but counts the codewords and allocates
+ * the array to store them.
+ */
+static int scan_new_codewords(struct bit_matrix* modules,
+                            struct bit_matrix* codeword_mask,
+                            u_int8_t mask_pattern,
+                            int apply_mask,
+                            u_int8_t* *codewords) {
+    *codewords = NULL;
+    int n = count_codewords(modules, codeword_mask, mask_pattern, apply_mask);
+    if (n < 0) {
+        return n;
+    }
+    (*codewords) = (u_int8_t*)qr_malloc(n * sizeof(u_int8_t));
+    if (*codewords == NULL) {
+        return MEMORY_ERROR;
+    }
+    scan_codewords(modules, codeword_mask, mask_pattern, apply_mask, n, *codewords);
     return n;
 }
 
+
+/**
+ * Only keeps whether each codeword contains at least one uncertain module.
+ */
+static void flag_uncertain_codewords(int n, u_int8_t* uncertain_codewords) {
+    for (int i = 0 ; i < n ; i++) {
+        uncertain_codewords[i] = (uncertain_codewords[i] != 0);
+    }
+}
+
+
+int get_codewords(struct bit_matrix* modules,
+                struct bit_matrix* codeword_mask,
+                u_int8_t mask_pattern,
+                u_int8_t* *codewords) {
+    return scan_new_codewords(modules, codeword_mask, mask_pattern, 1, codewords);
+}
+
+
+int get_codewords_in_buffer(struct bit_matrix* modules,
+                            struct bit_matrix* codeword_mask,
+                            u_int8_t mask_pattern,
+                            u_int8_t* codewords) {
+    int n = count_codewords(modules, codeword_mask, mask_pattern, 1);
+    if (n < 0 || n > MAX_CODEWORDS) {
+        return DECODING_ERROR;
+    }
+    scan_codewords(modules, codeword_mask, mask_pattern, 1, n, codewords);
+    return n;
+}
+
+
+int get_uncertain_codewords(struct bit_matrix* uncertain_modules,
+                            struct bit_matrix* codeword_mask,
+                            u_int8_t* *uncertain_codewords) {
+    int n = scan_new_codewords(uncertain_modules, codeword_mask, 0, 0, uncertain_codewords);
+    flag_uncertain_codewords(n, *uncertain_codewords);
+    return n;
+}
+
+
+int get_uncertain_codewords_in_buffer(struct bit_matrix* uncertain_modules,
+                                    struct bit_matrix* codeword_mask,
+                                    u_int8_t* uncertain_codewords) {
+    int n = count_codewords(uncertain_modules, codeword_mask, 0, 0);
+    if (n < 0 || n > MAX_CODEWORDS) {
+        return DECODING_ERROR;
+    }
+    scan_codewords(uncertain_modules, codeword_mask, 0, 0, n, uncertain_codewords);
+    flag_uncertain_codewords(n, uncertain_codewords);
+    return n;
+}
@@ -5,6 +5,10 @@
 #include "bitmatrix.h"
 #include "errors.h"
 
+// The number of codewords of a version 40 QR code,
+// which is the largest number of codewords
+#define MAX_CODEWORDS 3706
+
 
 /**
  * In order to convert modules into 8-bit words, the matrix is divided
@@ -69,4 +73,54 @@ int get_codewords(struct bit_matrix* modules,
                 u_int8_t mask_pattern,
                 u_int8_t* *codewords);
 
+
+/**
+ * Same as get_codewords() but the codewords are written in the given
+ * array, which must be large enough for MAX_CODEWORDS codewords.
+ *
+ * @return n > 0 the number of decoded codewords on success
+ *         DECODING_ERROR if the matrix sizes are different or not valid QR code sizes,
+ *                        or if the mask_pattern value is not between 0 and 7
+ */
+int get_codewords_in_buffer(struct bit_matrix* modules,
+                            struct bit_matrix* codeword_mask,
+                            u_int8_t mask_pattern,
+                            u_int8_t* codewords);
+
+
+/**
+ * Scans the given matrix of uncertain modules like get_codewords() does
+ * in order to find which codewords contain at least one module whose
+ * color is not reliable. Such codewords can be treated as erasures,
+ * i.e. errors whose positions are already known, which only cost one
+ * error correction codeword each instead of two.
+ *
+ * @param uncertain_modules A matrix where 1s represent uncertain modules
+ * @param codeword_mask A matrix where 1s represent function modules
+ *                      that should be ignored when scanning for data
+ *                      modules
+ * @param uncertain_codewords The address where to store an array that will
+ *                            be dynamically allocated with one value per
+ *                            codeword: 1 if the codeword is uncertain, 0
+ *                            otherwise
+ * @return n > 0 the number of codewords on success
+ *         DECODING_ERROR if the matrix sizes are different or not valid QR code sizes
+ *         MEMORY_ERROR on memory allocation error
+ */
+int get_uncertain_codewords(struct bit_matrix* uncertain_modules,
+                            struct bit_matrix* codeword_mask,
+                            u_int8_t* *uncertain_codewords);
+
+
+/**
+ * Same as get_uncertain_codewords() but the flags are written in the given
+ * array, which must be large enough for MAX_CODEWORDS codewords.
+ *
+ * @return n > 0 the number of codewords on success
+ *         DECODING_ERROR if the matrix sizes are different or not valid QR code sizes
+ */
+int get_uncertain_codewords_in_buffer(struct bit_matrix* uncertain_modules,
+                                    struct bit_matrix* codeword_mask,
+                                    u_int8_t* uncertain_codewords);
+
 #endif
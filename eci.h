@@ -73,6 +73,15 @@ int read_eci_designator(struct bitstream* stream);
 const char* get_eci_name(EciMode mode);
 
 
+/**
+ * Returns the table of 256 unicode values corresponding to the bytes
+ * of the given charset, or NULL if the given mode is not a single byte
+ * charset. This allows decoders to find the table once and then convert
+ * each byte with a simple lookup.
+ */
+const u_int32_t* get_single_byte_charset(EciMode mode);
+
+
 /**
  * Returns the unicode value corresponding to the given byte.
  */
@@ -15,4 +15,12 @@
 // When the image path cannot be loaded
 #define CANNOT_LOAD_IMAGE -4
 
+// When a buffer provided by the caller is too small
+// to receive the result
+#define BUFFER_TOO_SMALL -5
+
+// When a non-blocking operation cannot be done
+// without waiting
+#define WOULD_BLOCK -6
+
 #endif
@@ -1,7 +1,7 @@
 #include "euc_kr.h"
 
 
-static u_int32_t euc_kr_index_codepoint[] = {
+static const u_int32_t euc_kr_index_codepoint[] = {
  0xac02, 0xac03, 0xac05, 0xac06, 0xac0b, 0xac0c, 0xac0d, 0xac0e, 0xac0f, 0xac18, 0xac1e, 0xac1f, 0xac21, 0xac22, 0xac23, 0xac25,
  0xac26, 0xac27, 0xac28, 0xac29, 0xac2a, 0xac2b, 0xac2e, 0xac32, 0xac33, 0xac34, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
  0xac35, 0xac36, 0xac37, 0xac3a, 0xac3b, 0xac3d, 0xac3e, 0xac3f, 0xac41, 0xac42, 0xac43, 0xac44, 0xac45, 0xac46, 0xac47, 0xac48,
@@ -2,15 +2,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "allocator.h"
 #include "bitmatrix.h"
 #include "finderpattern.h"
 
 
 static int check_potential_center(struct bit_matrix* bm,  int search_finder_pattern, unsigned int pixel_counts[],
-                            unsigned int x, unsigned int y, struct finder_pattern_list* *list);
+                            unsigned int x, unsigned int y, struct arena* arena, struct finder_pattern_list* *list);
 
 
-int find_potential_centers(struct bit_matrix* bm, int search_finder_pattern, struct finder_pattern_list* *list) {
+int find_potential_centers(struct bit_matrix* bm, int search_finder_pattern, struct arena* arena,
+                            struct finder_pattern_list* *list) {
     unsigned int maxY = bm->height;
     unsigned int maxX = bm->width;
 
@@ -38,7 +40,7 @@ int find_potential_centers(struct bit_matrix* bm, int search_finder_pattern, str
                     if (current_state == 4) {
                         // We have now found a b/w/b/w/b pattern.
                         // We need to check if it looks like a finder pattern
-                        int res = check_potential_center(bm, search_finder_pattern, pixel_counts, x, y, list);
+                        int res = check_potential_center(bm, search_finder_pattern, pixel_counts, x, y, arena, list);
                         if (res == MEMORY_ERROR) {
                             return MEMORY_ERROR;
                         }
@@ -65,7 +67,7 @@ int find_potential_centers(struct bit_matrix* bm, int search_finder_pattern, str
             }
         }
         // A valid match may be ended by the right edge of the image rather than a white pixel
-        if (MEMORY_ERROR == check_potential_center(bm, search_finder_pattern, pixel_counts, maxX, y, list)) {
+        if (MEMORY_ERROR == check_potential_center(bm, search_finder_pattern, pixel_counts, maxX, y, arena, list)) {
             return MEMORY_ERROR;
         }
     }
@@ -74,8 +76,16 @@ int find_potential_centers(struct bit_matrix* bm, int search_finder_pattern, str
 }
 
 
-struct finder_pattern_list* create_finder_pattern_list(float x, float y, float module_size) {
-    struct finder_pattern_list* list = (struct finder_pattern_list*)malloc(sizeof(struct finder_pattern_list));
+/**
+ * Creates a list item in the given arena or with malloc if the arena is NULL.
+ */
+static struct finder_pattern_list* create_finder_pattern_list(struct arena* arena, float x, float y, float module_size) {
+    struct finder_pattern_list* list;
+    if (arena != NULL) {
+        list = (struct finder_pattern_list*)arena_alloc(arena, sizeof(struct finder_pattern_list));
+    } else {
+        list = (struct finder_pattern_list*)qr_malloc(sizeof(struct finder_pattern_list));
+    }
     if (list == NULL) {
         return NULL;
     }
@@ -92,7 +102,7 @@ void free_finder_pattern_list(struct finder_pattern_list* list) {
     struct finder_pattern_list* next;
     while (list != NULL) {
         next = list->next;
-        free(list);
+        qr_free(list);
         list = next;
     }
 }
@@ -346,7 +356,8 @@ static void combine_patterns(struct finder_pattern_list* list, float centerX, fl
  * Return SUCCESS on success
  *        MEMORY_ERROR on memory allocation error.
  */
-static int handle_potential_center(struct finder_pattern_list* *list, float centerX, float centerY, float estimated_module_size) {
+static int handle_potential_center(struct arena* arena, struct finder_pattern_list* *list,
+                                float centerX, float centerY, float estimated_module_size) {
     struct finder_pattern_list* tmp = (*list);
     while (tmp != NULL) {
         if (pattern_close_enough(tmp, centerX, centerY, estimated_module_size)) {
@@ -359,7 +370,7 @@ static int handle_potential_center(struct finder_pattern_list* *list, float cent
 
     // We haven't found any item in the list close enough to our match.
     // Let's add it
-    tmp = create_finder_pattern_list(centerX, centerY, estimated_module_size);
+    tmp = create_finder_pattern_list(arena, centerX, centerY, estimated_module_size);
     if (tmp == NULL) {
         return MEMORY_ERROR;
     }
@@ -379,13 +390,14 @@ static int handle_potential_center(struct finder_pattern_list* *list, float cent
  *                      to check
  * @param xEnd The x coordinate of the first white pixel after the candidate sequence
  * @param y The row where the sequence was found
+ * @param arena If not NULL, the arena where to allocate the list items
  * @param list The list where to add matches
  * @return SUCCESS if the given x,y position is indeed a pattern potential center
  *         DECODING_ERROR if not
  *         MEMORY_ERROR in case of memory allocation error
  */
 static int check_potential_center(struct bit_matrix* bm, int search_finder_pattern, unsigned int pixel_counts[],
-                            unsigned int xEnd, unsigned int y, struct finder_pattern_list* *list) {
+                            unsigned int xEnd, unsigned int y, struct arena* arena, struct finder_pattern_list* *list) {
 
     if (!proper_ratios(pixel_counts, search_finder_pattern)) {
         return DECODING_ERROR;
@@ -404,7 +416,7 @@ static int check_potential_center(struct bit_matrix* bm, int search_finder_patte
     }
 
     float estimated_module_size = total_pixels / (search_finder_pattern ? 7.0f : 5.0f);
-    return handle_potential_center(list, centerX, centerY, estimated_module_size);
+    return handle_potential_center(arena, list, centerX, centerY, estimated_module_size);
 }
 
 
@@ -1,6 +1,7 @@
 #ifndef _FINDERPATTERN_H
 #define _FINDERPATTERN_H
 
+#include "arena.h"
 #include "bitmatrix.h"
 #include "errors.h"
 
@@ -49,12 +50,15 @@ struct finder_pattern_list {
  * @param search_finder_pattern If non zero, the function looks for finder patterns,
  *                              i.e. patterns with 1:1:3:1:1 ratios; if zero, it looks
  *                              for alignment patterns that have 1:1:1:1:1 ratios
+ * @param arena If not NULL, the arena where to allocate the list items.
+ *              If NULL, the list must be freed with free_finder_pattern_list()
  * @param list Where to store the result
  * @return SUCCESS on success
  *         DECODING_ERROR if no center can be found
  *         MEMORY_ERROR in case of memory allocation error
  */
-int find_potential_centers(struct bit_matrix* bm, int search_finder_pattern, struct finder_pattern_list* *list);
+int find_potential_centers(struct bit_matrix* bm, int search_finder_pattern, struct arena* arena,
+                            struct finder_pattern_list* *list);
 
 
 /**
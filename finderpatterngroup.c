@@ -1,6 +1,7 @@
 #include <math.h>
 #include <stdlib.h>
 
+#include "allocator.h"
 #include "finderpatterngroup.h"
 
 // Since the minimum and maximum number of modules of the side
@@ -28,8 +29,14 @@ static int compare_module_sizes(struct finder_pattern_list* *a, struct finder_pa
  * Returns an array where the elements are pointers to the original list elements,
  * but sorted by increasing module size.
  */
-static struct finder_pattern_list** create_sorted_array(unsigned int n, struct finder_pattern_list* list) {
-    struct finder_pattern_list** array = (struct finder_pattern_list**)malloc(n * sizeof(struct finder_pattern_list*));
+static struct finder_pattern_list** create_sorted_array(unsigned int n, struct finder_pattern_list* list,
+                                                        struct arena* arena) {
+    struct finder_pattern_list** array;
+    if (arena != NULL) {
+        array = (struct finder_pattern_list**)arena_alloc(arena, n * sizeof(struct finder_pattern_list*));
+    } else {
+        array = (struct finder_pattern_list**)qr_malloc(n * sizeof(struct finder_pattern_list*));
+    }
     if (array == NULL) {
         return NULL;
     }
@@ -56,13 +63,13 @@ static float get_distance(struct finder_pattern* a, struct finder_pattern* b) {
 
 /**
  * Checks if the 3 given points can form a valid finder pattern group.
- * If so, adds the group to the given list.
+ * If so, adds the group to the given list, allocating it in the given arena if not NULL.
  * @return SUCCESS if a group is added
  *         DECODING_ERROR if no group is added
  *         MEMORY_ERROR in case of memory allocation error
  */
 static int check_points(struct finder_pattern* p1, struct finder_pattern* p2, struct finder_pattern* p3,
-                        struct finder_pattern_group_list* *groups) {
+                        struct arena* arena, struct finder_pattern_group_list* *groups) {
     float distance_1_2 = get_distance(p1, p2);
     float distance_1_3 = get_distance(p1, p3);
     float distance_2_3 = get_distance(p2, p3);
@@ -171,7 +178,12 @@ static int check_points(struct finder_pattern* p1, struct finder_pattern* p2, st
     }
 
     // We have a match
-    struct finder_pattern_group_list* match = (struct finder_pattern_group_list*)malloc(sizeof(struct finder_pattern_group_list));
+    struct finder_pattern_group_list* match;
+    if (arena != NULL) {
+        match = (struct finder_pattern_group_list*)arena_alloc(arena, sizeof(struct finder_pattern_group_list));
+    } else {
+        match = (struct finder_pattern_group_list*)qr_malloc(sizeof(struct finder_pattern_group_list));
+    }
     if (match == NULL) {
         return MEMORY_ERROR;
     }
@@ -185,7 +197,7 @@ static int check_points(struct finder_pattern* p1, struct finder_pattern* p2, st
 }
 
 
-int find_groups(struct finder_pattern_list* list, struct finder_pattern_group_list* *groups) {
+int find_groups(struct finder_pattern_list* list, struct arena* arena, struct finder_pattern_group_list* *groups) {
     unsigned int n = get_list_size(list);
     if (n < 3) {
         // We need at list 3 finder patterns to have a match
@@ -193,7 +205,7 @@ int find_groups(struct finder_pattern_list* list, struct finder_pattern_group_li
     }
 
     // Let's start by sorting the finder patterns by module sizes
-    struct finder_pattern_list** sorted_array = create_sorted_array(n, list);
+    struct finder_pattern_list** sorted_array = create_sorted_array(n, list, arena);
     if (sorted_array == NULL) {
         return MEMORY_ERROR;
     }
@@ -220,15 +232,19 @@ int find_groups(struct finder_pattern_list* list, struct finder_pattern_group_li
                     break;
                 }
 
-                if (MEMORY_ERROR == check_points(p1, p2, p3, groups)) {
-                    free(sorted_array);
+                if (MEMORY_ERROR == check_points(p1, p2, p3, arena, groups)) {
+                    if (arena == NULL) {
+                        qr_free(sorted_array);
+                    }
                     return MEMORY_ERROR;
                 }
             }
         }
     }
 
-    free(sorted_array);
+    if (arena == NULL) {
+        qr_free(sorted_array);
+    }
     return (*groups) ? SUCCESS : DECODING_ERROR;
 }
 
@@ -237,7 +253,7 @@ void free_finder_pattern_group_list(struct finder_pattern_group_list* list) {
     struct finder_pattern_group_list* tmp;
     while (list != NULL) {
         tmp = list->next;
-        free(list);
+        qr_free(list);
         list = tmp;
     }
 }
@@ -26,12 +26,14 @@ struct finder_pattern_group_list {
  * the QR code decoding process eliminate the false positives.
  *
  * @param list The finder patterns
+ * @param arena If not NULL, the arena where to allocate the groups.
+ *              If NULL, the groups must be freed with free_finder_pattern_group_list()
  * @param groups Where to store the groups
  * @return SUCCESS if some groups are found
  *         DECODING_ERROR if no group is found
  *         MEMORY_ERROR in case of memory allocation error
  */
-int find_groups(struct finder_pattern_list* list, struct finder_pattern_group_list* *groups);
+int find_groups(struct finder_pattern_list* list, struct arena* arena, struct finder_pattern_group_list* *groups);
 
 
 /**
@@ -8,7 +8,7 @@
 //
 // This array lists these values so that code[x] is the 15-bit masked
 // value encoding the 5-bit value x
-static u_int16_t code[] = {
+static const u_int16_t code[] = {
     0x5412,
     0x5125,
     0x5E7C,
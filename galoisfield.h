@@ -63,9 +63,19 @@
  *
  * Given that a 2^8 Galois field can represent 256 values, let's represent
  * all the elements as unsigned 8-bit values.
+ *
+ * All the powers, logarithms and inverses are stored in constant tables, so
+ * that these functions can safely be called from multiple threads. When
+ * compiled with GF_MULTIPLICATION_TABLE defined (for instance with
+ * 'make CFLAGS=-DGF_MULTIPLICATION_TABLE'), gf_multiply() uses a 64KB
+ * table containing all the possible products.
  */
 u_int8_t gf_add_or_subtract(u_int8_t a, u_int8_t b);
 u_int8_t gf_multiply(u_int8_t a, u_int8_t b);
+
+/**
+ * Returns 1/a, or 0 if a is 0.
+ */
 u_int8_t gf_inverse(u_int8_t a);
 
 /**
@@ -4,7 +4,7 @@
 /**
  * This data is from https://encoding.spec.whatwg.org/index-gb18030-ranges.txt
  */
-static u_int32_t index_gb18030_ranges[207][2]= {
+static const u_int32_t index_gb18030_ranges[207][2]= {
 {      0, 0x0080 },
 {     36, 0x00A5 },
 {     38, 0x00A9 },
@@ -218,7 +218,7 @@ static u_int32_t index_gb18030_ranges[207][2]= {
 /**
  * This data comes from https://encoding.spec.whatwg.org/index-gb18030.txt
  */
-static u_int32_t index_gb18030[] = {
+static const u_int32_t index_gb18030[] = {
  0x4e02, 0x4e04, 0x4e05, 0x4e06, 0x4e0f, 0x4e12, 0x4e17, 0x4e1f, 0x4e20, 0x4e21, 0x4e23, 0x4e26, 0x4e29, 0x4e2e, 0x4e2f, 0x4e31, 0x4e33,
  0x4e35, 0x4e37, 0x4e3c, 0x4e40, 0x4e41, 0x4e42, 0x4e44, 0x4e46, 0x4e4a, 0x4e51, 0x4e55, 0x4e57, 0x4e5a, 0x4e5b, 0x4e62, 0x4e63,
  0x4e64, 0x4e65, 0x4e67, 0x4e68, 0x4e6a, 0x4e6b, 0x4e6c, 0x4e6d, 0x4e6e, 0x4e6f, 0x4e72, 0x4e74, 0x4e75, 0x4e76, 0x4e77, 0x4e78,
@@ -1720,13 +1720,23 @@ static u_int32_t index_gb18030[] = {
  
 
 
+/**
+ * Returns the index of the last range whose pointer offset is lower than or
+ * equal to the given pointer. Since the ranges are sorted by pointer offset,
+ * this is a binary search.
+ */
 static int find_index(u_int32_t pointer) {
-    for (int i = 1 ; i < 207 ; i++) {
-        if (index_gb18030_ranges[i][0] > pointer) {
-            return i - 1;
+    int low = 0;
+    int high = 206;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (index_gb18030_ranges[middle][0] <= pointer) {
+            low = middle;
+        } else {
+            high = middle - 1;
         }
     }
-    return -1;
+    return low;
 }
 
 
@@ -1744,9 +1754,6 @@ static u_int32_t get_index_gb18030_range_code_point(u_int32_t pointer) {
     }
 
     int index = find_index(pointer);
-    if (index == -1) {
-        return 0;
-    }
     u_int32_t offset = index_gb18030_ranges[index][0];
     u_int32_t code_point_offset = index_gb18030_ranges[index][1];
     
@@ -1784,7 +1791,7 @@ int decode_gb18030_segment(struct bitstream* stream, unsigned int count, struct
                 third = value;
                 continue;
             }
-            return 0;
+            return DECODING_ERROR;
         }
 
         if (first != 0) {
@@ -1,24 +1,79 @@
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include "logs.h"
 
 
-static LogLevel LOG_LEVEL = ERRORS;
+// The level used by the threads that do not have their own,
+// only accessed atomically
+static int LOG_LEVEL = ERRORS;
 
+// The key of the level of each thread. A thread whose value is NULL
+// uses the global level, otherwise the value is its level + 1
+static pthread_key_t THREAD_LOG_LEVEL;
+static pthread_once_t THREAD_LOG_LEVEL_ONCE = PTHREAD_ONCE_INIT;
+static int THREAD_LOG_LEVEL_CREATED = 0;
 
-void set_log_level(LogLevel level) {
+
+static void create_thread_log_level_key() {
+    THREAD_LOG_LEVEL_CREATED = (0 == pthread_key_create(&THREAD_LOG_LEVEL, NULL));
+}
+
+
+/**
+ * Returns the given level if valid, ERRORS otherwise.
+ */
+static LogLevel validate(LogLevel level) {
     switch(level) {
         case NO_LOGS:
         case ERRORS:
         case INFO:
-        case GORY: LOG_LEVEL = level; break;
-        default: LOG_LEVEL = ERRORS; break;
+        case GORY: return level;
+        default: return ERRORS;
+    }
+}
+
+
+int get_thread_log_level() {
+    pthread_once(&THREAD_LOG_LEVEL_ONCE, create_thread_log_level_key);
+    if (!THREAD_LOG_LEVEL_CREATED) {
+        return GLOBAL_LOG_LEVEL;
+    }
+    void* value = pthread_getspecific(THREAD_LOG_LEVEL);
+    return (value == NULL) ? GLOBAL_LOG_LEVEL : (int)((intptr_t)value - 1);
+}
+
+
+/**
+ * Returns the level that applies to the current thread.
+ */
+static LogLevel get_log_level() {
+    int level = get_thread_log_level();
+    if (level == GLOBAL_LOG_LEVEL) {
+        return (LogLevel)__atomic_load_n(&LOG_LEVEL, __ATOMIC_RELAXED);
+    }
+    return (LogLevel)level;
+}
+
+
+void set_log_level(LogLevel level) {
+    __atomic_store_n(&LOG_LEVEL, (int)validate(level), __ATOMIC_RELAXED);
+}
+
+
+int set_thread_log_level(int level) {
+    int previous = get_thread_log_level();
+    if (THREAD_LOG_LEVEL_CREATED) {
+        void* value = (level == GLOBAL_LOG_LEVEL) ? NULL : (void*)((intptr_t)validate((LogLevel)level) + 1);
+        pthread_setspecific(THREAD_LOG_LEVEL, value);
     }
+    return previous;
 }
 
 
 void info(const char* fmt, ...) {
-    if (LOG_LEVEL < INFO) return;
+    if (get_log_level() < INFO) return;
 
     va_list args;
     va_start(args, fmt);
@@ -28,7 +83,7 @@ void info(const char* fmt, ...) {
 
 
 void error(const char* fmt, ...) {
-    if (LOG_LEVEL < ERRORS) return;
+    if (get_log_level() < ERRORS) return;
 
     va_list args;
     va_start(args, fmt);
@@ -38,7 +93,7 @@ void error(const char* fmt, ...) {
 
 
 void gory(const char* fmt, ...) {
-    if (LOG_LEVEL < GORY) return;
+    if (get_log_level() < GORY) return;
 
     va_list args;
     va_start(args, fmt);
@@ -47,13 +102,22 @@ void gory(const char* fmt, ...) {
 }
 
 
-void print_log(LogLevel level_to_use, const char* fmt, ...) {
+/**
+ * Returns whether messages of the given level are to be printed.
+ */
+static int is_enabled(LogLevel level_to_use) {
+    LogLevel level = get_log_level();
     switch (level_to_use) {
-        case NO_LOGS: return;
-        case INFO: if (LOG_LEVEL < INFO) return; break;
-        case GORY: if (LOG_LEVEL < GORY) return; break;
-        default:  if (LOG_LEVEL < ERRORS) return; break;
+        case NO_LOGS: return 0;
+        case INFO: return level >= INFO;
+        case GORY: return level >= GORY;
+        default: return level >= ERRORS;
     }
+}
+
+
+void print_log(LogLevel level_to_use, const char* fmt, ...) {
+    if (!is_enabled(level_to_use)) return;
 
     va_list args;
     va_start(args, fmt);
@@ -63,6 +127,9 @@ void print_log(LogLevel level_to_use, const char* fmt, ...) {
 
 
 void print_bytes(LogLevel level, u_int8_t* bytes, unsigned int n_bytes) {
+    // Let's not check the level for each byte when there is nothing to print
+    if (!is_enabled(level)) return;
+
     for (unsigned int i = 0 ; i < n_bytes ; i++) {
         if (i > 0 && (i % 32) == 0) {
             print_log(level, "\n");
@@ -71,4 +138,3 @@ void print_bytes(LogLevel level, u_int8_t* bytes, unsigned int n_bytes) {
     }
     print_log(level, "\n");
 }
-
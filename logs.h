@@ -19,13 +19,42 @@ typedef enum {
 } LogLevel;
 
 
+// Used to indicate that a thread uses the global log level
+#define GLOBAL_LOG_LEVEL -1
+
+
 /**
+ * Sets the global log level, i.e. the one used by the threads that do not
+ * have their own, like the ones that decode without a decoder. It can be
+ * changed at any time, even while other threads are decoding, but the
+ * threads that run a decoder use the decoder's level, if any, instead.
+ *
  * @param level The log level to use. Will use ERRORS if
  *              the given value is not a valid LogLevel value
  */
 void set_log_level(LogLevel level);
 
 
+/**
+ * Makes the current thread use its own log level instead of the
+ * global one. This is what decoders use to apply their own log level
+ * while they are running, and what their worker threads use to apply
+ * the level of the thread they work for.
+ *
+ * @param level The log level to use for the current thread, or
+ *              GLOBAL_LOG_LEVEL to go back to the global one
+ * @return The previous level of the thread, so that it can be restored
+ */
+int set_thread_log_level(int level);
+
+
+/**
+ * Returns the log level of the current thread, or GLOBAL_LOG_LEVEL
+ * if it uses the global one.
+ */
+int get_thread_log_level();
+
+
 /**
  * Emits a debug log message to stderr, if the log level allows it.
  */
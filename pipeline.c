@@ -0,0 +1,374 @@
+#include <pthread.h>
+#include "allocator.h"
+#include "binarize.h"
+#include "pipeline.h"
+#include "qrcode.h"
+
+#define N_STAGES 3
+
+
+/**
+ * A frame and the buffers it needs to go through the pipeline.
+ */
+struct pipeline_frame {
+    struct rgb_image* image;
+    void* tag;
+
+    u_int8_t* luminances;
+    unsigned int luminances_capacity;
+    u_int8_t* black_points;
+    unsigned int black_points_capacity;
+    struct bit_matrix bit_matrix;
+    unsigned int bit_matrix_capacity;
+
+    // SUCCESS as long as no stage has failed
+    int res;
+};
+
+
+/**
+ * A ring buffer with a single producer and a single consumer. The producer
+ * only touches next_write and the consumer only touches next_read, so that
+ * no lock is needed. The atomic frame count orders the accesses to the slots,
+ * and the lock and condition variable are only used when the consumer has to
+ * sleep until a frame arrives. There is no need to wait for room, because a
+ * ring is always large enough for all the frames plus the end of stream marker.
+ */
+struct frame_ring {
+    struct pipeline_frame** frames;
+    unsigned int size;
+    unsigned int next_write;
+    unsigned int next_read;
+
+    // The number of frames in the ring, only accessed atomically
+    unsigned int n_frames;
+
+    // Set by the consumer while it is waiting for a frame,
+    // only accessed atomically
+    int consumer_waiting;
+
+    // Protects the waiting of the consumer
+    pthread_mutex_t lock;
+
+    // Signaled when a frame is added while the consumer is waiting
+    pthread_cond_t has_frames;
+};
+
+
+struct qr_pipeline {
+    qr_async_callback callback;
+    void* data;
+
+    struct pipeline_frame* frames;
+    unsigned int n_frames;
+
+    // The frames that are ready to be reused, then the
+    // input of each stage
+    struct frame_ring free_frames;
+    struct frame_ring stages[N_STAGES];
+
+    // The decoder used by the last stage
+    struct qr_decoder* decoder;
+
+    pthread_t threads[N_STAGES];
+};
+
+
+static int init_ring(struct frame_ring* ring, unsigned int size) {
+    ring->frames = (struct pipeline_frame**)qr_malloc(size * sizeof(struct pipeline_frame*));
+    if (ring->frames == NULL) {
+        return MEMORY_ERROR;
+    }
+    if (0 != pthread_mutex_init(&(ring->lock), NULL)) {
+        qr_free(ring->frames);
+        ring->frames = NULL;
+        return MEMORY_ERROR;
+    }
+    if (0 != pthread_cond_init(&(ring->has_frames), NULL)) {
+        pthread_mutex_destroy(&(ring->lock));
+        qr_free(ring->frames);
+        ring->frames = NULL;
+        return MEMORY_ERROR;
+    }
+    ring->size = size;
+    ring->next_write = 0;
+    ring->next_read = 0;
+    ring->n_frames = 0;
+    ring->consumer_waiting = 0;
+    return SUCCESS;
+}
+
+
+static void free_ring(struct frame_ring* ring) {
+    if (ring->frames != NULL) {
+        pthread_cond_destroy(&(ring->has_frames));
+        pthread_mutex_destroy(&(ring->lock));
+        qr_free(ring->frames);
+    }
+}
+
+
+/**
+ * Adds a frame to the given ring. NULL marks the end of the stream.
+ */
+static void put_frame(struct frame_ring* ring, struct pipeline_frame* frame) {
+    ring->frames[ring->next_write] = frame;
+    ring->next_write = (ring->next_write + 1) % ring->size;
+    __atomic_add_fetch(&(ring->n_frames), 1, __ATOMIC_SEQ_CST);
+
+    // If the consumer is not waiting, it is guaranteed to see the new count
+    // before it decides to wait, so that there is no need to take the lock
+    if (__atomic_load_n(&(ring->consumer_waiting), __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&(ring->lock));
+        pthread_cond_signal(&(ring->has_frames));
+        pthread_mutex_unlock(&(ring->lock));
+    }
+}
+
+
+/**
+ * Takes the oldest frame of the given ring, that must not be empty.
+ */
+static struct pipeline_frame* take_frame(struct frame_ring* ring) {
+    struct pipeline_frame* frame = ring->frames[ring->next_read];
+    ring->next_read = (ring->next_read + 1) % ring->size;
+    __atomic_sub_fetch(&(ring->n_frames), 1, __ATOMIC_SEQ_CST);
+    return frame;
+}
+
+
+/**
+ * Takes the oldest frame of the given ring, waiting for one if needed.
+ */
+static struct pipeline_frame* get_frame(struct frame_ring* ring) {
+    if (0 == __atomic_load_n(&(ring->n_frames), __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&(ring->lock));
+        __atomic_store_n(&(ring->consumer_waiting), 1, __ATOMIC_SEQ_CST);
+        while (0 == __atomic_load_n(&(ring->n_frames), __ATOMIC_SEQ_CST)) {
+            pthread_cond_wait(&(ring->has_frames), &(ring->lock));
+        }
+        __atomic_store_n(&(ring->consumer_waiting), 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&(ring->lock));
+    }
+    return take_frame(ring);
+}
+
+
+/**
+ * Same as get_frame() but returns NULL instead of waiting.
+ */
+static struct pipeline_frame* try_get_frame(struct frame_ring* ring) {
+    if (0 == __atomic_load_n(&(ring->n_frames), __ATOMIC_SEQ_CST)) {
+        return NULL;
+    }
+    return take_frame(ring);
+}
+
+
+/**
+ * Makes sure that the given buffer has at least the given size.
+ */
+static int reserve_frame_buffer(u_int8_t* *buffer, unsigned int *capacity, unsigned int size) {
+    if (size <= (*capacity)) {
+        return SUCCESS;
+    }
+    qr_free(*buffer);
+    (*buffer) = (u_int8_t*)qr_malloc(size);
+    if ((*buffer) == NULL) {
+        (*capacity) = 0;
+        return MEMORY_ERROR;
+    }
+    (*capacity) = size;
+    return SUCCESS;
+}
+
+
+/**
+ * First stage: makes sure the frame buffers are large enough
+ * and computes the luminances.
+ */
+static void compute_luminances(struct pipeline_frame* frame) {
+    struct rgb_image* img = frame->image;
+    unsigned int n_pixels = img->width * img->height;
+    if (SUCCESS != reserve_frame_buffer(&(frame->luminances), &(frame->luminances_capacity), n_pixels)
+        || SUCCESS != reserve_frame_buffer(&(frame->black_points), &(frame->black_points_capacity),
+                                            get_n_black_points(img->width, img->height))
+        || SUCCESS != reserve_frame_buffer(&(frame->bit_matrix.matrix), &(frame->bit_matrix_capacity),
+                                            (n_pixels / 8) + ((n_pixels % 8) != 0))) {
+        frame->res = MEMORY_ERROR;
+        return;
+    }
+    calculate_luminances(img, frame->luminances);
+    frame->res = SUCCESS;
+}
+
+
+/**
+ * Second stage: converts the frame into a black and white matrix.
+ */
+static void binarize_frame(struct pipeline_frame* frame) {
+    if (frame->res != SUCCESS) {
+        return;
+    }
+    frame->bit_matrix.width = frame->image->width;
+    frame->bit_matrix.height = frame->image->height;
+    binarize_luminances(frame->luminances, frame->black_points, &(frame->bit_matrix));
+}
+
+
+/**
+ * Third stage: looks for QR codes, sends the result
+ * to the callback and recycles the frame.
+ */
+static void decode_frame(struct qr_pipeline* pipeline, struct pipeline_frame* frame) {
+    struct qr_async_result result;
+    result.image = frame->image;
+    result.tag = frame->tag;
+    result.res = frame->res;
+    result.matches = NULL;
+    if (frame->res == SUCCESS) {
+        result.res = find_qr_codes_in_binarized_image(pipeline->decoder, &(frame->bit_matrix), &(result.matches), NULL);
+        if (result.res != SUCCESS) {
+            result.matches = NULL;
+        }
+    }
+    pipeline->callback(result, pipeline->data);
+    put_frame(&(pipeline->free_frames), frame);
+}
+
+
+/**
+ * The arguments of a stage thread.
+ */
+struct stage_job {
+    struct qr_pipeline* pipeline;
+    unsigned int stage;
+};
+
+
+/**
+ * Processes the frames that come to the given stage until the end of the stream.
+ */
+static void* run_stage(void* data) {
+    struct qr_pipeline* pipeline = ((struct stage_job*)data)->pipeline;
+    unsigned int stage = ((struct stage_job*)data)->stage;
+    qr_free(data);
+
+    struct frame_ring* input = &(pipeline->stages[stage]);
+    struct frame_ring* output = (stage + 1 < N_STAGES) ? &(pipeline->stages[stage + 1]) : NULL;
+    for (;;) {
+        struct pipeline_frame* frame = get_frame(input);
+        if (frame != NULL) {
+            switch (stage) {
+                case 0: compute_luminances(frame); break;
+                case 1: binarize_frame(frame); break;
+                default: decode_frame(pipeline, frame); continue;
+            }
+        }
+        if (output != NULL) {
+            put_frame(output, frame);
+        }
+        if (frame == NULL) {
+            return NULL;
+        }
+    }
+}
+
+
+/**
+ * Frees everything but the threads, that must have been stopped.
+ */
+static void free_pipeline_resources(struct qr_pipeline* pipeline) {
+    if (pipeline->frames != NULL) {
+        for (unsigned int i = 0 ; i < pipeline->n_frames ; i++) {
+            qr_free(pipeline->frames[i].luminances);
+            qr_free(pipeline->frames[i].black_points);
+            qr_free(pipeline->frames[i].bit_matrix.matrix);
+        }
+        qr_free(pipeline->frames);
+    }
+    free_ring(&(pipeline->free_frames));
+    for (unsigned int i = 0 ; i < N_STAGES ; i++) {
+        free_ring(&(pipeline->stages[i]));
+    }
+    if (pipeline->decoder != NULL) {
+        free_qr_decoder(pipeline->decoder);
+    }
+    qr_free(pipeline);
+}
+
+
+/**
+ * Sends the end of stream marker and waits for the given number of stages to stop.
+ */
+static void stop_stages(struct qr_pipeline* pipeline, unsigned int n_started) {
+    put_frame(&(pipeline->stages[0]), NULL);
+    for (unsigned int i = 0 ; i < n_started ; i++) {
+        pthread_join(pipeline->threads[i], NULL);
+    }
+}
+
+
+struct qr_pipeline* new_qr_pipeline(unsigned int n_frames, qr_async_callback callback, void* data) {
+    if (n_frames == 0 || callback == NULL) {
+        return NULL;
+    }
+    struct qr_pipeline* pipeline = (struct qr_pipeline*)qr_calloc(1, sizeof(struct qr_pipeline));
+    if (pipeline == NULL) {
+        return NULL;
+    }
+    pipeline->callback = callback;
+    pipeline->data = data;
+    pipeline->n_frames = n_frames;
+    pipeline->frames = (struct pipeline_frame*)qr_calloc(n_frames, sizeof(struct pipeline_frame));
+    pipeline->decoder = new_qr_decoder();
+    int res = (pipeline->frames != NULL && pipeline->decoder != NULL) ? SUCCESS : MEMORY_ERROR;
+    if (res == SUCCESS) {
+        res = init_ring(&(pipeline->free_frames), n_frames);
+    }
+    for (unsigned int i = 0 ; res == SUCCESS && i < N_STAGES ; i++) {
+        // One more slot for the end of stream marker
+        res = init_ring(&(pipeline->stages[i]), n_frames + 1);
+    }
+    if (res != SUCCESS) {
+        free_pipeline_resources(pipeline);
+        return NULL;
+    }
+    for (unsigned int i = 0 ; i < n_frames ; i++) {
+        put_frame(&(pipeline->free_frames), &(pipeline->frames[i]));
+    }
+
+    for (unsigned int i = 0 ; i < N_STAGES ; i++) {
+        struct stage_job* job = (struct stage_job*)qr_malloc(sizeof(struct stage_job));
+        if (job != NULL) {
+            job->pipeline = pipeline;
+            job->stage = i;
+        }
+        if (job == NULL || 0 != pthread_create(&(pipeline->threads[i]), NULL, run_stage, job)) {
+            qr_free(job);
+            stop_stages(pipeline, i);
+            free_pipeline_resources(pipeline);
+            return NULL;
+        }
+    }
+    return pipeline;
+}
+
+
+int push_qr_frame(struct qr_pipeline* pipeline, struct rgb_image* image, void* tag, int blocking) {
+    struct pipeline_frame* frame = blocking ? get_frame(&(pipeline->free_frames))
+                                            : try_get_frame(&(pipeline->free_frames));
+    if (frame == NULL) {
+        return WOULD_BLOCK;
+    }
+    frame->image = image;
+    frame->tag = tag;
+    put_frame(&(pipeline->stages[0]), frame);
+    return SUCCESS;
+}
+
+
+void free_qr_pipeline(struct qr_pipeline* pipeline) {
+    stop_stages(pipeline, N_STAGES);
+    free_pipeline_resources(pipeline);
+}
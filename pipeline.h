@@ -0,0 +1,59 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include "async.h"
+#include "rgbimage.h"
+
+
+/**
+ * A pipeline decodes a stream of frames, like the ones of a camera, by
+ * running the stages of the decoding on different threads so that they
+ * overlap across frames: while the QR codes of frame N are being searched,
+ * frame N+1 is being binarized and the luminances of frame N+2 are being
+ * computed. The throughput is then bounded by the slowest stage rather
+ * than by the sum of all the stages.
+ *
+ * The buffers needed by each frame are recycled, so that once the pipeline
+ * has seen frames of a given size, no more allocation is needed for them.
+ */
+struct qr_pipeline;
+
+
+/**
+ * Creates a pipeline.
+ *
+ * @param n_frames The maximum number of frames being processed at the
+ *                 same time. A value lower than the number of stages
+ *                 leaves some stages idle
+ * @param callback The function that receives the results, always in the
+ *                 order in which the frames were pushed, from the thread
+ *                 of the last stage. It takes ownership of the matches
+ * @param data The data to pass to the callback
+ * @return The pipeline or NULL in case of error
+ */
+struct qr_pipeline* new_qr_pipeline(unsigned int n_frames, qr_async_callback callback, void* data);
+
+
+/**
+ * Pushes a frame into the pipeline. The image must not be modified or freed
+ * before its result has been received. This function must not be called
+ * from several threads at the same time.
+ *
+ * @param pipeline The pipeline
+ * @param image The image to decode
+ * @param tag Anything that helps the caller to identify the result
+ * @param blocking If not 0 and n_frames frames are already being processed,
+ *                 waits until the oldest one is done
+ * @return SUCCESS if the frame was pushed
+ *         WOULD_BLOCK if the pipeline is full and blocking is 0
+ */
+int push_qr_frame(struct qr_pipeline* pipeline, struct rgb_image* image, void* tag, int blocking);
+
+
+/**
+ * Waits for all the frames to be processed, stops the threads
+ * and frees the pipeline.
+ */
+void free_qr_pipeline(struct qr_pipeline* pipeline);
+
+#endif
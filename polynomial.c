@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "allocator.h"
 #include "galoisfield.h"
 #include "polynomial.h"
 
@@ -19,13 +20,13 @@ u_int8_t evaluate_polynomial(struct gf_polynomial* p, u_int8_t x) {
 
 
 struct gf_polynomial* new_gf_polynomial(unsigned int n_coefficients, u_int8_t* coefficients) {
-    struct gf_polynomial* p = (struct gf_polynomial*)malloc(sizeof(struct gf_polynomial));
+    struct gf_polynomial* p = (struct gf_polynomial*)qr_malloc(sizeof(struct gf_polynomial));
     if (p == NULL) {
         return NULL;
     }
-    p->coefficients = (u_int8_t*)calloc(n_coefficients, sizeof(u_int8_t));
+    p->coefficients = (u_int8_t*)qr_calloc(n_coefficients, sizeof(u_int8_t));
     if (p->coefficients == NULL) {
-        free(p);
+        qr_free(p);
         return NULL;
     }
     if (coefficients != NULL) {
@@ -37,8 +38,8 @@ struct gf_polynomial* new_gf_polynomial(unsigned int n_coefficients, u_int8_t* c
 
 
 void free_gf_polynomial(struct gf_polynomial* p) {
-    free(p->coefficients);
-    free(p);
+    qr_free(p->coefficients);
+    qr_free(p);
 }
 
 
@@ -158,7 +159,7 @@ int divide_polynomials(struct gf_polynomial* a, struct gf_polynomial* b,
     // q(n) q(n-1) ... q(0) r(m) ... r(0)
     //
     // where q(i) is the quotient coefficient for degree i.
-    u_int8_t* tmp = (u_int8_t*)malloc((degree_a + 1) * sizeof(u_int8_t));
+    u_int8_t* tmp = (u_int8_t*)qr_malloc((degree_a + 1) * sizeof(u_int8_t));
     if (tmp == NULL) {
         return -2;
     }
@@ -183,17 +184,17 @@ int divide_polynomials(struct gf_polynomial* a, struct gf_polynomial* b,
     // When we are done, we construct the quotient and remainder from the array
     *quotient = new_gf_polynomial(degree_a, tmp);
     if ((*quotient) == NULL) {
-        free(tmp);
+        qr_free(tmp);
         return -2;
     }
     *remainder = new_gf_polynomial(degree_b, tmp + degree_a);
     if ((*remainder) == NULL) {
-        free(*quotient);
-        free(tmp);
+        qr_free(*quotient);
+        qr_free(tmp);
         return -2;
     }
 
-    free(tmp);
+    qr_free(tmp);
     return 1;
 }
 
@@ -1,5 +1,8 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "allocator.h"
+#include "arena.h"
 #include "binarize.h"
 #include "bitstream.h"
 #include "bitstreamdecoder.h"
@@ -13,22 +16,263 @@
 #include "qrcode.h"
 #include "qrcodefinder.h"
 #include "reedsolomon.h"
+#include "resultcache.h"
 #include "rgbimage.h"
+#include "threadpool.h"
 #include "versioninformation.h"
 
 
+/**
+ * The buffers needed to go from the modules of a QR code to its data
+ * codewords. They are large enough for any version, so that a decoder
+ * can decode any QR code without allocating them.
+ */
+struct bitstream_buffers {
+    u_int8_t codewords[MAX_CODEWORDS];
+    u_int8_t uncertain_codewords[MAX_CODEWORDS];
+
+    struct blocks blocks;
+    struct block block[MAX_BLOCKS];
+    u_int8_t block_codewords[MAX_CODEWORDS];
+
+    struct blocks uncertain_blocks;
+    struct block uncertain_block[MAX_BLOCKS];
+    u_int8_t uncertain_block_codewords[MAX_CODEWORDS];
+
+    // Reads the data codewords from block_codewords
+    struct bitstream bitstream;
+};
+
+
+/**
+ * The buffers that are kept from one image to the next. They only
+ * grow, so that decoding images of the same size again and again
+ * does not need any new allocation for them.
+ */
+struct qr_decoder {
+    // The image loaded from a png file and the size of its buffer
+    struct rgb_image image;
+    unsigned int image_capacity;
+
+    // The buffers used to binarize the image and their sizes
+    u_int8_t* luminances;
+    unsigned int luminances_capacity;
+    u_int8_t* black_points;
+    unsigned int black_points_capacity;
+
+    // The black and white version of the image and the size of its matrix
+    struct bit_matrix bit_matrix;
+    unsigned int bit_matrix_capacity;
+
+    // The arena where the finder patterns and their groups are
+    // allocated while analyzing an image
+    struct arena* arena;
+
+    // The QR code candidates are sampled into these matrices that
+    // are large enough for any QR code version
+    struct bit_matrix* modules;
+    struct bit_matrix* uncertain_modules;
+
+    // For each version, the mask that indicates the data modules,
+    // or NULL if it has not been needed yet
+    struct bit_matrix* codeword_masks[40];
+
+    // The log level to use while this decoder is running
+    // or GLOBAL_LOG_LEVEL
+    int log_level;
+
+    // The number of threads used to decode the candidates of an image,
+    // the decoders that provide the buffers of the extra threads and
+    // the pool that provides these threads, created when needed
+    unsigned int n_threads;
+    struct qr_decoder* helpers[MAX_DECODER_THREADS - 1];
+    struct thread_pool* candidate_pool;
+
+    // If not NULL, where to look for the messages of the
+    // module matrices that have already been decoded
+    struct qr_result_cache* result_cache;
+
+    // The number of threads used to correct the blocks of a QR code
+    // and the pool that provides the extra ones, created when needed
+    unsigned int n_block_threads;
+    struct thread_pool* block_pool;
+
+    // Where the codewords of the QR codes are extracted and corrected
+    struct bitstream_buffers bitstream_buffers;
+};
+
+
+struct qr_decoder* new_qr_decoder() {
+    struct qr_decoder* decoder = (struct qr_decoder*)qr_calloc(1, sizeof(struct qr_decoder));
+    if (decoder == NULL) {
+        return NULL;
+    }
+    decoder->log_level = GLOBAL_LOG_LEVEL;
+    decoder->n_threads = 1;
+    decoder->n_block_threads = 1;
+    decoder->modules = create_bit_matrix(MAX_QR_CODE_DIMENSION, MAX_QR_CODE_DIMENSION);
+    decoder->uncertain_modules = create_bit_matrix(MAX_QR_CODE_DIMENSION, MAX_QR_CODE_DIMENSION);
+    decoder->arena = new_arena();
+    if (decoder->modules == NULL || decoder->uncertain_modules == NULL || decoder->arena == NULL) {
+        free_qr_decoder(decoder);
+        return NULL;
+    }
+    return decoder;
+}
+
+
+void free_qr_decoder(struct qr_decoder* decoder) {
+    qr_free(decoder->image.buffer);
+    qr_free(decoder->luminances);
+    qr_free(decoder->black_points);
+    qr_free(decoder->bit_matrix.matrix);
+    if (decoder->modules != NULL) {
+        free_bit_matrix(decoder->modules);
+    }
+    if (decoder->uncertain_modules != NULL) {
+        free_bit_matrix(decoder->uncertain_modules);
+    }
+    if (decoder->arena != NULL) {
+        free_arena(decoder->arena);
+    }
+    for (unsigned int i = 0 ; i < 40 ; i++) {
+        if (decoder->codeword_masks[i] != NULL) {
+            free_bit_matrix(decoder->codeword_masks[i]);
+        }
+    }
+    if (decoder->candidate_pool != NULL) {
+        free_thread_pool(decoder->candidate_pool);
+    }
+    for (unsigned int i = 0 ; i < MAX_DECODER_THREADS - 1 ; i++) {
+        if (decoder->helpers[i] != NULL) {
+            free_qr_decoder(decoder->helpers[i]);
+        }
+    }
+    if (decoder->block_pool != NULL) {
+        free_thread_pool(decoder->block_pool);
+    }
+    qr_free(decoder);
+}
+
+
+void set_decoder_log_level(struct qr_decoder* decoder, int level) {
+    decoder->log_level = level;
+}
+
+
+void set_decoder_n_threads(struct qr_decoder* decoder, unsigned int n_threads) {
+    if (n_threads < 1) {
+        n_threads = 1;
+    }
+    if (n_threads > MAX_DECODER_THREADS) {
+        n_threads = MAX_DECODER_THREADS;
+    }
+    if (n_threads != decoder->n_threads && decoder->candidate_pool != NULL) {
+        free_thread_pool(decoder->candidate_pool);
+        decoder->candidate_pool = NULL;
+    }
+    decoder->n_threads = n_threads;
+}
+
+
+void set_decoder_n_block_threads(struct qr_decoder* decoder, unsigned int n_threads) {
+    if (n_threads < 1) {
+        n_threads = 1;
+    }
+    if (n_threads > MAX_DECODER_THREADS) {
+        n_threads = MAX_DECODER_THREADS;
+    }
+    if (n_threads != decoder->n_block_threads && decoder->block_pool != NULL) {
+        free_thread_pool(decoder->block_pool);
+        decoder->block_pool = NULL;
+    }
+    decoder->n_block_threads = n_threads;
+}
+
+
+void set_decoder_result_cache(struct qr_decoder* decoder, struct qr_result_cache* cache) {
+    decoder->result_cache = cache;
+}
+
+
+/**
+ * Makes sure that the given buffer has at least the given size.
+ * Since the buffers are scratch space, their content is not
+ * preserved when they have to be enlarged.
+ *
+ * Returns SUCCESS or MEMORY_ERROR.
+ */
+static int reserve_buffer(u_int8_t* *buffer, unsigned int *capacity, unsigned int size) {
+    if (size <= (*capacity)) {
+        return SUCCESS;
+    }
+    qr_free(*buffer);
+    (*buffer) = (u_int8_t*)qr_malloc(size);
+    if ((*buffer) == NULL) {
+        (*capacity) = 0;
+        return MEMORY_ERROR;
+    }
+    (*capacity) = size;
+    return SUCCESS;
+}
+
+
+static int decode_qr_code(struct qr_decoder* decoder, struct bit_matrix* matrix,
+                        struct bit_matrix* uncertain_modules, struct bytebuffer* *code);
+static int decode_qr_code_in_buffer(struct qr_decoder* decoder, struct bit_matrix* matrix,
+                                    struct bit_matrix* uncertain_modules,
+                                    u_int8_t* message, unsigned int capacity);
+static int find_qr_codes_in_bit_matrix(struct qr_decoder* decoder, struct bit_matrix* bm,
+                                    struct qr_code_match_list* *match_list,
+                                    struct finder_pattern_list* *potential_finder_patterns);
+
+
 int find_qr_codes(const char* png, struct qr_code_match_list* *match_list,
                 struct finder_pattern_list* *potential_finder_patterns) {
     (*match_list) = NULL;
+    struct qr_decoder* decoder = new_qr_decoder();
+    if (decoder == NULL) {
+        return MEMORY_ERROR;
+    }
+    int res = find_qr_codes_with_decoder(decoder, png, match_list, potential_finder_patterns);
+    free_qr_decoder(decoder);
+    return res;
+}
+
+
+int find_qr_codes_with_decoder(struct qr_decoder* decoder, const char* png,
+                            struct qr_code_match_list* *match_list,
+                            struct finder_pattern_list* *potential_finder_patterns) {
+    (*match_list) = NULL;
+    if (potential_finder_patterns != NULL) {
+        (*potential_finder_patterns) = NULL;
+    }
 
     // First, let's load the png image as an RGB image
-    struct rgb_image* img;
-    int res = load_rgb_image(png, &img);
-    if (res == CANNOT_LOAD_IMAGE) {
+    int res = reload_rgb_image(png, &(decoder->image), &(decoder->image_capacity));
+    if (res != SUCCESS) {
         return res;
     }
-    if (res == MEMORY_ERROR) {
-        return res;
+
+    return find_qr_codes_in_rgb_image(decoder, &(decoder->image), match_list, potential_finder_patterns);
+}
+
+
+int find_qr_codes_in_rgb_image(struct qr_decoder* decoder, struct rgb_image* img,
+                            struct qr_code_match_list* *match_list,
+                            struct finder_pattern_list* *potential_finder_patterns) {
+    (*match_list) = NULL;
+    if (potential_finder_patterns != NULL) {
+        (*potential_finder_patterns) = NULL;
+    }
+
+    unsigned int n_pixels = img->width * img->height;
+    if (SUCCESS != reserve_buffer(&(decoder->luminances), &(decoder->luminances_capacity), n_pixels)
+        || SUCCESS != reserve_buffer(&(decoder->black_points), &(decoder->black_points_capacity),
+                                        get_n_black_points(img->width, img->height))
+        || SUCCESS != reserve_buffer(&(decoder->bit_matrix.matrix), &(decoder->bit_matrix_capacity),
+                                        (n_pixels / 8) + ((n_pixels % 8) != 0))) {
+        return MEMORY_ERROR;
     }
 
     // Now let's convert the image into a black and white matrix. In
@@ -37,12 +281,275 @@ int find_qr_codes(const char* png, struct qr_code_match_list* *match_list,
     // white module in some part of the image and a black module somewhere
     // else. To avoid such problems, the conversion to black and white is
     // done using some local luminance calculation rules
-    struct bit_matrix* bm = binarize(img);
-    free_rgb_image(img);
-    if (bm == NULL) {
+    struct bit_matrix* bm = &(decoder->bit_matrix);
+    bm->width = img->width;
+    bm->height = img->height;
+    binarize_with_buffers(img, decoder->luminances, decoder->black_points, bm);
+    return find_qr_codes_in_binarized_image(decoder, bm, match_list, potential_finder_patterns);
+}
+
+
+int find_qr_codes_in_binarized_image(struct qr_decoder* decoder, struct bit_matrix* bm,
+                            struct qr_code_match_list* *match_list,
+                            struct finder_pattern_list* *potential_finder_patterns) {
+    (*match_list) = NULL;
+    if (potential_finder_patterns != NULL) {
+        (*potential_finder_patterns) = NULL;
+    }
+
+    // All the temporary lists are allocated in the arena, so that
+    // they can all be released at once when we are done
+    int previous_log_level = set_thread_log_level(decoder->log_level);
+    int res = find_qr_codes_in_bit_matrix(decoder, bm, match_list, potential_finder_patterns);
+    set_thread_log_level(previous_log_level);
+    reset_arena(decoder->arena);
+    return res;
+}
+
+
+/**
+ * Tries to sample and decode the QR code defined by the given group of finder
+ * patterns, using the buffers of the given decoder and allocating temporary
+ * objects in the given arena.
+ *
+ * @return SUCCESS if a QR code was decoded, in which case *match is a new list item
+ *         DECODING_ERROR if there is no QR code to decode
+ *         MEMORY_ERROR in case of memory allocation error
+ */
+static int decode_candidate(struct qr_decoder* decoder, struct bit_matrix* bm,
+                            struct finder_pattern_group_list* group, struct arena* arena,
+                            struct qr_code_match_list* *match) {
+    struct qr_code candidate;
+    candidate.modules = decoder->modules;
+    candidate.uncertain_modules = decoder->uncertain_modules;
+    struct qr_code* code = &candidate;
+    int res = get_qr_code_in_buffers(group->bottom_left, group->top_left, group->top_right, bm, arena, code);
+    if (res != SUCCESS) {
+        return res;
+    }
+
+    // We have a QR code matrix, let's try to decode it
+    info("Found a potential code ");
+    print_matrix(INFO, code->modules);
+
+    struct bytebuffer* message;
+    res = decode_qr_code(decoder, code->modules, code->uncertain_modules, &message);
+    if (res != SUCCESS) {
+        return res;
+    }
+
+    (*match) = (struct qr_code_match_list*)qr_malloc(sizeof(struct qr_code_match_list));
+    if ((*match) == NULL) {
+        free_bytebuffer(message);
+        return MEMORY_ERROR;
+    }
+    (*match)->message = message;
+    (*match)->bottom_left_x = code->bottom_left_x;
+    (*match)->bottom_left_y = code->bottom_left_y;
+    (*match)->top_left_x = code->top_left_x;
+    (*match)->top_left_y = code->top_left_y;
+    (*match)->top_right_x = code->top_right_x;
+    (*match)->top_right_y = code->top_right_y;
+    (*match)->bottom_right_x = code->bottom_right_x;
+    (*match)->bottom_right_y = code->bottom_right_y;
+    (*match)->next = NULL;
+    return SUCCESS;
+}
+
+
+/**
+ * The candidates that a worker has not processed yet. The owner takes
+ * candidates from the start while other workers steal from the end.
+ */
+struct candidate_queue {
+    pthread_mutex_t lock;
+    unsigned int start;
+    unsigned int end;
+};
+
+
+/**
+ * The state shared by the workers that decode the candidates of an image.
+ */
+struct candidate_job {
+    struct bit_matrix* bm;
+    struct finder_pattern_group_list** groups;
+
+    // The result and the match of each candidate
+    int* results;
+    struct qr_code_match_list** matches;
+
+    // One queue and one decoder per worker
+    struct candidate_queue queues[MAX_DECODER_THREADS];
+    struct qr_decoder* decoders[MAX_DECODER_THREADS];
+    unsigned int n_workers;
+
+    // Protects next_worker, the next worker to be
+    // played by a thread that joins the job
+    pthread_mutex_t lock;
+    unsigned int next_worker;
+
+    int log_level;
+};
+
+
+/**
+ * Returns the index of the next candidate for the given worker, taken from
+ * its own queue or stolen from another one, or -1 if there is nothing left.
+ */
+static int take_candidate(struct candidate_job* job, unsigned int id) {
+    for (unsigned int k = 0 ; k < job->n_workers ; k++) {
+        struct candidate_queue* queue = &(job->queues[(id + k) % job->n_workers]);
+        int index = -1;
+        pthread_mutex_lock(&(queue->lock));
+        if (queue->start < queue->end) {
+            index = (k == 0) ? (int)(queue->start++) : (int)(--(queue->end));
+        }
+        pthread_mutex_unlock(&(queue->lock));
+        if (index >= 0) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * Becomes the next worker of the given job, if any is left,
+ * and decodes candidates until there are no more.
+ */
+static void* decode_candidates(void* data) {
+    struct candidate_job* job = (struct candidate_job*)data;
+    pthread_mutex_lock(&(job->lock));
+    unsigned int id = job->next_worker;
+    if (id < job->n_workers) {
+        job->next_worker++;
+    }
+    pthread_mutex_unlock(&(job->lock));
+    if (id == job->n_workers) {
+        return NULL;
+    }
+
+    struct qr_decoder* decoder = job->decoders[id];
+    int previous_log_level = set_thread_log_level(job->log_level);
+    int i;
+    while ((i = take_candidate(job, id)) >= 0) {
+        job->results[i] = decode_candidate(decoder, job->bm, job->groups[i], decoder->arena, &(job->matches[i]));
+    }
+    set_thread_log_level(previous_log_level);
+    return NULL;
+}
+
+
+/**
+ * Decodes the given candidates on the threads of the candidate pool of the
+ * given decoder and on the current thread. The given decoder and its helper
+ * decoders are shared between the threads, so that each one has its own
+ * buffers. The results are merged in the same order as if the candidates
+ * were decoded one by one.
+ */
+static int decode_candidates_in_parallel(struct qr_decoder* decoder, struct bit_matrix* bm,
+                                        struct finder_pattern_group_list* groups, unsigned int n_groups,
+                                        struct qr_code_match_list* *match_list) {
+    struct candidate_job job;
+    job.bm = bm;
+    job.log_level = decoder->log_level;
+    job.groups = (struct finder_pattern_group_list**)arena_alloc(decoder->arena,
+                                                    n_groups * sizeof(struct finder_pattern_group_list*));
+    job.results = (int*)arena_alloc(decoder->arena, n_groups * sizeof(int));
+    job.matches = (struct qr_code_match_list**)arena_alloc(decoder->arena,
+                                                    n_groups * sizeof(struct qr_code_match_list*));
+    if (job.groups == NULL || job.results == NULL || job.matches == NULL) {
+        return MEMORY_ERROR;
+    }
+    unsigned int i = 0;
+    for (struct finder_pattern_group_list* tmp = groups ; tmp != NULL ; tmp = tmp->next, i++) {
+        job.groups[i] = tmp;
+        job.results[i] = DECODING_ERROR;
+    }
+
+    // Let's create the helper decoders we don't have yet. If we cannot,
+    // we will just use fewer threads
+    unsigned int n_workers = decoder->n_threads < n_groups ? decoder->n_threads : n_groups;
+    job.decoders[0] = decoder;
+    job.n_workers = 1;
+    while (job.n_workers < n_workers) {
+        struct qr_decoder* *helper = &(decoder->helpers[job.n_workers - 1]);
+        if ((*helper) == NULL && NULL == ((*helper) = new_qr_decoder())) {
+            break;
+        }
+        (*helper)->result_cache = decoder->result_cache;
+        job.decoders[job.n_workers++] = (*helper);
+    }
+
+    // The candidates are spread evenly over the workers to begin with
+    if (0 != pthread_mutex_init(&(job.lock), NULL)) {
+        return MEMORY_ERROR;
+    }
+    job.next_worker = 0;
+    unsigned int n_initialized = 0;
+    for (unsigned int w = 0 ; w < job.n_workers ; w++) {
+        job.queues[w].start = (w * n_groups) / job.n_workers;
+        job.queues[w].end = ((w + 1) * n_groups) / job.n_workers;
+        if (0 != pthread_mutex_init(&(job.queues[w].lock), NULL)) {
+            break;
+        }
+        n_initialized++;
+    }
+    if (n_initialized < job.n_workers) {
+        for (unsigned int w = 0 ; w < n_initialized ; w++) {
+            pthread_mutex_destroy(&(job.queues[w].lock));
+        }
+        pthread_mutex_destroy(&(job.lock));
+        return MEMORY_ERROR;
+    }
+
+    // The threads are started the first time they are needed and kept
+    // for the next images. If there are fewer threads than workers, because
+    // some could not be started, the workers that run will steal the
+    // candidates of the others
+    if (decoder->candidate_pool == NULL) {
+        decoder->candidate_pool = new_thread_pool(decoder->n_threads - 1);
+    }
+    if (decoder->candidate_pool != NULL) {
+        run_in_thread_pool(decoder->candidate_pool, decode_candidates, &job);
+    } else {
+        decode_candidates(&job);
+    }
+    for (unsigned int w = 0 ; w < job.n_workers ; w++) {
+        pthread_mutex_destroy(&(job.queues[w].lock));
+    }
+    pthread_mutex_destroy(&(job.lock));
+    for (unsigned int w = 1 ; w < job.n_workers ; w++) {
+        reset_arena(job.decoders[w]->arena);
+    }
+
+    // Now let's build the result list in the same order as the serial loop
+    int memory_error = 0;
+    for (i = 0 ; i < n_groups ; i++) {
+        if (job.results[i] == MEMORY_ERROR) {
+            memory_error = 1;
+        } else if (job.results[i] == SUCCESS) {
+            job.matches[i]->next = (*match_list);
+            (*match_list) = job.matches[i];
+        }
+    }
+    if (memory_error) {
+        free_qr_code_match_list(*match_list);
+        (*match_list) = NULL;
         return MEMORY_ERROR;
     }
 
+    return (*match_list) != NULL ? SUCCESS : DECODING_ERROR;
+}
+
+
+/**
+ * Looks for QR codes in the given black and white image.
+ */
+static int find_qr_codes_in_bit_matrix(struct qr_decoder* decoder, struct bit_matrix* bm,
+                                    struct qr_code_match_list* *match_list,
+                                    struct finder_pattern_list* *potential_finder_patterns) {
     // 3 of the corners of a QR code have the same regular shape. They
     // are called finder patterns and they are meant to be used by
     // decoders to understand that there is a QR code to decoded
@@ -52,14 +559,15 @@ int find_qr_codes(const char* png, struct qr_code_match_list* *match_list,
     // you would look for rotations and deformations. This implementation
     // does not try to do anything fancy and only looks for the finder
     // patterns with the assumption that they are kind of parallel to
-    // the sides of the image
+    // the sides of the image. If the caller wants the finder patterns,
+    // they cannot be allocated in the arena
     struct finder_pattern_list* list;
-    res = find_potential_centers(bm, 1, &list);
+    struct arena* list_arena = (potential_finder_patterns != NULL) ? NULL : decoder->arena;
+    int res = find_potential_centers(bm, 1, list_arena, &list);
     if (res != SUCCESS) {
         if (res == DECODING_ERROR) {
             info("Could not find any finder pattern center\n");
         }
-        free_bit_matrix(bm);
         return res;
     }
 
@@ -80,73 +588,40 @@ int find_qr_codes(const char* png, struct qr_code_match_list* *match_list,
     //
     // this means figuring which finder pattern is A, B and C.
     struct finder_pattern_group_list* groups;
-    res = find_groups(list, &groups);
+    res = find_groups(list, decoder->arena, &groups);
     if (potential_finder_patterns != NULL) {
         (*potential_finder_patterns) = list;
-    } else {
-        free_finder_pattern_list(list);
     }
     if (res != SUCCESS) {
         info("Could not find any center group\n");
-        free_bit_matrix(bm);
         return res;
     }
 
     // For each triplet of finder patterns, let's try to find a QR code and to analyze it
+    unsigned int n_groups = 0;
+    for (struct finder_pattern_group_list* tmp = groups ; tmp != NULL ; tmp = tmp->next) {
+        n_groups++;
+    }
+    if (decoder->n_threads > 1 && n_groups > 1) {
+        return decode_candidates_in_parallel(decoder, bm, groups, n_groups, match_list);
+    }
+
     struct finder_pattern_group_list* tmp = groups;
     int memory_error = 0;
     while (tmp != NULL && !memory_error) {
-        struct qr_code* code;
-        switch(get_qr_code(tmp->bottom_left, tmp->top_left, tmp->top_right, bm, &code)) {
-            case MEMORY_ERROR: {
-                memory_error = 1;
-                break;
-            }
-            case DECODING_ERROR: {
-                // Cannot decode the QR code ? Nothing to do
-                break;
-            }
-            case SUCCESS: {
-                // We have a QR code matrix, let's try to decode it
-                info("Found a potential code ");
-                print_matrix(INFO, code->modules);
-
-                struct bytebuffer* message;
-                res = find_qr_code(code->modules, &message);
-                free_qr_code(code);
-
-                if (res == MEMORY_ERROR) {
-                    memory_error = 1;
-                }
-                else if (res == SUCCESS) {
-                    // We have a match, let's add it to the result list
-                    struct qr_code_match_list* match = (struct qr_code_match_list*)malloc(sizeof(struct qr_code_match_list));
-                    if (match == NULL) {
-                        memory_error = 1;
-                        free_bytebuffer(message);
-                    } else {
-                        match->message = message;
-                        match->bottom_left_x = code->bottom_left_x;
-                        match->bottom_left_y = code->bottom_left_y;
-                        match->top_left_x = code->top_left_x;
-                        match->top_left_y = code->top_left_y;
-                        match->top_right_x = code->top_right_x;
-                        match->top_right_y = code->top_right_y;
-                        match->bottom_right_x = code->bottom_right_x;
-                        match->bottom_right_y = code->bottom_right_y;
-                        match->next = (*match_list);
-                        (*match_list) = match;
-                    }
-                }
-                break;
-            }
+        struct qr_code_match_list* match;
+        res = decode_candidate(decoder, bm, tmp, decoder->arena, &match);
+        if (res == MEMORY_ERROR) {
+            memory_error = 1;
+        } else if (res == SUCCESS) {
+            // We have a match, let's add it to the result list
+            match->next = (*match_list);
+            (*match_list) = match;
         }
 
         tmp = tmp->next;
     }
 
-    free_bit_matrix(bm);
-    free_finder_pattern_group_list(groups);
     if (memory_error) {
         free_qr_code_match_list(*match_list);
         (*match_list) = NULL;
@@ -157,9 +632,11 @@ int find_qr_codes(const char* png, struct qr_code_match_list* *match_list,
 }
 
 
-int find_qr_code(struct bit_matrix* matrix, struct bytebuffer* *code) {
-    ErrorCorrectionLevel ec;
-    uint8_t mask_pattern;
+/**
+ * Reads the format and version information of the given QR code matrix.
+ */
+static int get_format_and_version(struct bit_matrix* matrix, ErrorCorrectionLevel* ec,
+                                    uint8_t* mask_pattern, uint8_t* version) {
     int res;
 
     // First, let's get the format information which consists of the
@@ -167,36 +644,107 @@ int find_qr_code(struct bit_matrix* matrix, struct bytebuffer* *code) {
     // the XOR masking pattern that was used when encoding the data to make sure
     // that the data modules looked random enough not to confuse QR code decoders
     // (like for instance all the data modules being of the same color)
-    if (SUCCESS != (res = get_format_information(matrix, &ec, &mask_pattern))) {
+    if (SUCCESS != (res = get_format_information(matrix, ec, mask_pattern))) {
         info("Cannot find format information\n");
         return res;
     }
 
-    switch (ec) {
+    switch (*ec) {
         case LOW: info("Error correction level = LOW\n"); break;
         case MEDIUM: info("Error correction level = MEDIUM\n"); break;
         case QUARTILE: info("Error correction level = QUARTILE\n"); break;
         case HIGH: info("Error correction level = HIGH\n"); break;
     }
 
-    info("XOR mask pattern number = %d\n", mask_pattern);
+    info("XOR mask pattern number = %d\n", *mask_pattern);
 
     // Then let's get the version information N which indicates that the QR code
     // is a N x N module matrix
-    uint8_t version;
-    res = get_version_information(matrix, &version);
+    res = get_version_information(matrix, version);
     if (res != SUCCESS) {
         info("Cannot find QR version\n");
         return res;
     }
 
-    info("QR version = %d\n", version);
+    info("QR version = %d\n", *version);
+    return SUCCESS;
+}
+
+
+/**
+ * Returns the codeword mask for QR codes of the given size. If there is
+ * a decoder, the mask is kept in it for the next QR codes of the same size.
+ */
+static int get_decoder_codeword_mask(struct qr_decoder* decoder, unsigned int size, struct bit_matrix* *mask) {
+    if (decoder == NULL) {
+        return get_codeword_mask(size, mask);
+    }
+    // The size has already been checked when reading the version
+    struct bit_matrix* *cached = &(decoder->codeword_masks[(size - 17) / 4 - 1]);
+    if ((*cached) == NULL) {
+        int res = get_codeword_mask(size, cached);
+        if (res != SUCCESS) {
+            (*cached) = NULL;
+            return res;
+        }
+    }
+    (*mask) = (*cached);
+    return SUCCESS;
+}
+
+
+/**
+ * Frees the given codeword mask unless it belongs to the given decoder.
+ */
+static void release_codeword_mask(struct qr_decoder* decoder, struct bit_matrix* mask) {
+    if (decoder == NULL) {
+        free_bit_matrix(mask);
+    }
+}
+
+
+/**
+ * Returns the bitstream buffers of the given decoder, or new ones
+ * if there is no decoder, or NULL in case of memory allocation error.
+ */
+static struct bitstream_buffers* get_bitstream_buffers(struct qr_decoder* decoder) {
+    if (decoder != NULL) {
+        return &(decoder->bitstream_buffers);
+    }
+    return (struct bitstream_buffers*)qr_malloc(sizeof(struct bitstream_buffers));
+}
+
+
+/**
+ * Frees the given bitstream buffers unless they belong to the given decoder.
+ */
+static void release_bitstream_buffers(struct qr_decoder* decoder, struct bitstream_buffers* buffers) {
+    if (decoder == NULL) {
+        qr_free(buffers);
+    }
+}
+
+
+/**
+ * Does all the work needed to get the error-free data codewords
+ * of the given QR code matrix. On success, buffers->bitstream
+ * reads them from the given buffers.
+ */
+static int get_qr_code_bitstream(struct qr_decoder* decoder, struct bitstream_buffers* buffers,
+                                struct bit_matrix* matrix, struct bit_matrix* uncertain_modules,
+                                uint8_t* version) {
+    ErrorCorrectionLevel ec;
+    uint8_t mask_pattern;
+    int res = get_format_and_version(matrix, &ec, &mask_pattern, version);
+    if (res != SUCCESS) {
+        return res;
+    }
 
     // Let's create the mask that will indicate which modules
     // are data modules (as opposed to non-data modules like
     // the ones used to encode format and version for instance)
     struct bit_matrix* codeword_mask;
-    res = get_codeword_mask(matrix->width, &codeword_mask);
+    res = get_decoder_codeword_mask(decoder, matrix->width, &codeword_mask);
     if (res != SUCCESS) {
         return res;
     }
@@ -206,16 +754,23 @@ int find_qr_code(struct bit_matrix* matrix, struct bytebuffer* *code) {
     // these data modules in the snake-fashion used by QR codes
     // and XOR them with the masking pattern to get the bitstream
     // representing the data to be decoded
-    u_int8_t* codewords;
-    int n_codewords = get_codewords(matrix, codeword_mask, mask_pattern, &codewords);
-    free_bit_matrix(codeword_mask);
+    int n_codewords = get_codewords_in_buffer(matrix, codeword_mask, mask_pattern, buffers->codewords);
     if (n_codewords < 0) {
-        if (n_codewords == DECODING_ERROR) {
-            fprintf(stderr, "Illegal arguments passed to get_codewords()\n");
-            exit(1);
+        fprintf(stderr, "Illegal arguments passed to get_codewords_in_buffer()\n");
+        exit(1);
+    }
+
+    // If we know which modules were not sampled reliably, the codewords that
+    // contain them can be treated as erasures, which makes error correction
+    // able to fix more codewords
+    if (uncertain_modules != NULL) {
+        res = get_uncertain_codewords_in_buffer(uncertain_modules, codeword_mask, buffers->uncertain_codewords);
+        if (res < 0) {
+            release_codeword_mask(decoder, codeword_mask);
+            return res;
         }
-        return n_codewords;
     }
+    release_codeword_mask(decoder, codeword_mask);
 
     // For error correction purposes, the original data is split
     // in blocks and for each block some error correction bytes
@@ -227,15 +782,19 @@ int find_qr_code(struct bit_matrix* matrix, struct bytebuffer* *code) {
     // purposes and relying on the error correction to make it decodable
     // anyway. So the next step is to de-interleave the bytes into
     // proper data+error correction blocks
-    struct blocks* blocks;
-    res = get_blocks(codewords, version, ec, &blocks);
-    free(codewords);
+    res = get_blocks_in_buffers(buffers->codewords, *version, ec,
+                                buffers->block, buffers->block_codewords, &(buffers->blocks));
     if (res != SUCCESS) {
-        if (res == DECODING_ERROR) {
-            fprintf(stderr, "Illegal arguments passed to get_blocks()\n");
-            exit(1);
-        }
-        return res;
+        fprintf(stderr, "Illegal arguments passed to get_blocks_in_buffers()\n");
+        exit(1);
+    }
+
+    // The uncertain codeword flags are de-interleaved the same way
+    struct blocks* uncertain_blocks = NULL;
+    if (uncertain_modules != NULL) {
+        uncertain_blocks = &(buffers->uncertain_blocks);
+        get_blocks_in_buffers(buffers->uncertain_codewords, *version, ec,
+                            buffers->uncertain_block, buffers->uncertain_block_codewords, uncertain_blocks);
     }
 
     // Now comes the error correction math magic. Each
@@ -244,14 +803,77 @@ int find_qr_code(struct bit_matrix* matrix, struct bytebuffer* *code) {
     // fix them. Using this mechanism, we now try to extract
     // the original data that was encoded into each block
     // and re-assemble the bytes that were stored into the QR code
-    struct bitstream* bitstream;
-    res = get_message_bitstream(blocks, &bitstream);
-    int n = blocks->n_blocks;
-    free_blocks(blocks);
+    struct thread_pool* pool = NULL;
+    if (decoder != NULL && decoder->n_block_threads > 1) {
+        if (decoder->block_pool == NULL) {
+            decoder->block_pool = new_thread_pool(decoder->n_block_threads - 1);
+        }
+        // Without a pool, the calling thread does all the work
+        pool = decoder->block_pool;
+    }
+    res = get_message_bitstream_in_place(&(buffers->blocks), uncertain_blocks, pool, &(buffers->bitstream));
     if (res != SUCCESS) {
         if (res == DECODING_ERROR) {
-            info("Failed to decode bistream blocks. The data may be too corrupted.\n", n);
+            info("Failed to decode bistream blocks. The data may be too corrupted.\n");
+        }
+        return res;
+    }
+    return SUCCESS;
+}
+
+
+/**
+ * Logs the given decoded message.
+ */
+static void log_message(struct bytebuffer* message) {
+    if (contains_text_data(message)) {
+        info("Decoded text message:\n%s\n", message->bytes);
+    } else {
+        info("Decoded binary message:\n");
+        print_bytes(INFO, message->bytes, message->n_bytes);
+    }
+    info("\n");
+}
+
+
+int find_qr_code(struct bit_matrix* matrix, struct bytebuffer* *code) {
+    return decode_qr_code(NULL, matrix, NULL, code);
+}
+
+
+int find_qr_code_with_uncertain_modules(struct bit_matrix* matrix, struct bit_matrix* uncertain_modules,
+                                        struct bytebuffer* *code) {
+    return decode_qr_code(NULL, matrix, uncertain_modules, code);
+}
+
+
+/**
+ * Same as find_qr_code_with_uncertain_modules(), using the buffers of the given decoder if not NULL.
+ */
+static int decode_qr_code(struct qr_decoder* decoder, struct bit_matrix* matrix,
+                        struct bit_matrix* uncertain_modules, struct bytebuffer* *code) {
+    // The same modules always give the same message, whatever the
+    // uncertain modules, since these only help the error correction
+    struct qr_result_cache* cache = (decoder != NULL) ? decoder->result_cache : NULL;
+    if (cache != NULL) {
+        int res = get_cached_message(cache, matrix, code);
+        if (res != DECODING_ERROR) {
+            if (res == SUCCESS) {
+                info("Found the message in the result cache\n");
+                log_message(*code);
+            }
+            return res;
         }
+    }
+
+    struct bitstream_buffers* buffers = get_bitstream_buffers(decoder);
+    if (buffers == NULL) {
+        return MEMORY_ERROR;
+    }
+    uint8_t version;
+    int res = get_qr_code_bitstream(decoder, buffers, matrix, uncertain_modules, &version);
+    if (res != SUCCESS) {
+        release_bitstream_buffers(decoder, buffers);
         return res;
     }
 
@@ -271,32 +893,96 @@ int find_qr_code(struct bit_matrix* matrix, struct bytebuffer* *code) {
     // step is to take the error-free bytes and to extract from them
     // the original data
     u_int8_t* message;
-    res = decode_bitstream(bitstream, version, &message);
-    free_bitstream(bitstream);
+    res = decode_bitstream(&(buffers->bitstream), version, &message);
+    release_bitstream_buffers(decoder, buffers);
     if (res < 0) {
         if (res == DECODING_ERROR) {
-            info("Failed to decode message\n", n);
+            info("Failed to decode message\n");
         }
         return res;
     }
 
-    (*code) = (struct bytebuffer*)malloc(sizeof(struct bytebuffer));
+    (*code) = (struct bytebuffer*)qr_malloc(sizeof(struct bytebuffer));
     if ((*code) == NULL) {
+        qr_free(message);
         return MEMORY_ERROR;
     }
     (*code)->bytes = message;
     (*code)->n_bytes = res;
+    (*code)->capacity = res + 1;
+    (*code)->fixed_capacity = 0;
 
+    // Failing to cache the message does not prevent
+    // from returning it
+    if (cache != NULL) {
+        cache_message(cache, matrix, *code);
+    }
+    log_message(*code);
+    return SUCCESS;
+}
 
-    if (contains_text_data(*code)) {
-        info("Decoded text message:\n%s\n", (*code)->bytes);
-    } else {
-        info("Decoded binary message:\n");
-        print_bytes(INFO, (*code)->bytes, (*code)->n_bytes);
+
+int get_max_message_size(struct bit_matrix* matrix) {
+    ErrorCorrectionLevel ec;
+    uint8_t mask_pattern;
+    uint8_t version;
+    int res = get_format_and_version(matrix, &ec, &mask_pattern, &version);
+    if (res != SUCCESS) {
+        return res;
     }
-    info("\n");
+    int n_data_codewords = get_n_data_codewords(version, ec);
+    if (n_data_codewords < 0) {
+        return n_data_codewords;
+    }
+    return get_max_decoded_size(n_data_codewords);
+}
 
-    return SUCCESS;
+
+int find_qr_code_in_buffer(struct bit_matrix* matrix, struct bit_matrix* uncertain_modules,
+                            u_int8_t* message, unsigned int capacity) {
+    return decode_qr_code_in_buffer(NULL, matrix, uncertain_modules, message, capacity);
+}
+
+
+int find_qr_code_in_buffer_with_decoder(struct qr_decoder* decoder, struct bit_matrix* matrix,
+                                        struct bit_matrix* uncertain_modules,
+                                        u_int8_t* message, unsigned int capacity) {
+    int previous_log_level = set_thread_log_level(decoder->log_level);
+    int res = decode_qr_code_in_buffer(decoder, matrix, uncertain_modules, message, capacity);
+    set_thread_log_level(previous_log_level);
+    return res;
+}
+
+
+/**
+ * Same as find_qr_code_in_buffer(), using the buffers of the given decoder if not NULL.
+ */
+static int decode_qr_code_in_buffer(struct qr_decoder* decoder, struct bit_matrix* matrix,
+                                    struct bit_matrix* uncertain_modules,
+                                    u_int8_t* message, unsigned int capacity) {
+    struct bitstream_buffers* buffers = get_bitstream_buffers(decoder);
+    if (buffers == NULL) {
+        return MEMORY_ERROR;
+    }
+    uint8_t version;
+    int res = get_qr_code_bitstream(decoder, buffers, matrix, uncertain_modules, &version);
+    if (res != SUCCESS) {
+        release_bitstream_buffers(decoder, buffers);
+        return res;
+    }
+
+    res = decode_bitstream_in_buffer(&(buffers->bitstream), version, message, capacity);
+    release_bitstream_buffers(decoder, buffers);
+    if (res < 0) {
+        if (res == DECODING_ERROR) {
+            info("Failed to decode message\n");
+        }
+        return res;
+    }
+
+    struct bytebuffer decoded = { message, capacity, res, 1 };
+    log_message(&decoded);
+    return res;
 }
 
 
@@ -304,7 +990,7 @@ void free_qr_code_match_list(struct qr_code_match_list* list) {
     while (list != NULL) {
         struct qr_code_match_list* next = list->next;
         free_bytebuffer(list->message);
-        free(list);
+        qr_free(list);
         list = next;
     }
 }
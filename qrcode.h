@@ -5,6 +5,8 @@
 #include "bytebuffer.h"
 #include "finderpattern.h"
 #include "logs.h"
+#include "resultcache.h"
+#include "rgbimage.h"
 
 
 /**
@@ -51,6 +53,116 @@ int find_qr_codes(const char* png, struct qr_code_match_list* *list,
                 struct finder_pattern_list* *potential_finder_patterns);
 
 
+/**
+ * A decoder keeps the intermediate buffers needed to analyze an image
+ * from one image to the next, so that decoding a stream of images of the
+ * same size does not spend its time allocating and freeing them.
+ *
+ * Thread safety: the library has no mutable global state except for the
+ * allocator, which is meant to be set once before decoding anything, and
+ * the global log level, which can be changed at any time. Any number of
+ * threads can decode concurrently as long as each of them uses its own
+ * decoder, since a decoder must not be used by several threads at the same
+ * time. Each decoder keeps its own log level. The functions that do not take
+ * a decoder, like find_qr_codes(), can be called from any thread.
+ */
+struct qr_decoder;
+
+
+/**
+ * Creates a new decoder or returns NULL in case of memory allocation error.
+ */
+struct qr_decoder* new_qr_decoder();
+
+
+/**
+ * Frees all the memory associated to the given decoder.
+ */
+void free_qr_decoder(struct qr_decoder* decoder);
+
+
+/**
+ * Sets the log level to use while the given decoder is running, so that
+ * decoders running in different threads can log differently. The level
+ * also applies to the extra threads the decoder uses for the candidates
+ * and the blocks. The default is GLOBAL_LOG_LEVEL, meaning that the level
+ * set with set_log_level() is used.
+ */
+void set_decoder_log_level(struct qr_decoder* decoder, int level);
+
+
+// The maximum number of threads a decoder can use
+#define MAX_DECODER_THREADS 64
+
+
+/**
+ * Sets the number of threads the given decoder uses to decode the QR code
+ * candidates of an image, which is worth it for images that contain many
+ * QR codes. The calling thread is one of them and the default is 1.
+ * Whatever the number of threads, the results are the same and in the
+ * same order. The extra threads are started the first time they are
+ * needed and kept until the number of threads changes or the decoder
+ * is freed.
+ */
+void set_decoder_n_threads(struct qr_decoder* decoder, unsigned int n_threads);
+
+
+/**
+ * Sets the number of threads the given decoder uses to correct the blocks
+ * of each QR code, which is worth it for the large versions that have many
+ * blocks. The calling thread is one of them and the default is 1. The extra
+ * threads are started the first time they are needed and kept until the
+ * number of threads changes or the decoder is freed.
+ */
+void set_decoder_n_block_threads(struct qr_decoder* decoder, unsigned int n_threads);
+
+
+/**
+ * Makes the given decoder look for the messages of the QR codes it samples
+ * in the given cache before decoding them, and remember the new ones there.
+ * This is worth it when the same QR codes are seen in many images. The
+ * cache is not owned by the decoder and can be shared with other decoders.
+ * NULL, the default, means no cache.
+ */
+void set_decoder_result_cache(struct qr_decoder* decoder, struct qr_result_cache* cache);
+
+
+/**
+ * Same as find_qr_codes() but using the buffers of the given decoder.
+ */
+int find_qr_codes_with_decoder(struct qr_decoder* decoder, const char* png,
+                            struct qr_code_match_list* *list,
+                            struct finder_pattern_list* *potential_finder_patterns);
+
+
+/**
+ * Same as find_qr_codes_with_decoder() but for an image that is already
+ * in memory, like a frame coming from a camera.
+ *
+ * @param decoder The decoder to use
+ * @param img The image to analyze. It is not modified
+ * @param list Where to store the results, if any
+ * @param potential_finder_patterns If not NULL, where to store the potential
+ *                                  finder patterns
+ * @return SUCCESS if at least one QR code is found
+ *         DECODING_ERROR if no QR code is found in the image
+ *         MEMORY_ERROR in case of memory allocation error
+ */
+int find_qr_codes_in_rgb_image(struct qr_decoder* decoder, struct rgb_image* img,
+                            struct qr_code_match_list* *list,
+                            struct finder_pattern_list* *potential_finder_patterns);
+
+
+/**
+ * Same as find_qr_codes_in_rgb_image() but for an image that has already
+ * been converted to black and white, for instance with binarize_luminances().
+ * The bit matrix is not modified and does not need to belong to the decoder.
+ */
+int find_qr_codes_in_binarized_image(struct qr_decoder* decoder, struct bit_matrix* bm,
+                            struct qr_code_match_list* *list,
+                            struct finder_pattern_list* *potential_finder_patterns);
+
+
 /**
  * Given a bit matrix that is supposed to represent a QR code (i.e. the
  * matrix is a square one where each cell represents a module), this
@@ -65,6 +177,70 @@ int find_qr_codes(const char* png, struct qr_code_match_list* *list,
 int find_qr_code(struct bit_matrix* matrix, struct bytebuffer* *code);
 
 
+/**
+ * Same as find_qr_code() but some modules are known to have been sampled
+ * without confidence, so that the codewords containing them can be treated
+ * as erasures if the QR code cannot be corrected without them.
+ *
+ * @param matrix The matrix that is supposed to represent the QR code
+ * @param uncertain_modules If not NULL, a matrix of the same size where 1s
+ *                          indicate modules whose color is not reliable
+ * @param code Where to store the result or NULL if the decoding fails
+ * @return SUCCESS on success
+ *         DECODING_ERROR if the matrix does not represent a QR that can be decoded
+ *         MEMORY_ERROR in case of memory allocation error
+ */
+int find_qr_code_with_uncertain_modules(struct bit_matrix* matrix, struct bit_matrix* uncertain_modules,
+                                        struct bytebuffer* *code);
+
+
+/**
+ * Given a bit matrix that is supposed to represent a QR code, this function
+ * reads its version and error correction level in order to tell how large a
+ * buffer must be to be passed to find_qr_code_in_buffer().
+ *
+ * @param matrix The matrix that is supposed to represent the QR code
+ * @return n > 0 the required buffer size on success
+ *         DECODING_ERROR if the version or the error correction level cannot be read
+ */
+int get_max_message_size(struct bit_matrix* matrix);
+
+
+/**
+ * Same as find_qr_code_with_uncertain_modules() but the decoded message
+ * is written in the given buffer as a null-terminated string, so that no
+ * memory is allocated for the result and the same buffer can be reused for
+ * many QR codes. A buffer
+ * of get_max_message_size(matrix) bytes is always large enough for the
+ * given matrix, and a buffer of get_max_message_size() bytes for a version
+ * 40 QR code with low error correction level is large enough for any QR code.
+ *
+ * @param matrix The matrix that is supposed to represent the QR code
+ * @param uncertain_modules If not NULL, the modules to be treated as erasures
+ * @param message Where to write the message
+ * @param capacity The size of the message buffer
+ * @return n >= 0 on success, where n is the number of decoded bytes not counting
+ *           the final 0
+ *         BUFFER_TOO_SMALL if the buffer is smaller than get_max_message_size(matrix)
+ *         DECODING_ERROR if the matrix does not represent a QR that can be decoded
+ *         MEMORY_ERROR in case of memory allocation error
+ */
+int find_qr_code_in_buffer(struct bit_matrix* matrix, struct bit_matrix* uncertain_modules,
+                            u_int8_t* message, unsigned int capacity);
+
+
+/**
+ * Same as find_qr_code_in_buffer() but uses the given decoder's codeword
+ * masks and buffers, so that once a QR code of the same version has been
+ * decoded, decoding does not allocate any memory. The decoder's result
+ * cache is not used, since looking up a message would allocate it.
+ * A decoder must not be used by several threads at the same time.
+ */
+int find_qr_code_in_buffer_with_decoder(struct qr_decoder* decoder, struct bit_matrix* matrix,
+                                        struct bit_matrix* uncertain_modules,
+                                        u_int8_t* message, unsigned int capacity);
+
+
 /**
  * Frees all the memory associated to the given list.
  */
@@ -1,7 +1,9 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "allocator.h"
 #include "qrcodefinder.h"
 
 
@@ -111,6 +113,7 @@ static int find_bottom_right_finder_pattern(struct finder_pattern bottom_left,
                             struct bit_matrix* image,
                             float module_size,
                             int dimension,
+                            struct arena* arena,
                             float *bottom_right_x, float *bottom_right_y) {
 
     *bottom_right_x = bottom_left.x + (top_right.x - top_left.x);
@@ -146,7 +149,7 @@ static int find_bottom_right_finder_pattern(struct finder_pattern bottom_left,
         return MEMORY_ERROR;
     }
     struct finder_pattern_list* candidates;
-    int res = find_potential_centers(search_area, 0, &candidates);
+    int res = find_potential_centers(search_area, 0, arena, &candidates);
     free_bit_matrix(search_area);
     if (res == MEMORY_ERROR) {
         return MEMORY_ERROR;
@@ -158,7 +161,9 @@ static int find_bottom_right_finder_pattern(struct finder_pattern bottom_left,
         // based on the top left one and on the pattern we just found
         *bottom_right_x = top_left.x + (alignment_x - top_left.x) / ratio;
         *bottom_right_y = top_left.y + (alignment_y - top_left.y) / ratio;
-        free_finder_pattern_list(candidates);
+        if (arena == NULL) {
+            free_finder_pattern_list(candidates);
+        }
     }
 
     return SUCCESS;
@@ -177,13 +182,35 @@ static void interpolate(float x1, float y1, float x2, float y2, unsigned int dis
 }
 
 
+/**
+ * Returns 1 if the pixels located at a third of a module from the given
+ * module center do not all have the same color as the center; 0 otherwise.
+ */
+static int is_uncertain(struct bit_matrix* image, float m_x, float m_y, float module_size, int black) {
+    float delta = module_size / 3.0f;
+    float offsets[4][2] = { { -delta, 0 }, { delta, 0 }, { 0, -delta }, { 0, delta } };
+    for (unsigned int i = 0 ; i < 4 ; i++) {
+        float x = m_x + offsets[i][0];
+        float y = m_y + offsets[i][1];
+        if (x < 0 || x >= image->width || y < 0 || y >= image->height) {
+            return 1;
+        }
+        if (is_black(image, (int)x, (int)y) != black) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
 /**
  * Given the positions of the 4 finder patterns' centers (3 real ones + virtual bottom right one),
  * the original image and the dimension, this function populate the given QR code structure from
  * the original binary image. If part of the QR code is outside the image, we assume arbitrarily that
- * the missing modules are white.
+ * the missing modules are white and we mark them as uncertain.
  */
 static void populate_qr_code(struct qr_code* code, struct bit_matrix* image, int dimension,
+                            float module_size,
                             struct finder_pattern bottom_left,
                             struct finder_pattern top_left,
                             struct finder_pattern top_right,
@@ -237,6 +264,9 @@ static void populate_qr_code(struct qr_code* code, struct bit_matrix* image, int
 
             int black = outside ? 0 : is_black(image, (int)m_x, (int)m_y);
             set_color(code->modules, black ? BLACK : WHITE, x + 3, y + 3);
+            if (outside || is_uncertain(image, m_x, m_y, module_size, black)) {
+                set_color(code->uncertain_modules, BLACK, x + 3, y + 3);
+            }
 
             // If M is on a corner, let's update the QR code bounds
             if (y == -3) {
@@ -262,40 +292,91 @@ static void populate_qr_code(struct qr_code* code, struct bit_matrix* image, int
 
 
 
+/**
+ * Locates the QR code defined by the given finder patterns and returns
+ * its dimension, its module size and the position of its virtual bottom
+ * right finder pattern.
+ */
+static int locate_qr_code(struct finder_pattern bottom_left,
+                        struct finder_pattern top_left,
+                        struct finder_pattern top_right,
+                        struct bit_matrix* image,
+                        struct arena* arena,
+                        int *dimension, float *module_size,
+                        float *bottom_right_x, float *bottom_right_y) {
+    *module_size = (bottom_left.module_size + top_left.module_size + top_right.module_size) / 3.0f;
+    *dimension = get_dimension(bottom_left, top_left, top_right, *module_size);
+    if (DECODING_ERROR == *dimension || *dimension > MAX_QR_CODE_DIMENSION) {
+        return DECODING_ERROR;
+    }
+
+    return find_bottom_right_finder_pattern(bottom_left, top_left, top_right, image, *module_size, *dimension,
+                                            arena, bottom_right_x, bottom_right_y);
+}
+
+
 int get_qr_code(struct finder_pattern bottom_left,
                             struct finder_pattern top_left,
                             struct finder_pattern top_right,
                             struct bit_matrix* image,
                             struct qr_code* *qr_code) {
-    float module_size = (bottom_left.module_size + top_left.module_size + top_right.module_size) / 3.0f;
-    int dimension = get_dimension(bottom_left, top_left, top_right, module_size);
-    if (DECODING_ERROR == dimension) {
-        return DECODING_ERROR;
-    }
-
+    int dimension;
+    float module_size;
     float x, y;
-    int res;
-    if (SUCCESS != (res = find_bottom_right_finder_pattern(bottom_left, top_left, top_right, image, module_size, dimension, &x, &y))) {
+    int res = locate_qr_code(bottom_left, top_left, top_right, image, NULL, &dimension, &module_size, &x, &y);
+    if (res != SUCCESS) {
         return res;
     }
 
-    struct qr_code* code = (struct qr_code*)malloc(sizeof(struct qr_code));
+    struct qr_code* code = (struct qr_code*)qr_malloc(sizeof(struct qr_code));
     if (code == NULL) {
         return MEMORY_ERROR;
     }
     code->modules = create_bit_matrix(dimension, dimension);
     if (code->modules == NULL) {
-        free(code);
+        qr_free(code);
+        return MEMORY_ERROR;
+    }
+    code->uncertain_modules = create_bit_matrix(dimension, dimension);
+    if (code->uncertain_modules == NULL) {
+        free_bit_matrix(code->modules);
+        qr_free(code);
         return MEMORY_ERROR;
     }
 
-    populate_qr_code(code, image, dimension, bottom_left, top_left, top_right, x, y);
+    populate_qr_code(code, image, dimension, module_size, bottom_left, top_left, top_right, x, y);
     *qr_code = code;
     return SUCCESS;
 }
 
 
+int get_qr_code_in_buffers(struct finder_pattern bottom_left,
+                            struct finder_pattern top_left,
+                            struct finder_pattern top_right,
+                            struct bit_matrix* image,
+                            struct arena* arena,
+                            struct qr_code* code) {
+    int dimension;
+    float module_size;
+    float x, y;
+    int res = locate_qr_code(bottom_left, top_left, top_right, image, arena, &dimension, &module_size, &x, &y);
+    if (res != SUCCESS) {
+        return res;
+    }
+
+    unsigned int n_bytes = ((dimension * dimension) / 8) + ((dimension * dimension) % 8 != 0);
+    code->modules->width = code->modules->height = dimension;
+    code->uncertain_modules->width = code->uncertain_modules->height = dimension;
+    memset(code->modules->matrix, 0, n_bytes);
+    memset(code->uncertain_modules->matrix, 0, n_bytes);
+
+    populate_qr_code(code, image, dimension, module_size, bottom_left, top_left, top_right, x, y);
+    return SUCCESS;
+}
+
+
 void free_qr_code(struct qr_code* code) {
     free_bit_matrix(code->modules);
-    free(code);
+    free_bit_matrix(code->uncertain_modules);
+    qr_free(code);
 }
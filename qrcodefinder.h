@@ -6,6 +6,9 @@
 #include "errors.h"
 #include "finderpattern.h"
 
+// The dimension of a version 40 QR code, the largest one
+#define MAX_QR_CODE_DIMENSION 177
+
 
 /**
  * This structure represents a QR code identified in an image.
@@ -14,6 +17,13 @@ struct qr_code {
     // A binary matrix where each cell represents one QR code module
     struct bit_matrix* modules;
 
+    // A matrix of the same size where 1s indicate modules whose color
+    // is uncertain, because they were outside of the image or because
+    // the pixels around the module center do not all have the same
+    // color. Codewords that contain such modules can be treated as
+    // erasures during error correction
+    struct bit_matrix* uncertain_modules;
+
     // The coordinates of the QR code corners in the original image
     int bottom_left_x, bottom_left_y;
     int top_left_x, top_left_y;
@@ -36,6 +46,26 @@ int get_qr_code(struct finder_pattern bottom_left,
                             struct qr_code* *qr_code);
 
 
+/**
+ * Same as get_qr_code() but populates an existing structure, so that the
+ * same module matrices can be reused for many QR codes. Both matrices must
+ * have been created with MAX_QR_CODE_DIMENSION x MAX_QR_CODE_DIMENSION
+ * dimensions. On success, their dimensions are updated to the ones of
+ * the QR code that was found. If not NULL, the given arena is used
+ * for the temporary objects needed to look for the alignment pattern.
+ *
+ * @return SUCCESS on success
+ *         DECODING_ERROR if the finder patterns do not define a QR code
+ *         MEMORY_ERROR in case of memory allocation error
+ */
+int get_qr_code_in_buffers(struct finder_pattern bottom_left,
+                            struct finder_pattern top_left,
+                            struct finder_pattern top_right,
+                            struct bit_matrix* image,
+                            struct arena* arena,
+                            struct qr_code* code);
+
+
 /**
  * Frees all the memory associated to the given code.
  */
@@ -1,18 +1,255 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+// The SIMD kernels are compiled with target attributes whatever the compiler
+// flags, and they are only used if the processor supports them
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_SYNDROMES
+#include <immintrin.h>
+#endif
 #include "galoisfield.h"
 #include "logs.h"
 #include "polynomial.h"
 #include "reedsolomon.h"
 
 
+#ifdef SIMD_SYNDROMES
+
+// For each element y of the field, the products of y with all the possible
+// values of the low and high nibbles of a byte. They are built once, the first
+// time a SIMD kernel is used
+static u_int8_t nibble_tables[256][2][16];
+static pthread_once_t nibble_tables_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Multiplying a byte by a constant y in the Galois field is a linear
+ * operation, so that y.abcdefgh = y.abcd0000 + y.0000efgh. This function
+ * fills the tables giving the products of each y with all the possible values
+ * of the low and high nibbles of a byte. Since each table fits in a 16 byte
+ * register, the PSHUFB instruction can then be used as 16 parallel table
+ * lookups to multiply 16 bytes by y at once.
+ */
+static void build_nibble_tables() {
+    for (unsigned int y = 0 ; y < 256 ; y++) {
+        u_int8_t products[8];
+        products[0] = y;
+        for (unsigned int i = 1 ; i < 8 ; i++) {
+            // Multiplying by X is a left shift followed by a reduction
+            // by the prime polynomial X^8 + X^4 + X^3 + X^2 + 1
+            u_int8_t p = products[i - 1];
+            products[i] = (p << 1) ^ ((p & 0x80) ? 0x1D : 0);
+        }
+        for (unsigned int v = 0 ; v < 16 ; v++) {
+            u_int8_t l = 0;
+            u_int8_t h = 0;
+            for (unsigned int bit = 0 ; bit < 4 ; bit++) {
+                if (v & (1 << bit)) {
+                    l ^= products[bit];
+                    h ^= products[bit + 4];
+                }
+            }
+            nibble_tables[y][0][v] = l;
+            nibble_tables[y][1][v] = h;
+        }
+    }
+}
+
+
+__attribute__((target("ssse3")))
+static void get_nibble_tables(u_int8_t y, __m128i* low, __m128i* high) {
+    *low = _mm_loadu_si128((__m128i*)nibble_tables[y][0]);
+    *high = _mm_loadu_si128((__m128i*)nibble_tables[y][1]);
+}
+
+
+/**
+ * Multiplies the 16 bytes of v by the constant described by the given nibble tables.
+ */
+__attribute__((target("ssse3")))
+static __m128i gf_multiply_vector(__m128i v, __m128i low, __m128i high) {
+    __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i l = _mm_shuffle_epi8(low, _mm_and_si128(v, mask));
+    __m128i h = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(v, 4), mask));
+    return _mm_xor_si128(l, h);
+}
+
+
+/**
+ * Given 16 lanes where lane l has the exponent 15 - l, returns
+ * sum over lane l of x^(15-l) . acc[l], x_powers being x, x^2, x^4 and x^8.
+ * Folding lanes l and l + 8 gives x^8.acc[l] + acc[l + 8] with the
+ * exponent 7 - l, and so on.
+ */
+__attribute__((target("ssse3")))
+static u_int8_t fold_lanes(__m128i acc, u_int8_t* x_powers) {
+    __m128i low, high;
+    for (int i = 3 ; i >= 0 ; i--) {
+        get_nibble_tables(x_powers[i], &low, &high);
+        __m128i upper = gf_multiply_vector(acc, low, high);
+        switch (i) {
+            case 3: acc = _mm_srli_si128(acc, 8); break;
+            case 2: acc = _mm_srli_si128(acc, 4); break;
+            case 1: acc = _mm_srli_si128(acc, 2); break;
+            default: acc = _mm_srli_si128(acc, 1); break;
+        }
+        acc = _mm_xor_si128(acc, upper);
+    }
+    return (u_int8_t)_mm_cvtsi128_si32(acc);
+}
+
+
+/**
+ * Evaluates the given message at x with 16 bytes at a time. If we split the message
+ * w_0 ... w_(n-1) into chunks of 16 codewords (after padding the beginning with zeroes
+ * so that n is a multiple of 16), we have:
+ *
+ * R(x) = sum over lane l of x^(15-l) . sum over chunk q of w_(16q+l) . (x^16)^(Q-1-q)
+ *
+ * The inner sums are calculated for all the lanes in parallel with Horner's method
+ * using the same multiplier x^16 for all lanes, then the lanes are folded.
+ */
+__attribute__((target("ssse3")))
+static u_int8_t evaluate_ssse3(u_int8_t* codewords, unsigned int n, u_int8_t x) {
+    u_int8_t x_powers[5];
+    x_powers[0] = x;
+    for (unsigned int i = 1 ; i < 5 ; i++) {
+        x_powers[i] = gf_multiply(x_powers[i - 1], x_powers[i - 1]);
+    }
+
+    __m128i low, high;
+    get_nibble_tables(x_powers[4], &low, &high);
+
+    // The first chunk is padded with zeroes at the beginning
+    unsigned int padding = (16 - n % 16) % 16;
+    u_int8_t first[16] = { 0 };
+    memcpy(first + padding, codewords, 16 - padding);
+    __m128i acc = _mm_loadu_si128((__m128i*)first);
+    for (unsigned int pos = 16 - padding ; pos < n ; pos += 16) {
+        acc = gf_multiply_vector(acc, low, high);
+        acc = _mm_xor_si128(acc, _mm_loadu_si128((__m128i*)(codewords + pos)));
+    }
+    return fold_lanes(acc, x_powers);
+}
+
+
+/**
+ * Same as evaluate_ssse3() with 32 bytes at a time. VPSHUFB shuffles each
+ * 128-bit half separately, so the nibble tables are duplicated in both halves.
+ * Lanes 0 to 15 have the exponents 31 to 16 and lanes 16 to 31 the exponents
+ * 15 to 0, so multiplying the first half by x^16 and adding the second half
+ * gives 16 lanes that can be folded like in the SSSE3 version.
+ */
+__attribute__((target("avx2")))
+static u_int8_t evaluate_avx2(u_int8_t* codewords, unsigned int n, u_int8_t x) {
+    u_int8_t x_powers[6];
+    x_powers[0] = x;
+    for (unsigned int i = 1 ; i < 6 ; i++) {
+        x_powers[i] = gf_multiply(x_powers[i - 1], x_powers[i - 1]);
+    }
+
+    __m128i low, high;
+    get_nibble_tables(x_powers[5], &low, &high);
+    __m256i low32 = _mm256_broadcastsi128_si256(low);
+    __m256i high32 = _mm256_broadcastsi128_si256(high);
+    __m256i mask = _mm256_set1_epi8(0x0F);
+
+    unsigned int padding = (32 - n % 32) % 32;
+    u_int8_t first[32] = { 0 };
+    memcpy(first + padding, codewords, 32 - padding);
+    __m256i acc = _mm256_loadu_si256((__m256i*)first);
+    for (unsigned int pos = 32 - padding ; pos < n ; pos += 32) {
+        __m256i l = _mm256_shuffle_epi8(low32, _mm256_and_si256(acc, mask));
+        __m256i h = _mm256_shuffle_epi8(high32, _mm256_and_si256(_mm256_srli_epi64(acc, 4), mask));
+        acc = _mm256_xor_si256(_mm256_xor_si256(l, h), _mm256_loadu_si256((__m256i*)(codewords + pos)));
+    }
+
+    get_nibble_tables(x_powers[4], &low, &high);
+    __m128i upper = gf_multiply_vector(_mm256_castsi256_si128(acc), low, high);
+    __m128i folded = _mm_xor_si128(upper, _mm256_extracti128_si256(acc, 1));
+
+    // The folding code is not VEX encoded, so the upper halves of the
+    // registers must be cleared to avoid the AVX to SSE transition penalty
+    _mm256_zeroupper();
+    return fold_lanes(folded, x_powers);
+}
+
+#endif
+
+
+int is_syndrome_kernel_supported(SyndromeKernel kernel) {
+    switch (kernel) {
+        case SYNDROMES_AUTO:
+        case SYNDROMES_SCALAR: return 1;
+#ifdef SIMD_SYNDROMES
+        case SYNDROMES_SSSE3: return __builtin_cpu_supports("ssse3");
+        case SYNDROMES_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+        default: return 0;
+    }
+}
+
+
 unsigned int calculate_syndromes(struct gf_polynomial* message, struct gf_polynomial* syndromes) {
-    unsigned int n = 0;
+    return calculate_syndromes_with_kernel(message, syndromes, SYNDROMES_AUTO);
+}
+
+
+unsigned int calculate_syndromes_with_kernel(struct gf_polynomial* message, struct gf_polynomial* syndromes,
+                                            SyndromeKernel kernel) {
     unsigned int n_syndromes = syndromes->n_coefficients;
+    u_int8_t* codewords = message->coefficients;
+
+    if (kernel == SYNDROMES_AUTO) {
+        // A message too short to fill a register is faster to do without SIMD
+        if (message->n_coefficients >= 32 && is_syndrome_kernel_supported(SYNDROMES_AVX2)) {
+            kernel = SYNDROMES_AVX2;
+        } else if (message->n_coefficients >= 16 && is_syndrome_kernel_supported(SYNDROMES_SSSE3)) {
+            kernel = SYNDROMES_SSSE3;
+        } else {
+            kernel = SYNDROMES_SCALAR;
+        }
+    } else if (!is_syndrome_kernel_supported(kernel) || message->n_coefficients == 0) {
+        kernel = SYNDROMES_SCALAR;
+    }
+
+#ifdef SIMD_SYNDROMES
+    if (kernel == SYNDROMES_SSSE3 || kernel == SYNDROMES_AVX2) {
+        pthread_once(&nibble_tables_once, build_nibble_tables);
+        for (unsigned int i = 0 ; i < n_syndromes ; i++) {
+            syndromes->coefficients[n_syndromes - 1 - i] = (kernel == SYNDROMES_AVX2)
+                ? evaluate_avx2(codewords, message->n_coefficients, gf_power(i))
+                : evaluate_ssse3(codewords, message->n_coefficients, gf_power(i));
+        }
+    } else
+#endif
+    {
+        // All the syndromes are calculated with Horner's method in a single pass
+        // over the codewords, by groups of MAX_ERROR_CORRECTION_CODEWORDS
+        for (unsigned int first = 0 ; first < n_syndromes ; first += MAX_ERROR_CORRECTION_CODEWORDS) {
+            unsigned int n = n_syndromes - first;
+            if (n > MAX_ERROR_CORRECTION_CODEWORDS) {
+                n = MAX_ERROR_CORRECTION_CODEWORDS;
+            }
+            u_int8_t x[MAX_ERROR_CORRECTION_CODEWORDS];
+            u_int8_t values[MAX_ERROR_CORRECTION_CODEWORDS] = { 0 };
+            for (unsigned int i = 0 ; i < n ; i++) {
+                x[i] = gf_power(first + i);
+            }
+            for (unsigned int j = 0 ; j < message->n_coefficients ; j++) {
+                for (unsigned int i = 0 ; i < n ; i++) {
+                    values[i] = gf_add_or_subtract(gf_multiply(values[i], x[i]), codewords[j]);
+                }
+            }
+            for (unsigned int i = 0 ; i < n ; i++) {
+                syndromes->coefficients[n_syndromes - 1 - (first + i)] = values[i];
+            }
+        }
+    }
+
+    unsigned int n = 0;
     for (unsigned int i = 0 ; i < n_syndromes ; i++) {
-        u_int8_t x = gf_power(i);
-        syndromes->coefficients[n_syndromes - 1 - i] = evaluate_polynomial(message, x);
         if (syndromes->coefficients[i]) {
             n++;
         }
@@ -22,196 +259,248 @@ unsigned int calculate_syndromes(struct gf_polynomial* message, struct gf_polyno
 
 
 /**
- * Returns a polynomial with all coefficients to zero or null in case
- * of memory allocation error.
+ * The polynomials manipulated by calculate_sigma_omega() are stored in
+ * MAX_RS_POLYNOMIAL_SIZE arrays indexed by degree, i.e. p[i] is the coefficient
+ * for X^i. Returns the highest i so that p[i] is not 0, or 0 if the polynomial
+ * is reduced to a constant.
  */
-static struct gf_polynomial* zero() {
-    return get_monomial(0, 0);
+static unsigned int degree_of(u_int8_t* p) {
+    unsigned int degree = MAX_RS_POLYNOMIAL_SIZE - 1;
+    while (degree > 0 && p[degree] == 0) {
+        degree--;
+    }
+    return degree;
 }
 
 
 /**
- * Returns a polynomial with equal to the constant term 1 or null in case
- * of memory allocation error.
+ * Adds scale.X^shift.b to a in place.
  */
-static struct gf_polynomial* one() {
-    return get_monomial(0, 1);
+static void add_scaled_shifted(u_int8_t* a, u_int8_t* b, u_int8_t scale, unsigned int shift) {
+    unsigned int degree_b = degree_of(b);
+    for (unsigned int i = 0 ; i <= degree_b && i + shift < MAX_RS_POLYNOMIAL_SIZE ; i++) {
+        a[i + shift] = gf_add_or_subtract(a[i + shift], gf_multiply(b[i], scale));
+    }
 }
 
 
-int calculate_sigma_omega(struct gf_polynomial* syndromes, unsigned int n_error_correction_codewords,
-                            struct gf_polynomial* *sigma, struct gf_polynomial* *omega) {
-
-    struct gf_polynomial* syndromes_copy = new_gf_polynomial(syndromes->n_coefficients, syndromes->coefficients);
-    if (syndromes_copy == NULL) {
-        return MEMORY_ERROR;
-    }
-    struct gf_polynomial* monomial = get_monomial(n_error_correction_codewords, 1);
-    if (monomial == NULL) {
-        free_gf_polynomial(syndromes_copy);
-        return MEMORY_ERROR;
+/**
+ * Stores the given degree-indexed array into the given polynomial, multiplying
+ * all the coefficients by the given scalar.
+ */
+static void export_polynomial(u_int8_t* p, u_int8_t scalar, struct gf_polynomial* dst) {
+    unsigned int degree = degree_of(p);
+    dst->n_coefficients = degree + 1;
+    for (unsigned int i = 0 ; i <= degree ; i++) {
+        dst->coefficients[degree - i] = gf_multiply(p[i], scalar);
     }
-    set_coefficient(monomial, n_error_correction_codewords, 1);
+}
 
-    struct gf_polynomial* rLast;
-    struct gf_polynomial* r;
-    struct gf_polynomial* tLast = zero();
-    if (tLast == NULL) {
-        free_gf_polynomial(syndromes_copy);
-        free_gf_polynomial(monomial);
-        return MEMORY_ERROR;
-    }
-    struct gf_polynomial* t = one();
-    if (t == NULL) {
-        free_gf_polynomial(syndromes_copy);
-        free_gf_polynomial(monomial);
-        free_gf_polynomial(tLast);
-        return MEMORY_ERROR;
+
+int calculate_sigma_omega(struct gf_polynomial* syndromes, unsigned int n_error_correction_codewords,
+                            struct gf_polynomial* sigma, struct gf_polynomial* omega) {
+    if (n_error_correction_codewords > MAX_ERROR_CORRECTION_CODEWORDS
+        || syndromes->n_coefficients > n_error_correction_codewords) {
+        return DECODING_ERROR;
     }
 
-    // Let's make sure that rLast is the one with the highest degree
-    if (get_degree(syndromes_copy) < n_error_correction_codewords) {
-        rLast = monomial;
-        r = syndromes_copy;
-    } else {
-        rLast = syndromes_copy;
-        r = monomial;
+    // The 4 polynomials used by the algorithm. Instead of allocating
+    // new polynomials at each step, we rotate the pointers so that the
+    // arrays holding rLastLast and tLastLast are reused in place to
+    // calculate the new r and t
+    u_int8_t storage[4][MAX_RS_POLYNOMIAL_SIZE];
+    memset(storage, 0, sizeof(storage));
+    u_int8_t* rLast = storage[0];
+    u_int8_t* r = storage[1];
+    u_int8_t* tLast = storage[2];
+    u_int8_t* t = storage[3];
+
+    // rLast = X^n_error_correction_codewords, which always has a higher
+    // degree than the syndromes
+    rLast[n_error_correction_codewords] = 1;
+    for (unsigned int i = 0 ; i < syndromes->n_coefficients ; i++) {
+        r[i] = get_coefficient(syndromes, i);
     }
+    // tLast = 0 and t = 1
+    t[0] = 1;
 
     // Now let's divide rLast by r
-    while (get_degree(r) >= n_error_correction_codewords / 2) {
-        struct gf_polynomial* rLastLast = rLast;
-        struct gf_polynomial* tLastLast = tLast;
+    while (degree_of(r) >= n_error_correction_codewords / 2) {
+        // rLastLast = rLast, rLast = r, and the same for t
+        u_int8_t* rLastLast = rLast;
+        u_int8_t* tLastLast = tLast;
         rLast = r;
         tLast = t;
 
-        if (is_zero_polynomial(rLast)) {
-            free_gf_polynomial(r);
-            free_gf_polynomial(t);
-            free_gf_polynomial(rLast);
-            free_gf_polynomial(tLast);
+        if (degree_of(rLast) == 0 && rLast[0] == 0) {
             return DECODING_ERROR;
         }
 
+        // r starts as rLastLast and will become the remainder of
+        // rLastLast / rLast, while t starts as tLastLast and will
+        // become q.tLast + tLastLast where q is the quotient. Since
+        // q is a sum of monomials, we can add each monomial's contribution
+        // to t as soon as we find it
         r = rLastLast;
-        struct gf_polynomial* q = zero();
-        if (q == NULL) {
-            free_gf_polynomial(r);
-            free_gf_polynomial(t);
-            free_gf_polynomial(rLast);
-            free_gf_polynomial(tLast);
-            return MEMORY_ERROR;
-        }
-
-        u_int8_t denominator_leading_term = get_coefficient(rLast, get_degree(rLast));
-        u_int8_t dlt_inverse = gf_inverse(denominator_leading_term);
+        t = tLastLast;
 
-        while (get_degree(r) >= get_degree(rLast) && !is_zero_polynomial(r)) {
-            int degree_diff = get_degree(r) - get_degree(rLast);
-            u_int8_t scale = gf_multiply(get_coefficient(r, get_degree(r)), dlt_inverse);
+        unsigned int degree_r_last = degree_of(rLast);
+        u_int8_t dlt_inverse = gf_inverse(rLast[degree_r_last]);
 
-            struct gf_polynomial* scale_monomial = get_monomial(degree_diff, scale);
-            if (scale_monomial == NULL) {
-                free_gf_polynomial(r);
-                free_gf_polynomial(t);
-                free_gf_polynomial(rLast);
-                free_gf_polynomial(tLast);
-                return MEMORY_ERROR;
-            }
-            struct gf_polynomial* new_q = add_polynomials(q, scale_monomial);
-            if (new_q == NULL) {
-                free_gf_polynomial(r);
-                free_gf_polynomial(t);
-                free_gf_polynomial(rLast);
-                free_gf_polynomial(tLast);
-                free_gf_polynomial(scale_monomial);
-                return MEMORY_ERROR;
-            }
-            free_gf_polynomial(q);
-            q = new_q;
-
-            struct gf_polynomial* tmp = multiply_polynomials(rLast, scale_monomial);
-            if (tmp == NULL) {
-                free_gf_polynomial(r);
-                free_gf_polynomial(t);
-                free_gf_polynomial(rLast);
-                free_gf_polynomial(tLast);
-                free_gf_polynomial(scale_monomial);
-                return MEMORY_ERROR;
-            }
-            struct gf_polynomial* new_r = add_polynomials(r, tmp);
-            if (new_r == NULL) {
-                free_gf_polynomial(r);
-                free_gf_polynomial(t);
-                free_gf_polynomial(rLast);
-                free_gf_polynomial(tLast);
-                free_gf_polynomial(scale_monomial);
-                free_gf_polynomial(tmp);
-                return MEMORY_ERROR;
-            }
-            r = new_r;
-            free_gf_polynomial(tmp);
-            free_gf_polynomial(scale_monomial);
+        unsigned int degree_r;
+        while ((degree_r = degree_of(r)) >= degree_r_last && !(degree_r == 0 && r[0] == 0)) {
+            unsigned int degree_diff = degree_r - degree_r_last;
+            u_int8_t scale = gf_multiply(r[degree_r], dlt_inverse);
+            add_scaled_shifted(t, tLast, scale, degree_diff);
+            add_scaled_shifted(r, rLast, scale, degree_diff);
         }
 
-        struct gf_polynomial* q_x_tLast = multiply_polynomials(q, tLast);
-        if (q_x_tLast == NULL) {
-            free_gf_polynomial(r);
-            free_gf_polynomial(t);
-            free_gf_polynomial(rLast);
-            free_gf_polynomial(tLast);
-            free_gf_polynomial(q);
-            return MEMORY_ERROR;
-        }
-        struct gf_polynomial* new_t = add_polynomials(q_x_tLast, tLastLast);
-        if (new_t == NULL) {
-            free_gf_polynomial(r);
-            free_gf_polynomial(t);
-            free_gf_polynomial(rLast);
-            free_gf_polynomial(tLast);
-            free_gf_polynomial(q_x_tLast);
-            free_gf_polynomial(q);
-            return MEMORY_ERROR;
-        }
-        t = new_t;
-        free_gf_polynomial(q_x_tLast);
-        free_gf_polynomial(q);
-
-        if (get_degree(r) >= get_degree(rLast)) {
-            free_gf_polynomial(r);
-            free_gf_polynomial(t);
-            free_gf_polynomial(rLast);
-            free_gf_polynomial(tLast);
+        if (degree_of(r) >= degree_r_last) {
             return DECODING_ERROR;
         }
     }
 
-    u_int8_t sigma_tilde_at_0 = get_coefficient(t, 0);
+    u_int8_t sigma_tilde_at_0 = t[0];
     if (sigma_tilde_at_0 == 0) {
-        free_gf_polynomial(r);
-        free_gf_polynomial(t);
-        free_gf_polynomial(rLast);
-        free_gf_polynomial(tLast);
         return DECODING_ERROR;
     }
     u_int8_t inverse = gf_inverse(sigma_tilde_at_0);
-    multiply_by_scalar(t, inverse);
-    multiply_by_scalar(r, inverse);
-    *sigma = t;
-    *omega = r;
+    export_polynomial(t, inverse, sigma);
+    export_polynomial(r, inverse, omega);
+    return SUCCESS;
+}
+
+
+int calculate_sigma_omega_berlekamp_massey(struct gf_polynomial* syndromes, unsigned int n_error_correction_codewords,
+                                            struct gf_polynomial* sigma, struct gf_polynomial* omega) {
+    return calculate_sigma_omega_with_erasures(syndromes, n_error_correction_codewords, NULL, 0, sigma, omega);
+}
+
+
+int calculate_sigma_omega_with_erasures(struct gf_polynomial* syndromes, unsigned int n_error_correction_codewords,
+                                        u_int8_t* erasure_locations, unsigned int n_erasures,
+                                        struct gf_polynomial* sigma, struct gf_polynomial* omega) {
+    if (n_error_correction_codewords > MAX_ERROR_CORRECTION_CODEWORDS
+        || syndromes->n_coefficients > n_error_correction_codewords
+        || n_erasures > n_error_correction_codewords) {
+        return DECODING_ERROR;
+    }
+
+    u_int8_t s[MAX_RS_POLYNOMIAL_SIZE] = { 0 };
+    for (unsigned int i = 0 ; i < syndromes->n_coefficients ; i++) {
+        s[i] = get_coefficient(syndromes, i);
+    }
+
+    // c is the current connection polynomial that will become sigma
+    // and b is a copy of c as it was before the last length change
+    u_int8_t storage[3][MAX_RS_POLYNOMIAL_SIZE];
+    memset(storage, 0, sizeof(storage));
+    u_int8_t* c = storage[0];
+    u_int8_t* b = storage[1];
+    u_int8_t* tmp = storage[2];
+    c[0] = 1;
+
+    // Both c and b start as the erasure locator (1 + X_1.X)...(1 + X_f.X)
+    // which is 1 when there are no erasures
+    for (unsigned int i = 0 ; i < n_erasures ; i++) {
+        for (unsigned int k = i + 1 ; k > 0 ; k--) {
+            c[k] = gf_add_or_subtract(c[k], gf_multiply(c[k - 1], erasure_locations[i]));
+        }
+    }
+    memcpy(b, c, MAX_RS_POLYNOMIAL_SIZE);
+
+    // The number of errors and erasures found so far
+    unsigned int l = n_erasures;
+    // The number of iterations since l was last updated
+    unsigned int m = 1;
+    // The discrepancy that was observed when l was last updated
+    u_int8_t last_discrepancy = 1;
+
+    // The first n_erasures syndromes have already been used up by the erasures
+    for (unsigned int n = n_erasures ; n < n_error_correction_codewords ; n++) {
+        // The discrepancy is the difference between the syndrome S_n and the
+        // value predicted for it by the current connection polynomial
+        u_int8_t d = s[n];
+        for (unsigned int i = 1 ; i <= l ; i++) {
+            d = gf_add_or_subtract(d, gf_multiply(c[i], s[n - i]));
+        }
+
+        if (d == 0) {
+            m++;
+            continue;
+        }
+
+        u_int8_t scale = gf_multiply(d, gf_inverse(last_discrepancy));
+        if (2 * l <= n + n_erasures) {
+            // The connection polynomial must grow
+            memcpy(tmp, c, MAX_RS_POLYNOMIAL_SIZE);
+            add_scaled_shifted(c, b, scale, m);
+            l = n + 1 + n_erasures - l;
+            u_int8_t* swap = b;
+            b = tmp;
+            tmp = swap;
+            last_discrepancy = d;
+            m = 1;
+        } else {
+            add_scaled_shifted(c, b, scale, m);
+            m++;
+        }
+    }
+
+    // If sigma's degree does not match the number of errors or if there are
+    // more errors than we can correct, knowing that each error costs 2 error
+    // correction codewords and each erasure costs 1, there is nothing we can do
+    if (2 * l > n_error_correction_codewords + n_erasures || degree_of(c) != l) {
+        return DECODING_ERROR;
+    }
+
+    // omega is given by the key equation: omega = (S.sigma) mod X^n_error_correction_codewords
+    u_int8_t w[MAX_RS_POLYNOMIAL_SIZE] = { 0 };
+    for (unsigned int i = 0 ; i < n_error_correction_codewords ; i++) {
+        for (unsigned int j = 0 ; j <= i && j <= l ; j++) {
+            w[i] = gf_add_or_subtract(w[i], gf_multiply(c[j], s[i - j]));
+        }
+    }
 
-    free_gf_polynomial(rLast);
-    free_gf_polynomial(tLast);
+    export_polynomial(c, 1, sigma);
+    export_polynomial(w, 1, omega);
     return SUCCESS;
 }
 
 
-int find_error_locations(struct gf_polynomial* sigma, u_int8_t* locations) {
+int find_error_locations(struct gf_polynomial* sigma, unsigned int n_codewords, u_int8_t* locations) {
     unsigned int n_errors = get_degree(sigma);
+    if (n_errors >= MAX_RS_POLYNOMIAL_SIZE) {
+        return DECODING_ERROR;
+    }
+
+    // This is a Chien search: instead of evaluating sigma from scratch for
+    // each alpha^(-e), we maintain each term sigma_k.alpha^(-e.k) and go
+    // from e to e + 1 by multiplying it by alpha^(-k). The terms are kept
+    // as logarithms so that this multiplication is just an addition. A value
+    // of -1 stands for a zero coefficient
+    int log_terms[MAX_RS_POLYNOMIAL_SIZE];
+    for (unsigned int k = 1 ; k <= n_errors ; k++) {
+        u_int8_t coefficient = get_coefficient(sigma, k);
+        log_terms[k] = (coefficient == 0) ? -1 : gf_log(coefficient);
+    }
+    u_int8_t constant = get_coefficient(sigma, 0);
+
+    // Only the degrees that fall inside the block can be error positions
     unsigned int n = 0;
-    for (unsigned int i = 1 ; i <= 255 && n < n_errors; i++) {
-        if (evaluate_polynomial(sigma, i) == 0) {
-            locations[n++] = gf_inverse(i);
+    for (unsigned int e = 0 ; e < n_codewords && e < 255 && n < n_errors ; e++) {
+        u_int8_t value = constant;
+        for (unsigned int k = 1 ; k <= n_errors ; k++) {
+            if (log_terms[k] >= 0) {
+                value = gf_add_or_subtract(value, gf_power(log_terms[k]));
+                log_terms[k] += 255 - k;
+                if (log_terms[k] >= 255) {
+                    log_terms[k] -= 255;
+                }
+            }
+        }
+        if (value == 0) {
+            locations[n++] = gf_power(e);
         }
     }
     return (n == n_errors) ? SUCCESS : DECODING_ERROR;
@@ -235,6 +524,22 @@ void find_error_magnitudes(struct gf_polynomial* omega, unsigned int n_errors,
 
 
 int error_correction(struct block* b) {
+    return error_correction_with_engine(b, BERLEKAMP_MASSEY);
+}
+
+
+/**
+ * Corrects the given block with the given engine. If there are erasures,
+ * they are given as positions in the codeword array and the
+ * Berlekamp-Massey engine must be used.
+ */
+static int correct_block(struct block* b, ErrorLocatorEngine engine, u_int8_t* erasures, unsigned int n_erasures) {
+    if (b->n_error_correction_codewords > MAX_ERROR_CORRECTION_CODEWORDS
+        || n_erasures > b->n_error_correction_codewords
+        || (n_erasures > 0 && engine != BERLEKAMP_MASSEY)) {
+        return DECODING_ERROR;
+    }
+
     struct gf_polynomial message;
     message.coefficients = b->codewords;
     message.n_coefficients = b->n_data_codewords + b->n_error_correction_codewords;
@@ -244,48 +549,53 @@ int error_correction(struct block* b) {
     gory("\n%d error detection/correction codewords:\n", b->n_error_correction_codewords);
     print_bytes(GORY, b->codewords + b->n_data_codewords, b->n_error_correction_codewords);
 
+    // All the work is done in the following stack arrays
+    u_int8_t syndrome_coefficients[MAX_ERROR_CORRECTION_CODEWORDS] = { 0 };
+    u_int8_t sigma_coefficients[MAX_RS_POLYNOMIAL_SIZE];
+    u_int8_t omega_coefficients[MAX_RS_POLYNOMIAL_SIZE];
+    u_int8_t error_locations[MAX_RS_POLYNOMIAL_SIZE];
+    u_int8_t error_magnitudes[MAX_RS_POLYNOMIAL_SIZE];
 
-    struct gf_polynomial* syndromes = new_gf_polynomial(b->n_error_correction_codewords, NULL);
-    if (syndromes == NULL) {
-        return MEMORY_ERROR;
-    }
-    if (0 == calculate_syndromes(&message, syndromes)) {
-        free_gf_polynomial(syndromes);
+    struct gf_polynomial syndromes = { syndrome_coefficients, b->n_error_correction_codewords };
+    struct gf_polynomial sigma = { sigma_coefficients, 0 };
+    struct gf_polynomial omega = { omega_coefficients, 0 };
+
+    if (0 == calculate_syndromes(&message, &syndromes)) {
         return 0;
     }
-    poly_print(GORY, "\nSyndromes", syndromes);
+    poly_print(GORY, "\nSyndromes", &syndromes);
 
-    struct gf_polynomial* sigma;
-    struct gf_polynomial* omega;
+    // The erasure positions are converted into alpha^i locations
+    // like the ones returned by find_error_locations()
+    u_int8_t erasure_locations[MAX_ERROR_CORRECTION_CODEWORDS];
+    for (unsigned int i = 0 ; i < n_erasures ; i++) {
+        if (erasures[i] >= message.n_coefficients) {
+            return DECODING_ERROR;
+        }
+        erasure_locations[i] = gf_power(message.n_coefficients - 1 - erasures[i]);
+    }
 
-    int res = calculate_sigma_omega(syndromes, b->n_error_correction_codewords, &sigma, &omega);
+    int res;
+    switch (engine) {
+        case EUCLIDEAN_ALGORITHM: res = calculate_sigma_omega(&syndromes, b->n_error_correction_codewords, &sigma, &omega); break;
+        case BERLEKAMP_MASSEY: res = calculate_sigma_omega_with_erasures(&syndromes, b->n_error_correction_codewords,
+                                                                        erasure_locations, n_erasures, &sigma, &omega); break;
+        default: return DECODING_ERROR;
+    }
     if (res != SUCCESS) {
         gory("Cannot calculate sigma and omega polynomials\n");
-        free_gf_polynomial(syndromes);
         return res;
     }
 
-    poly_print(GORY, "\nsigma", sigma);
-    poly_print(GORY, "\nomega", omega);
+    poly_print(GORY, "\nsigma", &sigma);
+    poly_print(GORY, "\nomega", &omega);
 
-    unsigned int n_errors = get_degree(sigma);
+    unsigned int n_errors = get_degree(&sigma);
     gory("\n%d error%s detected\n", n_errors, (n_errors > 1) ? "s" : "");
 
-    u_int8_t* error_locations = (u_int8_t*)malloc(n_errors * sizeof(u_int8_t));
-    if (error_locations == NULL) {
-        free_gf_polynomial(syndromes);
-        free_gf_polynomial(sigma);
-        free_gf_polynomial(omega);
-        return MEMORY_ERROR;
-    }
-
-    res = find_error_locations(sigma, error_locations);
+    res = find_error_locations(&sigma, message.n_coefficients, error_locations);
     if (res == DECODING_ERROR) {
         gory("Cannot find error locations\n");
-        free_gf_polynomial(syndromes);
-        free_gf_polynomial(sigma);
-        free_gf_polynomial(omega);
-        free(error_locations);
         return DECODING_ERROR;
     }
 
@@ -296,66 +606,259 @@ int error_correction(struct block* b) {
     }
     gory("\n");
 
-    u_int8_t* error_magnitudes = (u_int8_t*)malloc(n_errors * sizeof(u_int8_t));
-    if (error_magnitudes == NULL) {
-        free_gf_polynomial(syndromes);
-        free_gf_polynomial(sigma);
-        free_gf_polynomial(omega);
-        free(error_locations);
-        return MEMORY_ERROR;
-    }
-    find_error_magnitudes(omega, n_errors, error_locations, error_magnitudes);
+    find_error_magnitudes(&omega, n_errors, error_locations, error_magnitudes);
 
-    // Finally, let's apply the corrections
+    // Finally, let's apply the corrections. Erasures may turn out to have
+    // been correct, so we only count the codewords that actually change
+    unsigned int n_corrected = 0;
     for (unsigned int i = 0 ; i < n_errors ; i++) {
+        if (error_magnitudes[i] == 0) {
+            continue;
+        }
+        n_corrected++;
         unsigned int pos = message.n_coefficients - 1 - gf_log(error_locations[i]);
         u_int8_t bad = b->codewords[pos];
         b->codewords[pos] = gf_add_or_subtract(b->codewords[pos], error_magnitudes[i]);
         gory("Correcting codeword #%d from %02x to %02x\n", pos, bad, b->codewords[pos]);
     }
 
-    free_gf_polynomial(syndromes);
-    free_gf_polynomial(sigma);
-    free_gf_polynomial(omega);
-    free(error_locations);
-    free(error_magnitudes);
+    // Erasures leave fewer syndromes to detect a wrong correction, so let's
+    // make sure that we got a valid block and undo the corrections if not
+    if (n_erasures > 0 && 0 != calculate_syndromes(&message, &syndromes)) {
+        gory("The corrected block is not valid, undoing the corrections\n");
+        for (unsigned int i = 0 ; i < n_errors ; i++) {
+            unsigned int pos = message.n_coefficients - 1 - gf_log(error_locations[i]);
+            b->codewords[pos] = gf_add_or_subtract(b->codewords[pos], error_magnitudes[i]);
+        }
+        return DECODING_ERROR;
+    }
 
     gory("\nByte sequence after error correction:\n");
     print_bytes(GORY, b->codewords, b->n_data_codewords);
     gory("\n");
-    return n_errors;
+    return n_corrected;
 }
 
 
-int get_message_bitstream(struct blocks* blocks, struct bitstream* *bitstream) {
-    unsigned int n = 0;
-    for (unsigned int i = 0 ; i < blocks->n_blocks ; i++) {
-        gory("\nApplying error detection/correction to block %d/%d...\n", (i + 1), blocks->n_blocks);
-        n += blocks->block[i].n_data_codewords;
-        int res = error_correction(&(blocks->block[i]));
-        if (res < 0) {
-            return res;
+int error_correction_with_engine(struct block* b, ErrorLocatorEngine engine) {
+    return correct_block(b, engine, NULL, 0);
+}
+
+
+int error_correction_with_erasures(struct block* b, u_int8_t* erasures, unsigned int n_erasures) {
+    // Erasures are only worth using when the block cannot be corrected
+    // without them, since marking correct codewords as erasures wastes
+    // error correction codewords and leaves fewer syndromes to detect
+    // a wrong correction
+    int res = correct_block(b, BERLEKAMP_MASSEY, NULL, 0);
+    if (res >= 0 || n_erasures == 0) {
+        return res;
+    }
+
+    // At least 2 syndromes must remain to check the correction, or else
+    // any block would look correctable
+    if (b->n_error_correction_codewords < 2) {
+        return res;
+    }
+    if (n_erasures > b->n_error_correction_codewords - 2) {
+        gory("Too many erasures, only using %d of them\n", b->n_error_correction_codewords - 2);
+        n_erasures = b->n_error_correction_codewords - 2;
+    }
+    return correct_block(b, BERLEKAMP_MASSEY, erasures, n_erasures);
+}
+
+
+/**
+ * The state shared by the threads that correct the blocks of a QR code.
+ */
+struct block_correction_job {
+    struct blocks* blocks;
+
+    // If not NULL, the uncertain codeword flags of each block
+    struct blocks* uncertain_blocks;
+
+    // Protects the fields below
+    pthread_mutex_t lock;
+
+    // The next block to be corrected
+    unsigned int next_block;
+
+    // SUCCESS or the first error encountered, in which case the
+    // remaining blocks are not worth correcting
+    int result;
+
+    // The number of errors corrected in each block
+    int n_errors[MAX_BLOCKS];
+
+    // The log level of the thread that needs the blocks, so that
+    // the threads that help it log the same way
+    int log_level;
+};
+
+
+/**
+ * Corrects blocks of the given job until there are no more blocks
+ * or until a block fails.
+ */
+static void* correct_blocks(void* data) {
+    struct block_correction_job* job = (struct block_correction_job*)data;
+    int previous_log_level = set_thread_log_level(job->log_level);
+    for (;;) {
+        pthread_mutex_lock(&(job->lock));
+        if (job->result != SUCCESS || job->next_block == job->blocks->n_blocks) {
+            pthread_mutex_unlock(&(job->lock));
+            set_thread_log_level(previous_log_level);
+            return NULL;
         }
-        if (res > 0) {
-            info("Fixed %d errors in block %d/%d\n", res, (i + 1), blocks->n_blocks);
+        unsigned int i = job->next_block++;
+        pthread_mutex_unlock(&(job->lock));
+
+        gory("\nApplying error detection/correction to block %d/%d...\n", (i + 1), job->blocks->n_blocks);
+        int res;
+        if (job->uncertain_blocks == NULL) {
+            res = error_correction(&(job->blocks->block[i]));
         } else {
-            info("No errors in block %d/%d\n", (i + 1), blocks->n_blocks);
+            struct block* flags = &(job->uncertain_blocks->block[i]);
+            u_int8_t erasures[MAX_ERROR_CORRECTION_CODEWORDS];
+            unsigned int n_erasures = 0;
+            unsigned int n_codewords = flags->n_data_codewords + flags->n_error_correction_codewords;
+            for (unsigned int j = 0 ; j < n_codewords ; j++) {
+                if (flags->codewords[j]) {
+                    if (n_erasures < MAX_ERROR_CORRECTION_CODEWORDS) {
+                        erasures[n_erasures] = j;
+                    }
+                    n_erasures++;
+                }
+            }
+            if (n_erasures > MAX_ERROR_CORRECTION_CODEWORDS) {
+                // Only the first ones were recorded, which is more than
+                // error_correction_with_erasures() will use anyway
+                n_erasures = MAX_ERROR_CORRECTION_CODEWORDS;
+            }
+            res = error_correction_with_erasures(&(job->blocks->block[i]), erasures, n_erasures);
+        }
+
+        pthread_mutex_lock(&(job->lock));
+        job->n_errors[i] = res;
+        if (res < 0 && job->result == SUCCESS) {
+            job->result = res;
         }
+        pthread_mutex_unlock(&(job->lock));
     }
+}
 
-    (*bitstream) = new_bitstream(n);
-    if ((*bitstream) == NULL) {
+
+/**
+ * Corrects all the given blocks, with the help of the given pool if not NULL.
+ */
+static int correct_all_blocks(struct blocks* blocks, struct blocks* uncertain_blocks, struct thread_pool* pool) {
+    if (blocks->n_blocks > MAX_BLOCKS
+        || (uncertain_blocks != NULL && uncertain_blocks->n_blocks != blocks->n_blocks)) {
+        return DECODING_ERROR;
+    }
+
+    struct block_correction_job job;
+    job.blocks = blocks;
+    job.uncertain_blocks = uncertain_blocks;
+    job.next_block = 0;
+    job.result = SUCCESS;
+    job.log_level = get_thread_log_level();
+    if (0 != pthread_mutex_init(&(job.lock), NULL)) {
         return MEMORY_ERROR;
     }
 
+    // There is no point in waking up threads for a single block
+    if (pool != NULL && blocks->n_blocks > 1) {
+        run_in_thread_pool(pool, correct_blocks, &job);
+    } else {
+        correct_blocks(&job);
+    }
+    pthread_mutex_destroy(&(job.lock));
+
+    if (job.result != SUCCESS) {
+        return job.result;
+    }
+
+    for (unsigned int i = 0 ; i < blocks->n_blocks ; i++) {
+        if (job.n_errors[i] > 0) {
+            info("Fixed %d errors in block %d/%d\n", job.n_errors[i], (i + 1), blocks->n_blocks);
+        } else {
+            info("No errors in block %d/%d\n", (i + 1), blocks->n_blocks);
+        }
+    }
+    return SUCCESS;
+}
+
+
+/**
+ * Moves the data codewords of the given blocks to the beginning of
+ * their shared codeword array and returns how many there are.
+ */
+static unsigned int gather_data_codewords(struct blocks* blocks) {
     unsigned int pos = 0;
     for (unsigned int i = 0 ; i < blocks->n_blocks ; i++) {
-        int n_bytes = blocks->block[i].n_data_codewords * sizeof(u_int8_t);
-        memcpy((*bitstream)->bytes + pos, blocks->block[i].codewords, n_bytes);
-        pos += n_bytes;
+        memmove(blocks->codewords + pos, blocks->block[i].codewords, blocks->block[i].n_data_codewords);
+        pos += blocks->block[i].n_data_codewords;
+        blocks->block[i].codewords = NULL;
+    }
+    return pos;
+}
+
+
+int get_message_bitstream(struct blocks* blocks, struct blocks* uncertain_blocks,
+                        struct thread_pool* pool, struct bitstream* *bitstream) {
+    int res = correct_all_blocks(blocks, uncertain_blocks, pool);
+    if (res != SUCCESS) {
+        return res;
+    }
+
+    unsigned int n = 0;
+    for (unsigned int i = 0 ; i < blocks->n_blocks ; i++) {
+        n += blocks->block[i].n_data_codewords;
+    }
+
+    if (blocks->codewords != NULL) {
+        // When all the blocks live in a single array, the data codewords
+        // are gathered at the beginning of this array and the bitstream
+        // takes it over, instead of copying them into a new one
+        (*bitstream) = wrap_bitstream(blocks->codewords, n);
+        if ((*bitstream) == NULL) {
+            return MEMORY_ERROR;
+        }
+        gather_data_codewords(blocks);
+        blocks->codewords = NULL;
+    } else {
+        (*bitstream) = new_bitstream(n);
+        if ((*bitstream) == NULL) {
+            return MEMORY_ERROR;
+        }
+
+        unsigned int pos = 0;
+        for (unsigned int i = 0 ; i < blocks->n_blocks ; i++) {
+            int n_bytes = blocks->block[i].n_data_codewords * sizeof(u_int8_t);
+            memcpy((*bitstream)->bytes + pos, blocks->block[i].codewords, n_bytes);
+            pos += n_bytes;
+        }
     }
 
     gory("\nAll blocks successfully parsed into %d bytes:\n", (*bitstream)->n_bytes);
     print_bytes(GORY, (*bitstream)->bytes, (*bitstream)->n_bytes);
     return SUCCESS;
 }
+
+
+int get_message_bitstream_in_place(struct blocks* blocks, struct blocks* uncertain_blocks,
+                                struct thread_pool* pool, struct bitstream* bitstream) {
+    if (blocks->codewords == NULL) {
+        return DECODING_ERROR;
+    }
+    int res = correct_all_blocks(blocks, uncertain_blocks, pool);
+    if (res != SUCCESS) {
+        return res;
+    }
+
+    init_bitstream(bitstream, blocks->codewords, gather_data_codewords(blocks));
+    gory("\nAll blocks successfully parsed into %d bytes:\n", bitstream->n_bytes);
+    print_bytes(GORY, bitstream->bytes, bitstream->n_bytes);
+    return SUCCESS;
+}
@@ -5,6 +5,30 @@
 #include "blocks.h"
 #include "errors.h"
 #include "polynomial.h"
+#include "threadpool.h"
+
+// The maximum number of error correction codewords in a block. Since
+// each error requires 2 error correction codewords to be corrected, this is
+// twice the error correction capacity
+#define MAX_ERROR_CORRECTION_CODEWORDS (2 * MAX_ERROR_CORRECTION_CAPACITY)
+
+// The maximum number of coefficients of the polynomials used during
+// error correction
+#define MAX_RS_POLYNOMIAL_SIZE (MAX_ERROR_CORRECTION_CODEWORDS + 1)
+
+
+/**
+ * There are two ways of calculating the error locator and error
+ * evaluator polynomials from the syndromes.
+ */
+typedef enum {
+    // Repeated polynomial divisions, as done by zxing
+    EUCLIDEAN_ALGORITHM,
+
+    // Iterative synthesis of the shortest linear feedback shift
+    // register that generates the syndromes. This is the faster one
+    BERLEKAMP_MASSEY
+} ErrorLocatorEngine;
 
 
 /**
@@ -38,18 +62,54 @@
  * so that the data codewords at beginning of the codeword array are
  * the correct codewords to be used to decode the QR code.
  *
- * The implementation is a port of the one in the zxing project.
+ * The implementation is a port of the one in the zxing project, except that
+ * all the intermediate polynomials live in fixed size arrays on the stack
+ * so that no memory allocation is needed.
  *
  * @param b The single block to decode
  * @return On success, a value n>=0 representing the number of errors
  *         that were corrected
  *         DECODING_ERROR if the block could not be decoded
- *                        because there were too many errors
- *         MEMORY_ERROR in case of memory allocation error
+ *                        because there were too many errors or if the block
+ *                        has more error correction codewords than
+ *                        MAX_ERROR_CORRECTION_CODEWORDS
  */
 int error_correction(struct block* b);
 
 
+/**
+ * Same as error_correction(), which uses the Berlekamp-Massey algorithm,
+ * but with the given engine to calculate the error locator polynomial.
+ */
+int error_correction_with_engine(struct block* b, ErrorLocatorEngine engine);
+
+
+/**
+ * Same as error_correction() but some codewords are already known to be
+ * unreliable, for instance because some of their modules could not be
+ * sampled with confidence. Such erasures only cost one error correction
+ * codeword each instead of two for errors at unknown positions, so that
+ * a block with n error correction codewords can be corrected as long as
+ * 2 x errors + erasures <= n.
+ *
+ * Since erasures that turn out to be correct codewords waste error
+ * correction codewords and leave fewer syndromes to detect a wrong
+ * correction, the block is first corrected without them, and they are
+ * only used if this fails. At most n-2 erasures are used, so that there
+ * are always syndromes left to check the correction, and the corrected
+ * block is checked again before being accepted.
+ *
+ * @param b The single block to decode
+ * @param erasures The distinct positions of the unreliable codewords in
+ *                 the block's codeword array
+ * @param n_erasures The number of erasures. Only the first n-2 ones are used
+ * @return On success, a value n>=0 representing the number of codewords
+ *         that were corrected
+ *         DECODING_ERROR if the block could not be decoded
+ */
+int error_correction_with_erasures(struct block* b, u_int8_t* erasures, unsigned int n_erasures);
+
+
 /**
  * Each block of M codewords is treated a polynomial like:
  *
@@ -63,6 +123,12 @@ int error_correction(struct block* b);
  * error to be corrected. Otherwise there will be more work to do to figure
  * out how many errors there are and where they are.
  *
+ * On x86 processors that support them, each syndrome is calculated 32
+ * codewords at a time with AVX2 or 16 at a time with SSSE3, using PSHUFB
+ * based multiplications. The kernel is chosen at runtime, so that no special
+ * compiler flag is needed. Otherwise, all the syndromes are calculated in a
+ * single pass over the codewords.
+ *
  * @param message A polynomial representing the message we want to decode
  * @param syndromes A polynomial structure where to store the syndromes
  * @return The number of non zero syndromes
@@ -70,21 +136,95 @@ int error_correction(struct block* b);
 unsigned int calculate_syndromes(struct gf_polynomial* message, struct gf_polynomial* syndromes);
 
 
+/**
+ * The implementations of the syndrome calculation.
+ */
+typedef enum {
+    // The fastest one supported by the processor
+    SYNDROMES_AUTO,
+
+    // Portable C
+    SYNDROMES_SCALAR,
+
+    // x86 SIMD instructions
+    SYNDROMES_SSSE3,
+    SYNDROMES_AVX2
+} SyndromeKernel;
+
+
+/**
+ * Returns 1 if the given kernel can be used on this processor; 0 otherwise.
+ */
+int is_syndrome_kernel_supported(SyndromeKernel kernel);
+
+
+/**
+ * Same as calculate_syndromes() but with the given kernel,
+ * or the scalar one if the given kernel is not supported.
+ */
+unsigned int calculate_syndromes_with_kernel(struct gf_polynomial* message, struct gf_polynomial* syndromes,
+                                            SyndromeKernel kernel);
+
+
 /**
  * Given the syndromes, this function uses the Euclidian algorithm to
  * obtain the error locator polynomial (often referred to as sigma) and
  * the error evaluator polynomial (often referred to as omega).
  *
+ * The division steps are done in place in fixed size arrays, so this
+ * function does not allocate any memory. The caller provides the storage
+ * for the results.
+ *
  * @param syndromes The syndrome polynomial
- * @param n_error_correction_codewords The number of non-data codewords in the message
- * @param sigma Where to store the error locator polynomial
- * @param omega Where to store the error evalutator polynomial
+ * @param n_error_correction_codewords The number of non-data codewords in the message.
+ *                                     Must not be greater than MAX_ERROR_CORRECTION_CODEWORDS
+ * @param sigma Where to store the error locator polynomial. sigma->coefficients must
+ *              point to an array of at least MAX_RS_POLYNOMIAL_SIZE bytes. On success,
+ *              sigma->n_coefficients is set to degree(sigma) + 1
+ * @param omega Where to store the error evalutator polynomial, with the same
+ *              constraints as sigma
  * @return SUCCESS in case of success
- *         DECODING_ERROR in case of internal error
- *         MEMORY_ERROR in case of memory allocation error
+ *         DECODING_ERROR in case of internal error or if there are too many
+ *                        error correction codewords
  */
 int calculate_sigma_omega(struct gf_polynomial* syndromes, unsigned int n_error_correction_codewords,
-                            struct gf_polynomial* *sigma, struct gf_polynomial* *omega);
+                            struct gf_polynomial* sigma, struct gf_polynomial* omega);
+
+
+/**
+ * Same as calculate_sigma_omega() but using the Berlekamp-Massey algorithm.
+ * Starting with sigma = 1, each syndrome S_n is compared with the value
+ * predicted from the previous syndromes by sigma. If they differ, sigma is
+ * corrected with a scaled copy of the last sigma that was obtained before
+ * the number of errors increased. This only needs a few fixed size arrays
+ * and one pass over the syndromes. Once sigma is known, omega is obtained
+ * with the key equation:
+ *
+ * omega = (S.sigma) mod X^n_error_correction_codewords
+ *
+ * The error magnitudes can then be obtained from omega with Forney's
+ * formula, which is what find_error_magnitudes() does.
+ */
+int calculate_sigma_omega_berlekamp_massey(struct gf_polynomial* syndromes, unsigned int n_error_correction_codewords,
+                                            struct gf_polynomial* sigma, struct gf_polynomial* omega);
+
+
+/**
+ * Same as calculate_sigma_omega_berlekamp_massey() for a message where
+ * some error locations are known in advance. sigma starts as the erasure
+ * locator (1 + X_1.X)...(1 + X_f.X) instead of 1 and the iterations start
+ * at the syndrome S_f, so that the resulting sigma locates both the
+ * erasures and the errors. With n error correction codewords, this works
+ * as long as 2 x errors + f <= n.
+ *
+ * @param erasure_locations The erasure positions given as alpha^i where i is
+ *                          the degree of the erasure in the message polynomial
+ * @param n_erasures The number of erasures, that must not be greater than
+ *                   n_error_correction_codewords
+ */
+int calculate_sigma_omega_with_erasures(struct gf_polynomial* syndromes, unsigned int n_error_correction_codewords,
+                                        u_int8_t* erasure_locations, unsigned int n_erasures,
+                                        struct gf_polynomial* sigma, struct gf_polynomial* omega);
 
 
 /**
@@ -98,16 +238,21 @@ int calculate_sigma_omega(struct gf_polynomial* syndromes, unsigned int n_error_
  * to the monomials X^24, X^21 and and X^19, so the error locations
  * returned by the function would be alpha^24, alpha^21 and alpha^19
  *
+ * The roots are searched with a Chien search that only tests the degrees
+ * that correspond to codewords of the block, and that stops as soon as
+ * all the roots have been found.
+ *
  * @param sigma The error evaluator polynomial whose degree is the number
  *              of errors
+ * @param n_codewords The number of codewords in the block
  * @param locations An array of size degree(sigma) where to put the alpha^i
  *                  values
  * @return SUCCESS on success
- *         DECODING_ERROR if the number of roots does not match not match the
- *                        expected number of errors which indicates that we cannot
- *                        correct the errors
+ *         DECODING_ERROR if the number of roots inside the block does not match
+ *                        the expected number of errors which indicates that we
+ *                        cannot correct the errors
  */
-int find_error_locations(struct gf_polynomial* sigma, u_int8_t* locations);
+int find_error_locations(struct gf_polynomial* sigma, unsigned int n_codewords, u_int8_t* locations);
 
 
 /**
@@ -131,13 +276,42 @@ void find_error_magnitudes(struct gf_polynomial* omega, unsigned int n_errors,
  * on them and if all blocks can be decoded correctly, aggregates the data
  * bytes in a bitstream buffer.
  *
+ * Since the blocks are independent, they can be corrected in parallel by
+ * several threads that pick the next block to correct until there is none
+ * left. As soon as a block fails, the blocks that have not been started yet
+ * are skipped.
+ *
  * @param blocks The (data+error) blocks from the QR code
+ * @param uncertain_blocks If not NULL, blocks with the same layout as blocks
+ *                         where non zero values indicate codewords that should
+ *                         be treated as erasures
+ * @param pool If not NULL, the pool whose threads help the calling thread.
+ *             If NULL, all the blocks are corrected by the calling thread
  * @param bitstream On success, *bitstream will be allocated and filled with
- *                the correct data codewords
+ *                the correct data codewords. If the blocks come from get_blocks(),
+ *                the bitstream takes over the blocks' codeword array, after which
+ *                the blocks can only be passed to free_blocks()
  * @return SUCCESS on success
  *         DECODING_ERROR if a block cannot be successfully decoded
  *         MEMORY_ERROR in case of memory allocation error
  */
-int get_message_bitstream(struct blocks* blocks, struct bitstream* *bitstream);
+int get_message_bitstream(struct blocks* blocks, struct blocks* uncertain_blocks,
+                        struct thread_pool* pool, struct bitstream* *bitstream);
+
+
+/**
+ * Same as get_message_bitstream() but no memory is allocated. The data
+ * codewords are gathered at the beginning of the codeword array shared by
+ * the blocks, and the given bitstream is initialized to read them from there,
+ * so the blocks' codeword array must remain valid while the bitstream is
+ * used, and the bitstream must not be passed to free_bitstream().
+ *
+ * @return SUCCESS on success
+ *         DECODING_ERROR if a block cannot be successfully decoded or if the
+ *                        blocks do not share a single codeword array
+ *         MEMORY_ERROR if the job lock cannot be created
+ */
+int get_message_bitstream_in_place(struct blocks* blocks, struct blocks* uncertain_blocks,
+                                struct thread_pool* pool, struct bitstream* bitstream);
 
 #endif
@@ -0,0 +1,233 @@
+#include <pthread.h>
+#include <string.h>
+#include "allocator.h"
+#include "resultcache.h"
+
+
+/**
+ * A message and the modules it was decoded from.
+ */
+struct cache_entry {
+    u_int64_t hash;
+    unsigned int dimension;
+
+    // The bytes of the modules followed by the bytes of the message
+    u_int8_t* data;
+    unsigned int data_capacity;
+    unsigned int n_message_bytes;
+
+    // The next entry with the same bucket
+    struct cache_entry* next;
+
+    // The neighbors of this entry in the list of entries
+    // sorted from the most to the least recently used
+    struct cache_entry* newer;
+    struct cache_entry* older;
+};
+
+
+struct qr_result_cache {
+    // Protects all the fields below
+    pthread_mutex_t lock;
+
+    struct cache_entry* entries;
+    unsigned int capacity;
+    unsigned int n_entries;
+
+    // The hash table, whose size is a power of 2
+    struct cache_entry** buckets;
+    unsigned int n_buckets;
+
+    struct cache_entry* newest;
+    struct cache_entry* oldest;
+
+    unsigned long n_hits;
+    unsigned long n_misses;
+};
+
+
+struct qr_result_cache* new_qr_result_cache(unsigned int capacity) {
+    if (capacity == 0) {
+        return NULL;
+    }
+    struct qr_result_cache* cache = (struct qr_result_cache*)qr_calloc(1, sizeof(struct qr_result_cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->capacity = capacity;
+    cache->n_buckets = 1;
+    while (cache->n_buckets < 2 * capacity) {
+        cache->n_buckets *= 2;
+    }
+    cache->entries = (struct cache_entry*)qr_calloc(capacity, sizeof(struct cache_entry));
+    cache->buckets = (struct cache_entry**)qr_calloc(cache->n_buckets, sizeof(struct cache_entry*));
+    if (cache->entries == NULL || cache->buckets == NULL || 0 != pthread_mutex_init(&(cache->lock), NULL)) {
+        qr_free(cache->entries);
+        qr_free(cache->buckets);
+        qr_free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+
+void free_qr_result_cache(struct qr_result_cache* cache) {
+    for (unsigned int i = 0 ; i < cache->n_entries ; i++) {
+        qr_free(cache->entries[i].data);
+    }
+    pthread_mutex_destroy(&(cache->lock));
+    qr_free(cache->entries);
+    qr_free(cache->buckets);
+    qr_free(cache);
+}
+
+
+void get_qr_result_cache_stats(struct qr_result_cache* cache, unsigned long *n_hits, unsigned long *n_misses) {
+    pthread_mutex_lock(&(cache->lock));
+    (*n_hits) = cache->n_hits;
+    (*n_misses) = cache->n_misses;
+    pthread_mutex_unlock(&(cache->lock));
+}
+
+
+static unsigned int get_n_module_bytes(unsigned int dimension) {
+    return ((dimension * dimension) / 8) + ((dimension * dimension) % 8 != 0);
+}
+
+
+/**
+ * Returns the 64-bit FNV-1a hash of the given modules.
+ */
+static u_int64_t hash_modules(struct bit_matrix* modules) {
+    u_int64_t hash = 0xCBF29CE484222325ULL;
+    hash = (hash ^ modules->width) * 0x100000001B3ULL;
+    unsigned int n = get_n_module_bytes(modules->width);
+    for (unsigned int i = 0 ; i < n ; i++) {
+        hash = (hash ^ modules->matrix[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+
+/**
+ * Returns the entry for the given modules or NULL if there is none.
+ * Must be called with the lock held.
+ */
+static struct cache_entry* find_entry(struct qr_result_cache* cache, struct bit_matrix* modules, u_int64_t hash) {
+    struct cache_entry* entry = cache->buckets[hash & (cache->n_buckets - 1)];
+    for ( ; entry != NULL ; entry = entry->next) {
+        if (entry->hash == hash && entry->dimension == modules->width
+            && 0 == memcmp(entry->data, modules->matrix, get_n_module_bytes(modules->width))) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * Removes the given entry from the list of entries sorted by use.
+ */
+static void unlink_entry(struct qr_result_cache* cache, struct cache_entry* entry) {
+    if (entry->newer == NULL) {
+        cache->newest = entry->older;
+    } else {
+        entry->newer->older = entry->older;
+    }
+    if (entry->older == NULL) {
+        cache->oldest = entry->newer;
+    } else {
+        entry->older->newer = entry->newer;
+    }
+}
+
+
+/**
+ * Makes the given entry the most recently used one.
+ */
+static void push_newest(struct qr_result_cache* cache, struct cache_entry* entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest == NULL) {
+        cache->oldest = entry;
+    } else {
+        cache->newest->newer = entry;
+    }
+    cache->newest = entry;
+}
+
+
+int get_cached_message(struct qr_result_cache* cache, struct bit_matrix* modules, struct bytebuffer* *message) {
+    u_int64_t hash = hash_modules(modules);
+    pthread_mutex_lock(&(cache->lock));
+    struct cache_entry* entry = find_entry(cache, modules, hash);
+    if (entry == NULL) {
+        cache->n_misses++;
+        pthread_mutex_unlock(&(cache->lock));
+        return DECODING_ERROR;
+    }
+    cache->n_hits++;
+    unlink_entry(cache, entry);
+    push_newest(cache, entry);
+
+    // The copy has to be made before releasing the lock,
+    // since the entry may be reused right after
+    (*message) = new_bytebuffer_with_capacity(entry->n_message_bytes + 1);
+    if ((*message) != NULL) {
+        memcpy((*message)->bytes, entry->data + get_n_module_bytes(entry->dimension), entry->n_message_bytes);
+        (*message)->bytes[entry->n_message_bytes] = '\0';
+        (*message)->n_bytes = entry->n_message_bytes;
+    }
+    pthread_mutex_unlock(&(cache->lock));
+    return ((*message) == NULL) ? MEMORY_ERROR : SUCCESS;
+}
+
+
+int cache_message(struct qr_result_cache* cache, struct bit_matrix* modules, struct bytebuffer* message) {
+    u_int64_t hash = hash_modules(modules);
+    unsigned int n_module_bytes = get_n_module_bytes(modules->width);
+    unsigned int size = n_module_bytes + message->n_bytes;
+
+    pthread_mutex_lock(&(cache->lock));
+    if (NULL != find_entry(cache, modules, hash)) {
+        // Another thread has decoded the same modules in the meantime
+        pthread_mutex_unlock(&(cache->lock));
+        return SUCCESS;
+    }
+
+    // Let's use a new entry if there is one left, or the least recently used one
+    int reused = cache->n_entries == cache->capacity;
+    struct cache_entry* entry = reused ? cache->oldest : &(cache->entries[cache->n_entries]);
+    if (size > entry->data_capacity) {
+        u_int8_t* data = (u_int8_t*)qr_realloc(entry->data, size);
+        if (data == NULL) {
+            pthread_mutex_unlock(&(cache->lock));
+            return MEMORY_ERROR;
+        }
+        entry->data = data;
+        entry->data_capacity = size;
+    }
+
+    if (reused) {
+        unlink_entry(cache, entry);
+        struct cache_entry* *previous = &(cache->buckets[entry->hash & (cache->n_buckets - 1)]);
+        while ((*previous) != entry) {
+            previous = &((*previous)->next);
+        }
+        (*previous) = entry->next;
+    } else {
+        cache->n_entries++;
+    }
+
+    entry->hash = hash;
+    entry->dimension = modules->width;
+    memcpy(entry->data, modules->matrix, n_module_bytes);
+    memcpy(entry->data + n_module_bytes, message->bytes, message->n_bytes);
+    entry->n_message_bytes = message->n_bytes;
+    struct cache_entry* *bucket = &(cache->buckets[hash & (cache->n_buckets - 1)]);
+    entry->next = (*bucket);
+    (*bucket) = entry;
+    push_newest(cache, entry);
+    pthread_mutex_unlock(&(cache->lock));
+    return SUCCESS;
+}
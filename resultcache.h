@@ -0,0 +1,64 @@
+#ifndef _RESULTCACHE_H
+#define _RESULTCACHE_H
+
+#include "bitmatrix.h"
+#include "bytebuffer.h"
+#include "errors.h"
+
+
+/**
+ * When the same QR code is seen in many consecutive frames, it is sampled
+ * into the same modules again and again. A result cache remembers the
+ * messages decoded from the most recently seen module matrices, so that
+ * decoding them again can be skipped. Its entries are indexed by a hash
+ * of the modules but they keep a copy of them, so that a hash collision
+ * can never return the message of another QR code.
+ *
+ * A cache can be shared by decoders running in different threads.
+ */
+struct qr_result_cache;
+
+
+/**
+ * Creates a cache that remembers at most the given number of messages,
+ * forgetting the least recently used one when it is full.
+ * Returns NULL in case of memory allocation error.
+ */
+struct qr_result_cache* new_qr_result_cache(unsigned int capacity);
+
+
+/**
+ * Frees all the memory associated to the given cache.
+ */
+void free_qr_result_cache(struct qr_result_cache* cache);
+
+
+/**
+ * Gets the number of lookups that found a message and
+ * the number of the ones that did not.
+ */
+void get_qr_result_cache_stats(struct qr_result_cache* cache, unsigned long *n_hits, unsigned long *n_misses);
+
+
+/**
+ * Looks for the message decoded from the given modules.
+ *
+ * @param cache The cache
+ * @param modules The sampled modules of a QR code
+ * @param message Where to store a copy of the message, to be freed by the caller
+ * @return SUCCESS if the message was found
+ *         DECODING_ERROR if it was not
+ *         MEMORY_ERROR in case of memory allocation error
+ */
+int get_cached_message(struct qr_result_cache* cache, struct bit_matrix* modules, struct bytebuffer* *message);
+
+
+/**
+ * Remembers the message decoded from the given modules.
+ *
+ * @return SUCCESS on success
+ *         MEMORY_ERROR in case of memory allocation error
+ */
+int cache_message(struct qr_result_cache* cache, struct bit_matrix* modules, struct bytebuffer* message);
+
+#endif
@@ -23,6 +23,22 @@ struct rgb_image {
 int load_rgb_image(const char* filename, struct rgb_image* *image);
 
 
+/**
+ * Same as load_rgb_image() but loads the png file into an existing image
+ * structure, so that a buffer can be reused for many images. The buffer is
+ * only reallocated if it is smaller than the new image.
+ *
+ * @param filename The path to the png file to load
+ * @param image The image to update. Its buffer may be NULL
+ * @param capacity The size in bytes of the image buffer. It will be
+ *                 updated if the buffer has to be enlarged
+ * @return SUCCESS on success
+ *         CANNOT_LOAD_IMAGE if the image cannot be loaded
+ *         MEMORY_ERROR in case of memory allocation error
+ */
+int reload_rgb_image(const char* filename, struct rgb_image* image, unsigned int *capacity);
+
+
 /**
  * Frees the memory associated to the given image.
  */
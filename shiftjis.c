@@ -1398,6 +1398,10 @@ static const u_int16_t *const euc_to_utf8_2bytes[] = {
  * QR codes.
  */
 u_int32_t from_SJIS(u_int32_t value) {
+    // Half-width katakana are encoded on a single byte
+    if (value >= 0xA1 && value <= 0xDF) {
+        return 0xFF61 + (value - 0xA1);
+    }
     if (!(value >= 0x8140 && value <= 0x9FFC) && !(value >= 0xE040 && value <= 0xEBBF)) {
         return 0;
     }
@@ -1427,7 +1431,7 @@ u_int32_t from_SJIS(u_int32_t value) {
     c2 = (c2 & 0x7F) - 0x21;
     c1 = (c1 & 0x7F) - 0x21;
 
-    if (c2 >= sizeof(euc_to_utf8_2bytes)) {
+    if (c2 >= sizeof(euc_to_utf8_2bytes) / sizeof(euc_to_utf8_2bytes[0])) {
         return 0;
     }
     const u_int16_t* p = euc_to_utf8_2bytes[c2];
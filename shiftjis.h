@@ -5,8 +5,9 @@
 #include <stdint.h>
 
 /**
- * Given a Shift JIS value, returns the corresponding unicode character
- * or 0 if the given value cannot be decoded.
+ * Given a Shift JIS value, i.e. a 2-byte value or a single byte half-width
+ * katakana, returns the corresponding unicode character or 0 if the given
+ * value cannot be decoded.
  */
 u_int32_t from_SJIS(u_int32_t value);
 
@@ -1,15 +1,27 @@
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include "allocator.h"
+#include "arena.h"
+#include "async.h"
+#include "batch.h"
 #include "big5.h"
 #include "bitstream.h"
 #include "bitstreamdecoder.h"
 #include "eci.h"
 #include "euc_kr.h"
 #include "galoisfield.h"
+#include "logs.h"
 #include "gb18030.h"
+#include "pipeline.h"
+#include "qrcode.h"
 #include "reedsolomon.h"
+#include "resultcache.h"
+#include "tracker.h"
 
 
 /**
@@ -84,6 +96,35 @@ static u_int8_t chinese_shift_jis[] = {
 
 
 
+/**
+ * Verifies the precomputed Galois field tables against products
+ * calculated bit by bit modulo the prime polynomial.
+ */
+static int test_galois_field() {
+    int ok = 1;
+    for (unsigned int a = 0 ; a < 256 ; a++) {
+        for (unsigned int b = 0 ; b < 256 ; b++) {
+            unsigned int product = 0;
+            unsigned int shifted = a;
+            for (unsigned int bit = 0 ; bit < 8 ; bit++) {
+                if (b & (1 << bit)) {
+                    product ^= shifted;
+                }
+                shifted <<= 1;
+                if (shifted & 0x100) {
+                    shifted ^= 0x11D;
+                }
+            }
+            ok = ok && product == gf_multiply(a, b);
+        }
+        if (a > 0) {
+            ok = ok && gf_power(gf_log(a)) == a && 1 == gf_multiply(a, gf_inverse(a));
+        }
+    }
+    return ok && gf_power(0) == 1 && gf_power(1) == 2 && gf_power(255) == 1;
+}
+
+
 /**
  * Verifies that the syndromes are all 0 when there is no error.
  */
@@ -320,6 +361,35 @@ static int test_divide_polynomials2() {
 }
 
 
+// Compares the SIMD kernels supported by this processor to the scalar one
+// for all the message lengths, so that all the paddings are covered
+int test_syndrome_kernels() {
+    SyndromeKernel kernels[] = { SYNDROMES_SSSE3, SYNDROMES_AVX2 };
+    u_int8_t codewords[255];
+    for (unsigned int i = 0 ; i < 255 ; i++) {
+        codewords[i] = (i * 97 + 13) & 0xFF;
+    }
+    u_int8_t expected_coefficients[MAX_ERROR_CORRECTION_CODEWORDS];
+    u_int8_t actual_coefficients[MAX_ERROR_CORRECTION_CODEWORDS];
+    struct gf_polynomial expected = { expected_coefficients, MAX_ERROR_CORRECTION_CODEWORDS };
+    struct gf_polynomial actual = { actual_coefficients, MAX_ERROR_CORRECTION_CODEWORDS };
+    for (unsigned int k = 0 ; k < 2 ; k++) {
+        if (!is_syndrome_kernel_supported(kernels[k])) {
+            continue;
+        }
+        for (unsigned int n = 1 ; n <= 255 ; n++) {
+            struct gf_polynomial message = { codewords, n };
+            calculate_syndromes_with_kernel(&message, &expected, SYNDROMES_SCALAR);
+            calculate_syndromes_with_kernel(&message, &actual, kernels[k]);
+            if (0 != memcmp(expected_coefficients, actual_coefficients, MAX_ERROR_CORRECTION_CODEWORDS)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
 int test_calculate_sigma_omega() {
     struct gf_polynomial* codewords = new_gf_polynomial(26, test_block);
     if (codewords == NULL) {
@@ -338,8 +408,10 @@ int test_calculate_sigma_omega() {
         return 0;
     }
 
-    struct gf_polynomial* sigma;
-    struct gf_polynomial* omega;
+    u_int8_t sigma_coefficients[MAX_RS_POLYNOMIAL_SIZE];
+    u_int8_t omega_coefficients[MAX_RS_POLYNOMIAL_SIZE];
+    struct gf_polynomial sigma = { sigma_coefficients, 0 };
+    struct gf_polynomial omega = { omega_coefficients, 0 };
 
     int ok = SUCCESS == calculate_sigma_omega(syndromes, 10, &sigma, &omega);
     if (!ok) {
@@ -363,25 +435,51 @@ int test_calculate_sigma_omega() {
         return 0;
     }
 
-    ok = equal_polynomials(expected_sigma, sigma) && equal_polynomials(expected_omega, omega);
+    ok = equal_polynomials(expected_sigma, &sigma) && equal_polynomials(expected_omega, &omega);
 
     free_gf_polynomial(codewords);
     free_gf_polynomial(syndromes);
-    free_gf_polynomial(sigma);
-    free_gf_polynomial(omega);
     free_gf_polynomial(expected_sigma);
     free_gf_polynomial(expected_omega);
     return ok;
 }
 
 
+int test_calculate_sigma_omega_berlekamp_massey() {
+    u_int8_t codewords[26];
+    memcpy(codewords, test_block, 26);
+    codewords[0] = 0;
+    struct gf_polynomial message = { codewords, 26 };
+
+    u_int8_t syndrome_coefficients[10];
+    struct gf_polynomial syndromes = { syndrome_coefficients, 10 };
+    if (0 == calculate_syndromes(&message, &syndromes)) {
+        return 0;
+    }
+
+    u_int8_t sigma_coefficients[MAX_RS_POLYNOMIAL_SIZE];
+    u_int8_t omega_coefficients[MAX_RS_POLYNOMIAL_SIZE];
+    struct gf_polynomial sigma = { sigma_coefficients, 0 };
+    struct gf_polynomial omega = { omega_coefficients, 0 };
+    if (SUCCESS != calculate_sigma_omega_berlekamp_massey(&syndromes, 10, &sigma, &omega)) {
+        return 0;
+    }
+
+    struct gf_polynomial expected_sigma = { (u_int8_t[]){ gf_power(25), 1 }, 2 };
+    struct gf_polynomial expected_omega = { (u_int8_t[]){ gf_power(6) }, 1 };
+    return equal_polynomials(&expected_sigma, &sigma) && equal_polynomials(&expected_omega, &omega);
+}
+
+
 int test_find_error_locations() {
     struct gf_polynomial* sigma = new_gf_polynomial(2, (u_int8_t[]){ gf_power(25), 1 });
     if (sigma == NULL) {
         return 0;
     }
     u_int8_t t[1];
-    int ok = SUCCESS == find_error_locations(sigma, t) && gf_log(t[0]) == 25;
+    int ok = SUCCESS == find_error_locations(sigma, 26, t) && gf_log(t[0]) == 25;
+    // The error is outside of a block of 25 codewords
+    ok = ok && DECODING_ERROR == find_error_locations(sigma, 25, t);
 
     free_gf_polynomial(sigma);
     return ok;
@@ -472,6 +570,190 @@ int test_error_correction4() {
 }
 
 
+// Test with the Euclidean algorithm and the maximum number of errors in the message
+int test_error_correction_euclid() {
+    struct block b;
+    u_int8_t codewords[26];
+    memcpy(codewords, test_block, 26);
+    b.codewords = codewords;
+    b.n_data_codewords = 16;
+    b.n_error_correction_codewords = 10;
+
+    for (unsigned int i = 0 ; i < 5 ; i++) {
+        codewords[i * 5] ^= 0x55;
+    }
+
+    return 5 == error_correction_with_engine(&b, EUCLIDEAN_ALGORITHM) && 0 == memcmp(codewords, test_block, 26);
+}
+
+
+// Test with more corrupted codewords than errors alone could fix, but whose positions are mostly known
+int test_error_correction_with_erasures() {
+    struct block b;
+    u_int8_t codewords[26];
+    memcpy(codewords, test_block, 26);
+    b.codewords = codewords;
+    b.n_data_codewords = 16;
+    b.n_error_correction_codewords = 10;
+
+    // 8 erasures, one of them being correct, and 1 error
+    u_int8_t erasures[8] = { 0, 3, 4, 9, 12, 17, 20, 25 };
+    for (unsigned int i = 0 ; i < 7 ; i++) {
+        codewords[erasures[i]] ^= 0x24 + i;
+    }
+    codewords[7] ^= 0x81;
+
+    return 8 == error_correction_with_erasures(&b, erasures, 8) && 0 == memcmp(codewords, test_block, 26);
+}
+
+
+// Test with as many erasures as error correction codewords, all of them being correct, and 1 error
+int test_error_correction_with_all_erasures() {
+    struct block b;
+    u_int8_t codewords[26];
+    memcpy(codewords, test_block, 26);
+    b.codewords = codewords;
+    b.n_data_codewords = 16;
+    b.n_error_correction_codewords = 10;
+
+    u_int8_t erasures[10] = { 0, 2, 4, 6, 8, 10, 12, 14, 16, 18 };
+    codewords[21] ^= 0x5a;
+
+    return 1 == error_correction_with_erasures(&b, erasures, 10) && 0 == memcmp(codewords, test_block, 26);
+}
+
+
+// Test with 2 errors and erasures that leave too few error correction codewords for them
+int test_error_correction_with_wasted_erasures() {
+    struct block b;
+    u_int8_t codewords[26];
+    memcpy(codewords, test_block, 26);
+    b.codewords = codewords;
+    b.n_data_codewords = 16;
+    b.n_error_correction_codewords = 10;
+
+    // With these erasures, the 2 errors could be mistaken for a single one
+    u_int8_t erasures[8] = { 13, 22, 11, 17, 1, 12, 16, 7 };
+    codewords[2] ^= 0x15;
+    codewords[3] ^= 0x14;
+
+    return 2 == error_correction_with_erasures(&b, erasures, 8) && 0 == memcmp(codewords, test_block, 26);
+}
+
+
+// Test the de-interleaving of a version 5 QR code with high error correction level
+int test_get_blocks() {
+    u_int8_t codewords[134];
+    for (unsigned int i = 0 ; i < 134 ; i++) {
+        codewords[i] = i;
+    }
+    struct blocks* blocks;
+    if (SUCCESS != get_blocks(codewords, 5, HIGH, &blocks)) {
+        return 0;
+    }
+    int ok = blocks->n_blocks == 4
+            && blocks->block[0].n_data_codewords == 11 && blocks->block[3].n_data_codewords == 12
+            && blocks->block[0].codewords == blocks->codewords
+            && blocks->block[1].codewords == blocks->codewords + 33
+            && blocks->block[1].codewords[1] == 5
+            && blocks->block[2].codewords[11] == 44 && blocks->block[3].codewords[11] == 45
+            && blocks->block[0].codewords[11] == 46 && blocks->block[3].codewords[33] == 133;
+    free_blocks(blocks);
+    return ok;
+}
+
+
+// Test the correction of several blocks by multiple threads
+int test_get_message_bitstream_parallel() {
+    u_int8_t codewords[8][26];
+    struct block block[8];
+    for (unsigned int i = 0 ; i < 8 ; i++) {
+        memcpy(codewords[i], test_block, 26);
+        codewords[i][i] ^= 0x42;
+        block[i].codewords = codewords[i];
+        block[i].n_data_codewords = 16;
+        block[i].n_error_correction_codewords = 10;
+    }
+    struct blocks blocks = { block, 8, NULL };
+    struct thread_pool* pool = new_thread_pool(3);
+    if (pool == NULL) {
+        return 0;
+    }
+
+    struct bitstream* s;
+    if (SUCCESS != get_message_bitstream(&blocks, NULL, pool, &s)) {
+        free_thread_pool(pool);
+        return 0;
+    }
+    int ok = s->n_bytes == 8 * 16;
+    for (unsigned int i = 0 ; ok && i < 8 ; i++) {
+        ok = 0 == memcmp(s->bytes + 16 * i, test_block, 16);
+    }
+    free_bitstream(s);
+
+    // Now with a block that cannot be corrected
+    for (unsigned int i = 1 ; i < 26 ; i++) {
+        codewords[5][i] ^= i;
+    }
+    ok = ok && DECODING_ERROR == get_message_bitstream(&blocks, NULL, pool, &s);
+    free_thread_pool(pool);
+    return ok;
+}
+
+
+// Corrects blocks on a pool while only the calling thread has a log level
+// that prints something, so that the blocks corrected by the other threads
+// are only logged if these threads use the level of the calling thread
+int test_block_threads_log_level() {
+    // Enough blocks with errors for the other threads to take some
+    u_int8_t codewords[MAX_BLOCKS][26];
+    struct block block[MAX_BLOCKS];
+    for (unsigned int i = 0 ; i < MAX_BLOCKS ; i++) {
+        memcpy(codewords[i], test_block, 26);
+        for (unsigned int j = 0 ; j < 5 ; j++) {
+            codewords[i][j * 5] ^= 0x55;
+        }
+        block[i].codewords = codewords[i];
+        block[i].n_data_codewords = 16;
+        block[i].n_error_correction_codewords = 10;
+    }
+    struct blocks blocks = { block, MAX_BLOCKS, NULL };
+    struct thread_pool* pool = new_thread_pool(3);
+    FILE* log = tmpfile();
+    int saved_stderr = dup(2);
+    if (pool == NULL || log == NULL || saved_stderr < 0) {
+        return 0;
+    }
+
+    fflush(stderr);
+    dup2(fileno(log), 2);
+    set_log_level(NO_LOGS);
+    int previous = set_thread_log_level(GORY);
+    struct bitstream* s;
+    int res = get_message_bitstream(&blocks, NULL, pool, &s);
+    set_thread_log_level(previous);
+    set_log_level(ERRORS);
+    fflush(stderr);
+    dup2(saved_stderr, 2);
+    close(saved_stderr);
+    free_thread_pool(pool);
+    if (res == SUCCESS) {
+        free_bitstream(s);
+    }
+
+    static char text[1 << 20];
+    rewind(log);
+    size_t n = fread(text, 1, sizeof(text) - 1, log);
+    text[n] = '\0';
+    fclose(log);
+    unsigned int n_blocks_logged = 0;
+    for (char* p = text ; NULL != (p = strstr(p, "Applying error detection/correction to block")) ; p++) {
+        n_blocks_logged++;
+    }
+    return res == SUCCESS && n_blocks_logged == MAX_BLOCKS;
+}
+
+
 int test_bitstream() {
     struct bitstream* s = new_bitstream(4);
     if (s == NULL) {
@@ -494,6 +776,29 @@ int test_bitstream() {
 }
 
 
+int test_bitstream_peek_skip() {
+    struct bitstream* s = new_bitstream(12);
+    if (s == NULL) {
+        return 0;
+    }
+    for (unsigned int i = 0 ; i < 12 ; i++) {
+        s->bytes[i] = 0x11 * (i + 1);
+    }
+
+    int ok = 0x1 == peek_bits(s, 4) && 96 == remaining_bits(s);
+    skip_bits(s, 4);
+    ok = ok && 0x1223 == read_bits(s, 16);
+    skip_bits(s, 66);
+    ok = ok && 10 == remaining_bits(s);
+    ok = ok && 0x3 == peek_bits(s, 2) && 0x3CC == read_bits(s, 10);
+    skip_bits(s, 1);
+    ok = ok && 0 == remaining_bits(s) && 0 == peek_bits(s, 1);
+
+    free_bitstream(s);
+    return ok;
+}
+
+
 int test_decode_bitstream() {
     struct bitstream* s = new_bitstream(16);
     if (s == NULL) {
@@ -509,7 +814,7 @@ int test_decode_bitstream() {
     }
 
     int ok = 0 == memcmp(decoded, decoded_text, n);
-    free(decoded);
+    qr_free(decoded);
     return ok;
 }
 
@@ -529,7 +834,211 @@ int test_decode_bitstream_numeric() {
     }
 
     int ok = 0 == memcmp(decoded, decoded_numeric_example, n);
-    free(decoded);
+    qr_free(decoded);
+    return ok;
+}
+
+
+int test_decode_bitstream_in_buffer() {
+    struct bitstream* s = new_bitstream(18);
+    if (s == NULL) {
+        return 0;
+    }
+    memcpy(s->bytes, numeric_example, 18);
+
+    u_int8_t output[64];
+    int ok = BUFFER_TOO_SMALL == decode_bitstream_in_buffer(s, 1, output, get_max_decoded_size(18) - 1);
+    int n = decode_bitstream_in_buffer(s, 1, output, sizeof(output));
+    free_bitstream(s);
+
+    return ok && n == 8 && 0 == strcmp((char*)output, decoded_numeric_example)
+            && 46 == get_n_data_codewords(5, HIGH) && 2956 == get_n_data_codewords(40, LOW);
+}
+
+
+/**
+ * Appends the n lowest bits of the given value to the given zeroed bytes.
+ */
+static void append_bits(u_int8_t* bytes, unsigned int *n_bits, unsigned int value, unsigned int n) {
+    for (unsigned int i = n ; i > 0 ; i--) {
+        if ((value >> (i - 1)) & 1) {
+            bytes[(*n_bits) / 8] |= 0x80 >> ((*n_bits) % 8);
+        }
+        (*n_bits)++;
+    }
+}
+
+
+/**
+ * Creates a version 1 stream made of an ECI designator followed by a byte
+ * segment that repeats the given byte as much as possible.
+ */
+static struct bitstream* new_byte_segment_stream(unsigned int eci, u_int8_t byte, unsigned int count) {
+    struct bitstream* s = new_bitstream(3 + count);
+    if (s == NULL) {
+        return NULL;
+    }
+    unsigned int n_bits = 0;
+    append_bits(s->bytes, &n_bits, 7, 4);
+    append_bits(s->bytes, &n_bits, eci, 8);
+    append_bits(s->bytes, &n_bits, 4, 4);
+    append_bits(s->bytes, &n_bits, count, 8);
+    for (unsigned int i = 0 ; i < count ; i++) {
+        append_bits(s->bytes, &n_bits, byte, 8);
+    }
+    return s;
+}
+
+
+/**
+ * Decodes the given version 1 stream into a growing buffer and into a buffer
+ * of get_max_decoded_size() bytes, and checks that both give the expected
+ * number of bytes, whose first character is the given one.
+ */
+static int check_max_decoded_size(struct bitstream* s, unsigned int expected_size, const char* first_char) {
+    u_int8_t* decoded;
+    int n1 = decode_bitstream(s, 1, &decoded);
+    if (n1 < 0) {
+        return 0;
+    }
+    unsigned int capacity = get_max_decoded_size(s->n_bytes);
+    u_int8_t* output = (u_int8_t*)malloc(capacity);
+    if (output == NULL) {
+        qr_free(decoded);
+        return 0;
+    }
+    init_bitstream(s, s->bytes, s->n_bytes);
+    int n2 = decode_bitstream_in_buffer(s, 1, output, capacity);
+
+    int ok = n1 == (int)expected_size && n2 == n1 && 0 == memcmp(output, decoded, n1 + 1)
+            && 0 == memcmp(decoded, first_char, strlen(first_char));
+    free(output);
+    qr_free(decoded);
+    return ok;
+}
+
+
+// A Cp437 byte segment full of box-drawing characters, that all take 3 utf8 bytes
+int test_max_decoded_size_cp437() {
+    struct bitstream* s = new_byte_segment_stream(2, 0xC9, 252);
+    if (s == NULL) {
+        return 0;
+    }
+    int ok = check_max_decoded_size(s, 3 * 252, "\xe2\x95\x94");
+    free_bitstream(s);
+    return ok;
+}
+
+
+// A Shift JIS byte segment full of half-width katakana, that all take 3 utf8 bytes
+int test_max_decoded_size_half_width_katakana() {
+    struct bitstream* s = new_byte_segment_stream(20, 0xB1, 252);
+    if (s == NULL) {
+        return 0;
+    }
+    int ok = check_max_decoded_size(s, 3 * 252, "\xef\xbd\xb1");
+    free_bitstream(s);
+    return ok;
+}
+
+
+// A numeric segment with as many digits as possible, 3 of them every 10 bits
+int test_max_decoded_size_numeric() {
+    struct bitstream* s = new_bitstream(418);
+    if (s == NULL) {
+        return 0;
+    }
+    unsigned int n_bits = 0;
+    append_bits(s->bytes, &n_bits, 1, 4);
+    append_bits(s->bytes, &n_bits, 999, 10);
+    for (unsigned int i = 0 ; i < 333 ; i++) {
+        append_bits(s->bytes, &n_bits, 123, 10);
+    }
+    int ok = check_max_decoded_size(s, 999, "123123");
+    free_bitstream(s);
+    return ok;
+}
+
+
+// Test with "AC-42" encoded as an alphanumeric segment followed by "1234567"
+// encoded as a numeric segment, so that both segments end with a single character
+int test_decode_bitstream_alphanumeric_numeric() {
+    u_int8_t data[] = { 0x20, 0x29, 0xce, 0xe7, 0x21, 0x08, 0x0e, 0x3d, 0xb9, 0x0e, 0x00 };
+    struct bitstream* s = new_bitstream(sizeof(data));
+    if (s == NULL) {
+        return 0;
+    }
+    memcpy(s->bytes, data, sizeof(data));
+
+    u_int8_t* decoded;
+    int n = decode_bitstream(s, 1, &decoded);
+    free_bitstream(s);
+    if (n < 0) {
+        return 0;
+    }
+
+    int ok = n == 12 && 0 == memcmp(decoded, "AC-421234567", n + 1);
+    qr_free(decoded);
+    return ok;
+}
+
+
+// Test with "Grüße aus Köln, 2024!" encoded as an ISO-8859-1 byte segment
+// followed by the utf8 bytes of "日本" in a byte segment with the UTF-8 ECI
+int test_decode_bitstream_latin1_utf8() {
+    u_int8_t data[] = {
+        0x41, 0x54, 0x77, 0x2f, 0xcd, 0xf6, 0x52, 0x06, 0x17, 0x57, 0x32, 0x04, 0xbf, 0x66, 0xc6, 0xe2,
+        0xc2, 0x03, 0x23, 0x03, 0x23, 0x42, 0x17, 0x1a, 0x40, 0x6e, 0x69, 0x7a, 0x5e, 0x69, 0xca, 0xc0
+    };
+    u_int8_t expected[] = {
+        0x47, 0x72, 0xc3, 0xbc, 0xc3, 0x9f, 0x65, 0x20, 0x61, 0x75, 0x73, 0x20, 0x4b, 0xc3, 0xb6, 0x6c,
+        0x6e, 0x2c, 0x20, 0x32, 0x30, 0x32, 0x34, 0x21, 0xe6, 0x97, 0xa5, 0xe6, 0x9c, 0xac
+    };
+    struct bitstream* s = new_bitstream(sizeof(data));
+    if (s == NULL) {
+        return 0;
+    }
+    memcpy(s->bytes, data, sizeof(data));
+
+    u_int8_t* decoded;
+    int n = decode_bitstream(s, 1, &decoded);
+    free_bitstream(s);
+    if (n < 0) {
+        return 0;
+    }
+
+    int ok = n == sizeof(expected) && 0 == memcmp(decoded, expected, n);
+    qr_free(decoded);
+    return ok;
+}
+
+
+// Test with "Καλημέρα" encoded with the ISO-8859-7 ECI followed by
+// "╔═╗ ok" encoded with the Cp437 ECI
+int test_decode_bitstream_single_byte_charsets() {
+    u_int8_t data[] = {
+        0x70, 0x94, 0x08, 0xca, 0xe1, 0xeb, 0xe7, 0xec, 0xdd, 0xf1, 0xe1, 0x70, 0x24, 0x06, 0xc9, 0xcd,
+        0xbb, 0x20, 0x6f, 0x6b, 0x00
+    };
+    u_int8_t expected[] = {
+        0xce, 0x9a, 0xce, 0xb1, 0xce, 0xbb, 0xce, 0xb7, 0xce, 0xbc, 0xce, 0xad, 0xcf, 0x81, 0xce, 0xb1,
+        0xe2, 0x95, 0x94, 0xe2, 0x95, 0x90, 0xe2, 0x95, 0x97, 0x20, 0x6f, 0x6b
+    };
+    struct bitstream* s = new_bitstream(sizeof(data));
+    if (s == NULL) {
+        return 0;
+    }
+    memcpy(s->bytes, data, sizeof(data));
+
+    u_int8_t* decoded;
+    int n = decode_bitstream(s, 1, &decoded);
+    free_bitstream(s);
+    if (n < 0) {
+        return 0;
+    }
+
+    int ok = n == sizeof(expected) && 0 == memcmp(decoded, expected, n);
+    qr_free(decoded);
     return ok;
 }
 
@@ -549,7 +1058,7 @@ int test_decode_bitstream_kanji() {
     }
 
     int ok = 0 == memcmp(decoded, decoded_kanji_example, n);
-    free(decoded);
+    qr_free(decoded);
     return ok;
 }
 
@@ -574,6 +1083,29 @@ int test_decode_bitstream_gb18030() {
 }
 
 
+// Test with 4-byte GB18030 sequences for U+00A5 and U+20000
+int test_decode_gb18030_four_bytes() {
+    u_int8_t data[] = { 0x81, 0x30, 0x84, 0x36, 0x95, 0x32, 0x82, 0x36 };
+    u_int8_t expected[] = { 0xc2, 0xa5, 0xf0, 0xa0, 0x80, 0x80 };
+    struct bitstream* s = new_bitstream(sizeof(data));
+    if (s == NULL) {
+        return 0;
+    }
+    memcpy(s->bytes, data, sizeof(data));
+
+    struct bytebuffer* buffer = new_bytebuffer();
+    if (buffer == NULL) {
+        free_bitstream(s);
+        return 0;
+    }
+    int ok = SUCCESS == decode_gb18030_segment(s, sizeof(data), buffer)
+            && buffer->n_bytes == sizeof(expected) && 0 == memcmp(buffer->bytes, expected, sizeof(expected));
+    free_bitstream(s);
+    free_bytebuffer(buffer);
+    return ok;
+}
+
+
 int test_decode_bitstream_big5() {
     struct bitstream* s = new_bitstream(22);
     if (s == NULL) {
@@ -733,9 +1265,629 @@ int test_decode_percents_in_FNC1_mode() {
 
 typedef int (*test)();
 
+int test_arena() {
+    struct arena* arena = new_arena();
+    if (arena == NULL) {
+        return 0;
+    }
+    int ok = 1;
+    u_int8_t* first = NULL;
+    for (int pass = 0 ; ok && pass < 2 ; pass++) {
+        // Enough blocks to need several chunks, plus one larger than a chunk
+        for (int i = 0 ; ok && i < 2000 ; i++) {
+            u_int8_t* block = (u_int8_t*)arena_alloc(arena, 1 + i % 40);
+            ok = block != NULL && ((uintptr_t)block % 8) == 0;
+            if (ok) {
+                memset(block, i, 1 + i % 40);
+            }
+            if (i == 0) {
+                // After a reset, the memory must be reused from the start
+                ok = ok && (pass == 0 || block == first);
+                first = block;
+            }
+        }
+        u_int8_t* big = (u_int8_t*)arena_alloc(arena, 100000);
+        ok = ok && big != NULL;
+        if (ok) {
+            memset(big, 0xFF, 100000);
+        }
+        reset_arena(arena);
+    }
+    free_arena(arena);
+    return ok;
+}
+
+
+/**
+ * Returns 1 if the given match lists contain the same messages at the same
+ * positions; 0 otherwise.
+ */
+static int same_matches(struct qr_code_match_list* a, struct qr_code_match_list* b) {
+    while (a != NULL && b != NULL) {
+        if (a->message->n_bytes != b->message->n_bytes
+            || 0 != memcmp(a->message->bytes, b->message->bytes, a->message->n_bytes)
+            || a->top_left_x != b->top_left_x || a->top_left_y != b->top_left_y
+            || a->bottom_right_x != b->bottom_right_x || a->bottom_right_y != b->bottom_right_y) {
+            return 0;
+        }
+        a = a->next;
+        b = b->next;
+    }
+    return a == NULL && b == NULL;
+}
+
+
+// Decodes images of different sizes with the same decoder, so
+// that its buffers have to be enlarged and then reused
+int test_decoder_reuse() {
+    const char* images[] = { "images/QR-v1.png", "images/QR-v40.png", "images/kanji.png", "images/QR-v1.png" };
+    struct qr_decoder* decoder = new_qr_decoder();
+    if (decoder == NULL) {
+        return 0;
+    }
+    int ok = 1;
+    for (unsigned int i = 0 ; ok && i < sizeof(images) / sizeof(images[0]) ; i++) {
+        struct qr_code_match_list* expected;
+        struct qr_code_match_list* actual;
+        int res1 = find_qr_codes(images[i], &expected, NULL);
+        int res2 = find_qr_codes_with_decoder(decoder, images[i], &actual, NULL);
+        ok = res1 == SUCCESS && res2 == SUCCESS && same_matches(expected, actual);
+        free_qr_code_match_list(expected);
+        free_qr_code_match_list(actual);
+    }
+    free_qr_decoder(decoder);
+    return ok;
+}
+
+
+// The images decoded concurrently by the thread safety test
+static const char* corpus[] = {
+    "images/225x225.png", "images/QR-v1.png", "images/QR-v10.png", "images/QR-v2.png",
+    "images/QR-v25.png", "images/QR-v3.png", "images/QR-v4.png", "images/QR-v40.png",
+    "images/iso-8859-1.png", "images/kanji.png", "images/kino.png", "images/numeric.png",
+    "images/shift-jis.png", "images/structured-append-1.png", "images/structured-append-2.png",
+    "images/structured-append-3.png", "images/structured-append-4.png", "images/test.png",
+    "example.png"
+};
+
+#define CORPUS_SIZE (sizeof(corpus) / sizeof(corpus[0]))
+#define N_DECODING_THREADS 4
+#define N_PASSES 3
+
+
+/**
+ * The reference results the threads compare their own results to.
+ */
+struct corpus_results {
+    int res[CORPUS_SIZE];
+    struct qr_code_match_list* matches[CORPUS_SIZE];
+    int ok;
+};
+
+
+/**
+ * Decodes the whole corpus several times with a decoder of its
+ * own and checks that the results match the reference ones.
+ */
+static void* decode_corpus(void* data) {
+    struct corpus_results* job = (struct corpus_results*)data;
+    struct qr_decoder* decoder = new_qr_decoder();
+    if (decoder == NULL) {
+        return NULL;
+    }
+    set_decoder_log_level(decoder, NO_LOGS);
+    int ok = 1;
+    for (unsigned int pass = 0 ; ok && pass < N_PASSES ; pass++) {
+        for (unsigned int i = 0 ; ok && i < CORPUS_SIZE ; i++) {
+            struct qr_code_match_list* matches;
+            int res = find_qr_codes_with_decoder(decoder, corpus[i], &matches, NULL);
+            ok = res == job->res[i] && same_matches(matches, job->matches[i]);
+            free_qr_code_match_list(matches);
+        }
+    }
+    free_qr_decoder(decoder);
+    job->ok = ok;
+    return NULL;
+}
+
+
+int test_concurrent_decoding() {
+    struct corpus_results reference;
+    unsigned int n_decoded = 0;
+    for (unsigned int i = 0 ; i < CORPUS_SIZE ; i++) {
+        reference.res[i] = find_qr_codes(corpus[i], &(reference.matches[i]), NULL);
+        n_decoded += (reference.res[i] == SUCCESS);
+    }
+
+    struct corpus_results jobs[N_DECODING_THREADS];
+    pthread_t threads[N_DECODING_THREADS];
+    unsigned int n_started = 0;
+    int ok = n_decoded > 0;
+    for ( ; n_started < N_DECODING_THREADS ; n_started++) {
+        jobs[n_started] = reference;
+        jobs[n_started].ok = 0;
+        if (0 != pthread_create(&(threads[n_started]), NULL, decode_corpus, &(jobs[n_started]))) {
+            ok = 0;
+            break;
+        }
+    }
+    for (unsigned int i = 0 ; i < n_started ; i++) {
+        pthread_join(threads[i], NULL);
+        ok = ok && jobs[i].ok;
+    }
+
+    for (unsigned int i = 0 ; i < CORPUS_SIZE ; i++) {
+        free_qr_code_match_list(reference.matches[i]);
+    }
+    return ok;
+}
+
+
+// Decodes the corpus with the candidates of each image spread over several
+// threads, which must give exactly the same results as a single thread. The
+// number of threads changes halfway so that the pool has to be recreated
+int test_parallel_candidates() {
+    struct qr_decoder* decoder = new_qr_decoder();
+    if (decoder == NULL) {
+        return 0;
+    }
+    set_decoder_n_threads(decoder, 4);
+    int ok = 1;
+    for (unsigned int i = 0 ; ok && i < CORPUS_SIZE ; i++) {
+        if (i == CORPUS_SIZE / 2) {
+            set_decoder_n_threads(decoder, 3);
+        }
+        struct qr_code_match_list* expected;
+        struct qr_code_match_list* actual;
+        int res1 = find_qr_codes(corpus[i], &expected, NULL);
+        int res2 = find_qr_codes_with_decoder(decoder, corpus[i], &actual, NULL);
+        ok = res1 == res2 && same_matches(expected, actual);
+        free_qr_code_match_list(expected);
+        free_qr_code_match_list(actual);
+    }
+    free_qr_decoder(decoder);
+    return ok;
+}
+
+
+// Decodes the corpus with the blocks of each QR code corrected by a pool
+// of threads, changing its size halfway so that it has to be recreated
+int test_parallel_blocks() {
+    struct qr_decoder* decoder = new_qr_decoder();
+    if (decoder == NULL) {
+        return 0;
+    }
+    set_decoder_n_block_threads(decoder, 4);
+    int ok = 1;
+    for (unsigned int i = 0 ; ok && i < CORPUS_SIZE ; i++) {
+        if (i == CORPUS_SIZE / 2) {
+            set_decoder_n_block_threads(decoder, 3);
+        }
+        struct qr_code_match_list* expected;
+        struct qr_code_match_list* actual;
+        int res1 = find_qr_codes(corpus[i], &expected, NULL);
+        int res2 = find_qr_codes_with_decoder(decoder, corpus[i], &actual, NULL);
+        ok = res1 == res2 && same_matches(expected, actual);
+        free_qr_code_match_list(expected);
+        free_qr_code_match_list(actual);
+    }
+    free_qr_decoder(decoder);
+    return ok;
+}
+
+
+/**
+ * Counts the results received by the batch callback.
+ */
+struct batch_callback_data {
+    pthread_mutex_t lock;
+    unsigned int n_results;
+    unsigned int n_successes;
+};
+
+
+static void count_batch_result(unsigned int index, struct qr_batch_result result, void* data) {
+    (void)index;
+    struct batch_callback_data* counts = (struct batch_callback_data*)data;
+    pthread_mutex_lock(&(counts->lock));
+    counts->n_results++;
+    counts->n_successes += (result.res == SUCCESS);
+    pthread_mutex_unlock(&(counts->lock));
+    free_qr_code_match_list(result.matches);
+}
+
+
+int test_batch() {
+    struct qr_batch_input inputs[CORPUS_SIZE];
+    struct qr_batch_result expected[CORPUS_SIZE];
+    unsigned int n_successes = 0;
+    for (unsigned int i = 0 ; i < CORPUS_SIZE ; i++) {
+        inputs[i].png = corpus[i];
+        inputs[i].image = NULL;
+        expected[i].res = find_qr_codes(corpus[i], &(expected[i].matches), NULL);
+        n_successes += (expected[i].res == SUCCESS);
+    }
+
+    // The results must come in input order
+    struct qr_batch_result results[CORPUS_SIZE];
+    int ok = SUCCESS == find_qr_codes_in_batch(inputs, CORPUS_SIZE, 3, results);
+    for (unsigned int i = 0 ; i < CORPUS_SIZE ; i++) {
+        ok = ok && results[i].res == expected[i].res && same_matches(results[i].matches, expected[i].matches);
+        free_qr_code_match_list(results[i].matches);
+        free_qr_code_match_list(expected[i].matches);
+    }
+
+    struct batch_callback_data counts;
+    counts.n_results = 0;
+    counts.n_successes = 0;
+    pthread_mutex_init(&(counts.lock), NULL);
+    ok = ok && SUCCESS == find_qr_codes_in_batch_with_callback(inputs, CORPUS_SIZE, 3, count_batch_result, &counts);
+    pthread_mutex_destroy(&(counts.lock));
+
+    return ok && counts.n_results == CORPUS_SIZE && counts.n_successes == n_successes;
+}
+
+
+// Submits the corpus through a small queue without ever blocking, waiting
+// on the result file descriptor when the queue is full, like an event loop would
+int test_async_decoding() {
+    struct rgb_image* images[CORPUS_SIZE];
+    int expected[CORPUS_SIZE];
+    struct qr_code_match_list* expected_matches[CORPUS_SIZE];
+    int ok = 1;
+    for (unsigned int i = 0 ; i < CORPUS_SIZE ; i++) {
+        expected[i] = find_qr_codes(corpus[i], &(expected_matches[i]), NULL);
+        if (SUCCESS != load_rgb_image(corpus[i], &(images[i]))) {
+            images[i] = NULL;
+            ok = 0;
+        }
+    }
+
+    struct qr_async_decoder* decoder = new_qr_async_decoder(3, 4, NULL, NULL);
+    ok = ok && decoder != NULL;
+    unsigned int n_submitted = 0;
+    unsigned int n_received = 0;
+    unsigned int n_would_block = 0;
+    while (ok && n_received < CORPUS_SIZE) {
+        if (n_submitted < CORPUS_SIZE) {
+            int res = submit_qr_image(decoder, images[n_submitted], corpus + n_submitted, 0);
+            if (res == SUCCESS) {
+                n_submitted++;
+                continue;
+            }
+            n_would_block++;
+        }
+        struct pollfd fd = { get_qr_result_fd(decoder), POLLIN, 0 };
+        ok = 1 == poll(&fd, 1, -1);
+
+        struct qr_async_result result;
+        while (ok && SUCCESS == poll_qr_result(decoder, &result, 0)) {
+            unsigned int i = (const char**)result.tag - corpus;
+            ok = result.image == images[i] && result.res == expected[i]
+                && same_matches(result.matches, expected_matches[i]);
+            free_qr_code_match_list(result.matches);
+            n_received++;
+        }
+    }
+    if (decoder != NULL) {
+        free_qr_async_decoder(decoder);
+    }
+
+    for (unsigned int i = 0 ; i < CORPUS_SIZE ; i++) {
+        if (images[i] != NULL) {
+            free_rgb_image(images[i]);
+        }
+        free_qr_code_match_list(expected_matches[i]);
+    }
+    return ok && n_would_block > 0;
+}
+
+
+/**
+ * What the pipeline callback compares the results it receives to.
+ */
+struct pipeline_check {
+    int expected[CORPUS_SIZE];
+    struct qr_code_match_list* expected_matches[CORPUS_SIZE];
+    unsigned int n_received;
+    int ok;
+};
+
+
+static void check_pipeline_result(struct qr_async_result result, void* data) {
+    struct pipeline_check* check = (struct pipeline_check*)data;
+    // The frames must come out in the order they went in
+    unsigned int i = (const char**)result.tag - corpus;
+    check->ok = check->ok && i == check->n_received % CORPUS_SIZE && result.res == check->expected[i]
+                && same_matches(result.matches, check->expected_matches[i]);
+    check->n_received++;
+    free_qr_code_match_list(result.matches);
+}
+
+
+// Streams the corpus twice through a pipeline that has fewer
+// frame buffers than images, so that they have to be recycled
+int test_pipeline() {
+    struct rgb_image* images[CORPUS_SIZE];
+    struct pipeline_check check;
+    check.n_received = 0;
+    check.ok = 1;
+    for (unsigned int i = 0 ; i < CORPUS_SIZE ; i++) {
+        check.expected[i] = find_qr_codes(corpus[i], &(check.expected_matches[i]), NULL);
+        if (SUCCESS != load_rgb_image(corpus[i], &(images[i]))) {
+            images[i] = NULL;
+            check.ok = 0;
+        }
+    }
+
+    struct qr_pipeline* pipeline = check.ok ? new_qr_pipeline(4, check_pipeline_result, &check) : NULL;
+    int ok = pipeline != NULL;
+    for (unsigned int pass = 0 ; ok && pass < 2 ; pass++) {
+        for (unsigned int i = 0 ; ok && i < CORPUS_SIZE ; i++) {
+            ok = SUCCESS == push_qr_frame(pipeline, images[i], corpus + i, 1);
+        }
+    }
+    if (pipeline != NULL) {
+        free_qr_pipeline(pipeline);
+    }
+
+    for (unsigned int i = 0 ; i < CORPUS_SIZE ; i++) {
+        if (images[i] != NULL) {
+            free_rgb_image(images[i]);
+        }
+        free_qr_code_match_list(check.expected_matches[i]);
+    }
+    return ok && check.ok && check.n_received == 2 * CORPUS_SIZE;
+}
+
+
+// The frame in which the tracker test moves a QR code around
+#define FRAME_SIZE 480
+
+
+/**
+ * Draws the given image into a white frame at the given position.
+ */
+static void draw_in_frame(struct rgb_image* img, struct rgb_image* frame, unsigned int x, unsigned int y) {
+    memset(frame->buffer, 0xFF, frame->width * frame->height * 3);
+    for (unsigned int i = 0 ; i < img->height ; i++) {
+        memcpy(frame->buffer + ((y + i) * frame->width + x) * 3, img->buffer + i * img->width * 3, img->width * 3);
+    }
+}
+
+
+// Follows a QR code that moves a little from one frame to the next before
+// jumping to the other side of the frame, which must give the same results
+// as analyzing every frame as a whole
+int test_tracker() {
+    unsigned int positions[][2] = { { 10, 10 }, { 14, 12 }, { 18, 14 }, { 250, 240 }, { 252, 244 } };
+    unsigned int n_frames = sizeof(positions) / sizeof(positions[0]);
+    u_int8_t buffer[FRAME_SIZE * FRAME_SIZE * 3];
+    struct rgb_image frame = { FRAME_SIZE, FRAME_SIZE, buffer };
+    struct rgb_image* img;
+    if (SUCCESS != load_rgb_image("images/QR-v3.png", &img)) {
+        return 0;
+    }
+    struct qr_decoder* decoder = new_qr_decoder();
+    struct qr_tracker* tracker = new_qr_tracker(10);
+    int ok = decoder != NULL && tracker != NULL;
+    for (unsigned int i = 0 ; ok && i < n_frames ; i++) {
+        draw_in_frame(img, &frame, positions[i][0], positions[i][1]);
+        struct qr_code_match_list* expected;
+        struct qr_code_match_list* actual;
+        int res1 = find_qr_codes_in_rgb_image(decoder, &frame, &expected, NULL);
+        int res2 = track_qr_codes(tracker, decoder, &frame, &actual);
+        ok = res1 == SUCCESS && res2 == SUCCESS && same_matches(expected, actual);
+        free_qr_code_match_list(expected);
+        free_qr_code_match_list(actual);
+    }
+
+    // The whole frame must only have been analyzed for the
+    // first frame and when the QR code was lost
+    ok = ok && get_n_full_scans(tracker) == 2;
+    if (tracker != NULL) {
+        free_qr_tracker(tracker);
+    }
+    if (decoder != NULL) {
+        free_qr_decoder(decoder);
+    }
+    free_rgb_image(img);
+    return ok;
+}
+
+
+// Decodes the corpus twice with a cache large enough to remember all
+// the QR codes and with one that has to keep evicting them, which
+// must not change the results
+int test_result_cache() {
+    unsigned int capacities[] = { 64, 1 };
+    struct qr_decoder* decoder = new_qr_decoder();
+    if (decoder == NULL) {
+        return 0;
+    }
+    int ok = 1;
+    for (unsigned int c = 0 ; ok && c < 2 ; c++) {
+        struct qr_result_cache* cache = new_qr_result_cache(capacities[c]);
+        if (cache == NULL) {
+            ok = 0;
+            break;
+        }
+        set_decoder_result_cache(decoder, cache);
+        unsigned int n_codes = 0;
+        for (unsigned int pass = 0 ; ok && pass < 2 ; pass++) {
+            for (unsigned int i = 0 ; ok && i < CORPUS_SIZE ; i++) {
+                struct qr_code_match_list* expected;
+                struct qr_code_match_list* actual;
+                int res1 = find_qr_codes(corpus[i], &expected, NULL);
+                int res2 = find_qr_codes_with_decoder(decoder, corpus[i], &actual, NULL);
+                ok = res1 == res2 && same_matches(expected, actual);
+                for (struct qr_code_match_list* m = expected ; pass == 1 && m != NULL ; m = m->next) {
+                    n_codes++;
+                }
+                free_qr_code_match_list(expected);
+                free_qr_code_match_list(actual);
+            }
+        }
+        unsigned long n_hits;
+        unsigned long n_misses;
+        get_qr_result_cache_stats(cache, &n_hits, &n_misses);
+        // With a large enough cache, every QR code of the second pass is a hit
+        ok = ok && (capacities[c] == 1 || n_hits >= n_codes) && n_misses > 0;
+        set_decoder_result_cache(decoder, NULL);
+        free_qr_result_cache(cache);
+    }
+    free_qr_decoder(decoder);
+    return ok;
+}
+
+
+/**
+ * The counters of the allocator used to check that the
+ * library uses the allocator it is given.
+ */
+struct allocation_counters {
+    unsigned int n_allocations;
+    unsigned int n_releases;
+};
+
+
+static void* counting_allocate(size_t size, void* data) {
+    ((struct allocation_counters*)data)->n_allocations++;
+    return malloc(size);
+}
+
+
+static void* counting_reallocate(void* ptr, size_t size, void* data) {
+    if (ptr == NULL) {
+        ((struct allocation_counters*)data)->n_allocations++;
+    }
+    return realloc(ptr, size);
+}
+
+
+static void counting_release(void* ptr, void* data) {
+    ((struct allocation_counters*)data)->n_releases++;
+    free(ptr);
+}
+
+
+int test_allocator() {
+    struct allocation_counters counters = { 0, 0 };
+    struct qr_allocator allocator = { counting_allocate, counting_reallocate, counting_release, &counters };
+    qr_set_allocator(&allocator);
+
+    struct qr_code_match_list* matches;
+    int res = find_qr_codes("images/QR-v2.png", &matches, NULL);
+    int ok = res == SUCCESS && counters.n_allocations > 0 && counters.n_releases < counters.n_allocations;
+    if (res == SUCCESS) {
+        free_qr_code_match_list(matches);
+    }
+    qr_set_allocator(NULL);
+
+    // Once the results are freed, everything must have been released
+    return ok && counters.n_releases == counters.n_allocations;
+}
+
+
+// The modules of images/QR-v1.png, that encodes "Ver1" with high error correction level
+static const char* qr_v1_modules[] = {
+    "*******   **  *******",
+    "*     * *   * *     *",
+    "* *** * *   * * *** *",
+    "* *** * *   * * *** *",
+    "* *** * * *** * *** *",
+    "*     * * *   *     *",
+    "******* * * * *******",
+    "                     ",
+    "  *  ******* * ***** ",
+    "   *** ****** *  *  *",
+    "** ** **  * * *   * *",
+    " ***    *  * *  **  *",
+    "***   **  ****      *",
+    "        **  ** *   * ",
+    "******* ****** ***  *",
+    "*     * **  * **     ",
+    "* *** *   *  * **   *",
+    "* *** *    ****      ",
+    "* *** * **   **   ***",
+    "*     *  ** * * *    ",
+    "*******   **  *  ** *",
+    NULL
+};
+
+
+int test_find_qr_code() {
+    struct bit_matrix* matrix;
+    if (SUCCESS != create_from_string(qr_v1_modules, &matrix)) {
+        return 0;
+    }
+    struct bit_matrix* uncertain_modules = create_bit_matrix(21, 21);
+    if (uncertain_modules == NULL) {
+        free_bit_matrix(matrix);
+        return 0;
+    }
+
+    // Let's damage the 12 codewords of the bottom right corner, which is more
+    // than the 8 errors that can be corrected, and flag them as uncertain
+    for (unsigned int y = 9 ; y < 21 ; y++) {
+        for (unsigned int x = 13 ; x < 21 ; x++) {
+            set_color(matrix, !is_black(matrix, x, y), x, y);
+            set_color(uncertain_modules, 1, x, y);
+        }
+    }
+
+    struct bytebuffer* code1 = NULL;
+    struct bytebuffer* code2 = NULL;
+    int res1 = find_qr_code(matrix, &code1);
+    int res2 = find_qr_code_with_uncertain_modules(matrix, uncertain_modules, &code2);
+    int ok = res1 == DECODING_ERROR && res2 == SUCCESS && 0 == strcmp((char*)code2->bytes, "Ver1");
+    if (res1 == SUCCESS) {
+        free_bytebuffer(code1);
+    }
+    if (res2 == SUCCESS) {
+        free_bytebuffer(code2);
+    }
+    free_bit_matrix(uncertain_modules);
+    free_bit_matrix(matrix);
+    return ok;
+}
+
+
+int test_find_qr_code_in_buffer_with_decoder() {
+    struct bit_matrix* matrix;
+    if (SUCCESS != create_from_string(qr_v1_modules, &matrix)) {
+        return 0;
+    }
+    struct qr_decoder* decoder = new_qr_decoder();
+    if (decoder == NULL) {
+        free_bit_matrix(matrix);
+        return 0;
+    }
+
+    struct allocation_counters counters = { 0, 0 };
+    struct qr_allocator allocator = { counting_allocate, counting_reallocate, counting_release, &counters };
+    qr_set_allocator(&allocator);
+
+    // The first QR code of a version creates the codeword mask,
+    // after what the decoder's buffers are enough
+    u_int8_t message[32];
+    int n1 = find_qr_code_in_buffer_with_decoder(decoder, matrix, NULL, message, sizeof(message));
+    unsigned int n_first_allocations = counters.n_allocations;
+    int n2 = find_qr_code_in_buffer_with_decoder(decoder, matrix, NULL, message, sizeof(message));
+    unsigned int n_second_allocations = counters.n_allocations - n_first_allocations;
+    qr_set_allocator(NULL);
+
+    free_qr_decoder(decoder);
+    free_bit_matrix(matrix);
+    return n1 == 4 && n2 == 4 && 0 == strcmp((char*)message, "Ver1")
+            && n_first_allocations > 0 && n_second_allocations == 0;
+}
+
+
 int main() {
     printf("Running tests...\n");
     test tests[] = {
+        test_galois_field,
         test_reed_solomon1,
         test_reed_solomon2,
         test_get_degree,
@@ -748,18 +1900,36 @@ int main() {
         test_multiply_by_monomial,
         test_divide_polynomials,
         test_divide_polynomials2,
+        test_syndrome_kernels,
         test_calculate_sigma_omega,
+        test_calculate_sigma_omega_berlekamp_massey,
         test_find_error_locations,
         test_find_error_magnitudes,
         test_error_correction,
         test_error_correction2,
         test_error_correction3,
         test_error_correction4,
+        test_error_correction_euclid,
+        test_error_correction_with_erasures,
+        test_error_correction_with_all_erasures,
+        test_error_correction_with_wasted_erasures,
+        test_get_blocks,
+        test_get_message_bitstream_parallel,
+        test_block_threads_log_level,
         test_bitstream,
+        test_bitstream_peek_skip,
         test_decode_bitstream,
         test_decode_bitstream_numeric,
+        test_decode_bitstream_alphanumeric_numeric,
+        test_decode_bitstream_in_buffer,
+        test_max_decoded_size_cp437,
+        test_max_decoded_size_half_width_katakana,
+        test_max_decoded_size_numeric,
+        test_decode_bitstream_latin1_utf8,
+        test_decode_bitstream_single_byte_charsets,
         test_decode_bitstream_kanji,
         test_decode_bitstream_gb18030,
+        test_decode_gb18030_four_bytes,
         test_decode_bitstream_big5,
         test_decode_bitstream_euc_kr,
         test_decode_bitstream_chinese_shift_jis,
@@ -767,6 +1937,19 @@ int main() {
         test_decode_eci_designator2,
         test_decode_eci_designator3,
         test_decode_percents_in_FNC1_mode,
+        test_arena,
+        test_decoder_reuse,
+        test_concurrent_decoding,
+        test_batch,
+        test_async_decoding,
+        test_pipeline,
+        test_tracker,
+        test_result_cache,
+        test_parallel_candidates,
+        test_parallel_blocks,
+        test_allocator,
+        test_find_qr_code,
+        test_find_qr_code_in_buffer_with_decoder,
         NULL
     };
     int total = 0;
@@ -0,0 +1,132 @@
+#include <pthread.h>
+#include "allocator.h"
+#include "threadpool.h"
+
+// We don't want to start an absurd number of threads
+// if the caller asks for it
+#define MAX_POOL_THREADS 64
+
+
+struct thread_pool {
+    // Protects all the fields below
+    pthread_mutex_t lock;
+
+    // Signaled when a new task is started or when stopping
+    pthread_cond_t has_task;
+
+    // Signaled when the last worker is done with the current task
+    pthread_cond_t task_done;
+
+    // The current task, and a counter that is incremented
+    // for each new task so that the workers know when to run it
+    void* (*task)(void*);
+    void* data;
+    unsigned int generation;
+
+    // The number of workers that have not finished the current task
+    unsigned int n_busy;
+
+    // Set when the pool is being freed
+    int stopping;
+
+    pthread_t threads[MAX_POOL_THREADS];
+    unsigned int n_threads;
+};
+
+
+static void* run_worker(void* data) {
+    struct thread_pool* pool = (struct thread_pool*)data;
+    // The pool starts at generation 0, and a worker that starts late
+    // must still run the tasks started before it could wait for them
+    unsigned int generation = 0;
+    pthread_mutex_lock(&(pool->lock));
+    for (;;) {
+        while (pool->generation == generation && !pool->stopping) {
+            pthread_cond_wait(&(pool->has_task), &(pool->lock));
+        }
+        if (pool->stopping) {
+            break;
+        }
+        generation = pool->generation;
+        void* (*task)(void*) = pool->task;
+        void* task_data = pool->data;
+        pthread_mutex_unlock(&(pool->lock));
+
+        task(task_data);
+
+        pthread_mutex_lock(&(pool->lock));
+        if (--(pool->n_busy) == 0) {
+            pthread_cond_signal(&(pool->task_done));
+        }
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    return NULL;
+}
+
+
+struct thread_pool* new_thread_pool(unsigned int n_threads) {
+    if (n_threads > MAX_POOL_THREADS) {
+        n_threads = MAX_POOL_THREADS;
+    }
+    struct thread_pool* pool = (struct thread_pool*)qr_calloc(1, sizeof(struct thread_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    if (0 != pthread_mutex_init(&(pool->lock), NULL)) {
+        qr_free(pool);
+        return NULL;
+    }
+    if (0 != pthread_cond_init(&(pool->has_task), NULL)) {
+        pthread_mutex_destroy(&(pool->lock));
+        qr_free(pool);
+        return NULL;
+    }
+    if (0 != pthread_cond_init(&(pool->task_done), NULL)) {
+        pthread_cond_destroy(&(pool->has_task));
+        pthread_mutex_destroy(&(pool->lock));
+        qr_free(pool);
+        return NULL;
+    }
+    while (pool->n_threads < n_threads) {
+        if (0 != pthread_create(&(pool->threads[pool->n_threads]), NULL, run_worker, pool)) {
+            // If we cannot start more threads, the ones we have will do the job
+            break;
+        }
+        pool->n_threads++;
+    }
+    return pool;
+}
+
+
+void free_thread_pool(struct thread_pool* pool) {
+    pthread_mutex_lock(&(pool->lock));
+    pool->stopping = 1;
+    pthread_cond_broadcast(&(pool->has_task));
+    pthread_mutex_unlock(&(pool->lock));
+    for (unsigned int i = 0 ; i < pool->n_threads ; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&(pool->task_done));
+    pthread_cond_destroy(&(pool->has_task));
+    pthread_mutex_destroy(&(pool->lock));
+    qr_free(pool);
+}
+
+
+void run_in_thread_pool(struct thread_pool* pool, void* (*task)(void*), void* data) {
+    pthread_mutex_lock(&(pool->lock));
+    pool->task = task;
+    pool->data = data;
+    pool->generation++;
+    pool->n_busy = pool->n_threads;
+    pthread_cond_broadcast(&(pool->has_task));
+    pthread_mutex_unlock(&(pool->lock));
+
+    task(data);
+
+    pthread_mutex_lock(&(pool->lock));
+    while (pool->n_busy > 0) {
+        pthread_cond_wait(&(pool->task_done), &(pool->lock));
+    }
+    pthread_mutex_unlock(&(pool->lock));
+}
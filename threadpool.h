@@ -0,0 +1,36 @@
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+/**
+ * A thread pool keeps worker threads alive between tasks, so that splitting
+ * small amounts of work between threads, like correcting the blocks of a QR
+ * code, does not cost the creation of new threads every time.
+ */
+struct thread_pool;
+
+
+/**
+ * Creates a pool with the given number of worker threads, not counting the
+ * thread that will run the tasks. If some threads cannot be started, the
+ * pool works with the ones that could.
+ * Returns NULL in case of memory allocation error.
+ */
+struct thread_pool* new_thread_pool(unsigned int n_threads);
+
+
+/**
+ * Stops the threads and frees the pool.
+ */
+void free_thread_pool(struct thread_pool* pool);
+
+
+/**
+ * Calls task(data) once in each worker thread and once in the calling
+ * thread, and returns when all the calls have returned. The task is expected
+ * to share its work between the threads, for instance by taking the next item
+ * to process from a counter protected by a mutex. A pool must not be used
+ * by several threads at the same time.
+ */
+void run_in_thread_pool(struct thread_pool* pool, void* (*task)(void*), void* data);
+
+#endif
@@ -0,0 +1,198 @@
+#include <string.h>
+#include "allocator.h"
+#include "tracker.h"
+
+// The binarizer works on blocks of 8x8 pixels and needs
+// at least 5 of them in each direction
+#define BLOCK_SIZE 8
+#define MIN_REGION_SIZE (5 * BLOCK_SIZE)
+
+
+struct qr_tracker {
+    unsigned int full_scan_period;
+    unsigned int n_frames_since_full_scan;
+    unsigned int n_full_scans;
+
+    // The number of QR codes found in the previous frame
+    // and the box that contains all their corners
+    unsigned int n_codes;
+    int min_x, min_y;
+    int max_x, max_y;
+
+    // The part of the frame that is analyzed when
+    // the QR codes are being tracked
+    struct rgb_image region;
+    unsigned int region_capacity;
+};
+
+
+struct qr_tracker* new_qr_tracker(unsigned int full_scan_period) {
+    struct qr_tracker* tracker = (struct qr_tracker*)qr_calloc(1, sizeof(struct qr_tracker));
+    if (tracker == NULL) {
+        return NULL;
+    }
+    tracker->full_scan_period = full_scan_period;
+    return tracker;
+}
+
+
+void free_qr_tracker(struct qr_tracker* tracker) {
+    qr_free(tracker->region.buffer);
+    qr_free(tracker);
+}
+
+
+unsigned int get_n_full_scans(struct qr_tracker* tracker) {
+    return tracker->n_full_scans;
+}
+
+
+static int clamp(int value, int max) {
+    return value < 0 ? 0 : (value > max ? max : value);
+}
+
+
+static void update_box(struct qr_tracker* tracker, int x, int y) {
+    if (x < tracker->min_x) {
+        tracker->min_x = x;
+    } else if (x > tracker->max_x) {
+        tracker->max_x = x;
+    }
+    if (y < tracker->min_y) {
+        tracker->min_y = y;
+    } else if (y > tracker->max_y) {
+        tracker->max_y = y;
+    }
+}
+
+
+/**
+ * Remembers where the given QR codes are.
+ */
+static void remember_codes(struct qr_tracker* tracker, struct qr_code_match_list* list) {
+    tracker->n_codes = 0;
+    if (list == NULL) {
+        return;
+    }
+    tracker->min_x = tracker->max_x = list->top_left_x;
+    tracker->min_y = tracker->max_y = list->top_left_y;
+    for ( ; list != NULL ; list = list->next) {
+        tracker->n_codes++;
+        update_box(tracker, list->bottom_left_x, list->bottom_left_y);
+        update_box(tracker, list->top_left_x, list->top_left_y);
+        update_box(tracker, list->top_right_x, list->top_right_y);
+        update_box(tracker, list->bottom_right_x, list->bottom_right_y);
+    }
+}
+
+
+/**
+ * Copies into the region of the tracker the part of the image where the
+ * QR codes of the previous frame were, with a margin so that they can
+ * have moved a bit. The region starts on a block boundary, so that it is
+ * binarized the same way as it would be in the whole image.
+ *
+ * @return SUCCESS if the region was copied, in which case x and y are its
+ *                 position in the image
+ *         DECODING_ERROR if the region would be too small to be analyzed
+ *         MEMORY_ERROR in case of memory allocation error
+ */
+static int copy_region(struct qr_tracker* tracker, struct rgb_image* img, unsigned int *x, unsigned int *y) {
+    int width = tracker->max_x - tracker->min_x;
+    int height = tracker->max_y - tracker->min_y;
+    int margin = (width > height ? width : height) / 2 + BLOCK_SIZE;
+
+    int x0 = clamp(tracker->min_x - margin, img->width) / BLOCK_SIZE * BLOCK_SIZE;
+    int y0 = clamp(tracker->min_y - margin, img->height) / BLOCK_SIZE * BLOCK_SIZE;
+    int x1 = clamp(tracker->max_x + margin, img->width);
+    int y1 = clamp(tracker->max_y + margin, img->height);
+    if (x1 - x0 < MIN_REGION_SIZE || y1 - y0 < MIN_REGION_SIZE) {
+        return DECODING_ERROR;
+    }
+
+    struct rgb_image* region = &(tracker->region);
+    region->width = x1 - x0;
+    region->height = y1 - y0;
+    unsigned int size = region->width * region->height * 3;
+    if (size > tracker->region_capacity) {
+        qr_free(region->buffer);
+        region->buffer = (u_int8_t*)qr_malloc(size);
+        if (region->buffer == NULL) {
+            tracker->region_capacity = 0;
+            return MEMORY_ERROR;
+        }
+        tracker->region_capacity = size;
+    }
+    for (unsigned int i = 0 ; i < region->height ; i++) {
+        memcpy(region->buffer + i * region->width * 3,
+                img->buffer + ((y0 + i) * img->width + x0) * 3,
+                region->width * 3);
+    }
+    (*x) = x0;
+    (*y) = y0;
+    return SUCCESS;
+}
+
+
+/**
+ * Tries to find the QR codes of the previous frame in the region around them.
+ *
+ * @return SUCCESS if at least as many QR codes as in the previous frame were found
+ *         DECODING_ERROR if the whole frame has to be analyzed
+ *         MEMORY_ERROR in case of memory allocation error
+ */
+static int find_tracked_qr_codes(struct qr_tracker* tracker, struct qr_decoder* decoder, struct rgb_image* img,
+                                struct qr_code_match_list* *list) {
+    unsigned int x, y;
+    int res = copy_region(tracker, img, &x, &y);
+    if (res != SUCCESS) {
+        return res;
+    }
+    res = find_qr_codes_in_rgb_image(decoder, &(tracker->region), list, NULL);
+    if (res != SUCCESS) {
+        return res;
+    }
+
+    unsigned int n_codes = 0;
+    for (struct qr_code_match_list* match = (*list) ; match != NULL ; match = match->next) {
+        n_codes++;
+        match->bottom_left_x += x;
+        match->bottom_left_y += y;
+        match->top_left_x += x;
+        match->top_left_y += y;
+        match->top_right_x += x;
+        match->top_right_y += y;
+        match->bottom_right_x += x;
+        match->bottom_right_y += y;
+    }
+    if (n_codes < tracker->n_codes) {
+        // Some QR code was lost
+        free_qr_code_match_list(*list);
+        (*list) = NULL;
+        return DECODING_ERROR;
+    }
+    return SUCCESS;
+}
+
+
+int track_qr_codes(struct qr_tracker* tracker, struct qr_decoder* decoder, struct rgb_image* img,
+                    struct qr_code_match_list* *list) {
+    (*list) = NULL;
+    if (tracker->n_codes > 0 && tracker->n_frames_since_full_scan + 1 < tracker->full_scan_period) {
+        int res = find_tracked_qr_codes(tracker, decoder, img, list);
+        if (res == SUCCESS) {
+            tracker->n_frames_since_full_scan++;
+            remember_codes(tracker, *list);
+            return SUCCESS;
+        }
+        if (res == MEMORY_ERROR) {
+            return res;
+        }
+    }
+
+    tracker->n_full_scans++;
+    tracker->n_frames_since_full_scan = 0;
+    int res = find_qr_codes_in_rgb_image(decoder, img, list, NULL);
+    remember_codes(tracker, (res == SUCCESS) ? (*list) : NULL);
+    return res;
+}
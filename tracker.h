@@ -0,0 +1,51 @@
+#ifndef _TRACKER_H
+#define _TRACKER_H
+
+#include "qrcode.h"
+#include "rgbimage.h"
+
+
+/**
+ * In a video stream, a QR code found in a frame is almost always near the
+ * same place in the next frame. A tracker remembers where the QR codes of
+ * the previous frame were, so that the next frame can be decoded by only
+ * looking at the region around them, which is much cheaper than analyzing
+ * the whole frame. The whole frame is still analyzed periodically to find
+ * new QR codes, as well as whenever a QR code is lost.
+ */
+struct qr_tracker;
+
+
+/**
+ * Creates a tracker.
+ *
+ * @param full_scan_period The whole frame is analyzed at least once every
+ *                         full_scan_period frames. 0 or 1 means always
+ * @return The tracker or NULL in case of memory allocation error
+ */
+struct qr_tracker* new_qr_tracker(unsigned int full_scan_period);
+
+
+/**
+ * Frees all the memory associated to the given tracker.
+ */
+void free_qr_tracker(struct qr_tracker* tracker);
+
+
+/**
+ * Same as find_qr_codes_in_rgb_image() for the next frame of the stream
+ * followed by the given tracker. The coordinates of the matches are
+ * always relative to the whole frame.
+ */
+int track_qr_codes(struct qr_tracker* tracker, struct qr_decoder* decoder, struct rgb_image* img,
+                    struct qr_code_match_list* *list);
+
+
+/**
+ * Returns the number of frames that were analyzed as a whole since
+ * the tracker was created, as opposed to the ones for which only the
+ * regions around the known QR codes were analyzed.
+ */
+unsigned int get_n_full_scans(struct qr_tracker* tracker);
+
+#endif
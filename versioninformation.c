@@ -5,7 +5,7 @@
  * table D.1 in annex D of ISO/IEC 18004:2006 so that
  * code[x] is the sequence corresponding the version number (x + 7).
  */
-u_int32_t code[] = {
+static const u_int32_t code[] = {
     0x07C94,
     0x085BC,
     0x09A99,
@@ -145,6 +145,12 @@ int get_version_information(struct bit_matrix* bm, u_int8_t *version_info) {
         return DECODING_ERROR;
     }
 
+    // The codeword layout depends on the size of the matrix, so a version
+    // that does not match this size means that the modules were not sampled
+    // correctly and that the codewords cannot be decoded
+    if (bestValue != (*version_info)) {
+        return DECODING_ERROR;
+    }
     (*version_info) = bestValue;
     return SUCCESS;
 }